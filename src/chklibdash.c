@@ -3,7 +3,11 @@
  */
 
 #include "libdash.h"
+#include "parser.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 /* Configure the options being used by program */
 #define USE_FULL_TEST     0         /* Use individual tests */
@@ -138,12 +142,1051 @@ static bool push_and_tokenise(struct parse_context *ctx, const char *cmd)
   return true;
 }
 
+/* Return true if the two strings are the same or both missing */
+static bool same_text(const char *a, const char *b)
+{
+  return a == b || (a && b && !strcmp(a, b));
+}
+
+static bool same_node(union parse_node *, union parse_node *);
+
+/* Return true if the two lists hold the same nodes */
+static bool same_list(struct parse_nodelist *a, struct parse_nodelist *b)
+{
+  for (; a && b; a = a->next, b = b->next)
+    if (!same_node(a->node, b->node))
+      return false;
+  return !a && !b;
+}
+
+/* Return true if the children of the two n-ary nodes are the same */
+static bool same_child(union parse_node **a,
+                       union parse_node **b,
+                       uint32_t           count)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < count; idx++)
+    if (!same_node(a[idx], b[idx]))
+      return false;
+  return true;
+}
+
+/* Return true if the two trees are the same, apart from where they are held */
+static bool same_node(union parse_node *a, union parse_node *b)
+{
+  uint32_t idx;
+
+  if (!a || !b)
+    return a == b;
+  if (a->type != b->type)
+    return false;
+  switch (a->type) {
+  case NCMD:
+    return a->ncmd.linno == b->ncmd.linno && a->ncmd.cmdid == b->ncmd.cmdid &&
+        same_node(a->ncmd.assign, b->ncmd.assign) &&
+        same_node(a->ncmd.args, b->ncmd.args) &&
+        same_node(a->ncmd.redirect, b->ncmd.redirect);
+  case NPIPE:
+    return a->npipe.backgnd == b->npipe.backgnd &&
+        same_list(a->npipe.cmdlist, b->npipe.cmdlist);
+  case NREDIR:
+  case NBACKGND:
+  case NSUBSHELL:
+    /* The line is not set for a command run in the background */
+    return (a->type == NBACKGND || a->nredir.linno == b->nredir.linno) &&
+        same_node(a->nredir.node, b->nredir.node) &&
+        same_node(a->nredir.redirect, b->nredir.redirect);
+  case NAND:
+  case NOR:
+  case NSEMI:
+  case NWHILE:
+  case NUNTIL:
+    return same_node(a->nbinary.ch1, b->nbinary.ch1) &&
+        same_node(a->nbinary.ch2, b->nbinary.ch2);
+  case NIF:
+    return same_node(a->nif.test, b->nif.test) &&
+        same_node(a->nif.ifpart, b->nif.ifpart) &&
+        same_node(a->nif.elsepart, b->nif.elsepart);
+  case NFOR:
+    return a->nfor.linno == b->nfor.linno &&
+        same_text(a->nfor.var, b->nfor.var) &&
+        same_node(a->nfor.args, b->nfor.args) &&
+        same_node(a->nfor.body, b->nfor.body);
+  case NCASE:
+    return a->ncase.linno == b->ncase.linno &&
+        same_node(a->ncase.expr, b->ncase.expr) &&
+        same_node(a->ncase.cases, b->ncase.cases);
+  case NCLIST:
+    return same_node(a->nclist.pattern, b->nclist.pattern) &&
+        same_node(a->nclist.body, b->nclist.body) &&
+        same_node(a->nclist.next, b->nclist.next);
+  case NDEFUN:
+    return a->ndefun.linno == b->ndefun.linno &&
+        same_text(a->ndefun.text, b->ndefun.text) &&
+        same_node(a->ndefun.body, b->ndefun.body);
+  case NARG:
+    return same_text(a->narg.text, b->narg.text) &&
+        same_list(a->narg.backquote, b->narg.backquote) &&
+        same_node(a->narg.arith, b->narg.arith) &&
+        same_node(a->narg.next, b->narg.next);
+  case NTO:
+  case NCLOBBER:
+  case NFROM:
+  case NFROMTO:
+  case NAPPEND:
+    return a->nfile.fd == b->nfile.fd &&
+        same_node(a->nfile.fname, b->nfile.fname) &&
+        same_node(a->nfile.next, b->nfile.next);
+  case NTOFD:
+  case NFROMFD:
+    return a->ndup.fd == b->ndup.fd && a->ndup.dupfd == b->ndup.dupfd &&
+        same_node(a->ndup.vname, b->ndup.vname) &&
+        same_node(a->ndup.next, b->ndup.next);
+  case NHERE:
+  case NXHERE:
+    return a->nhere.fd == b->nhere.fd &&
+        same_node(a->nhere.doc, b->nhere.doc) &&
+        same_node(a->nhere.next, b->nhere.next);
+  case NNOT:
+    return same_node(a->nnot.com, b->nnot.com);
+  case NARITH:
+    if (a->narith.flags != b->narith.flags ||
+        a->narith.ninsn != b->narith.ninsn)
+      return false;
+    for (idx = 0; idx < a->narith.ninsn; idx++)
+      if (a->narith.insn[idx].op != b->narith.insn[idx].op ||
+          a->narith.insn[idx].arg != b->narith.insn[idx].arg)
+        return false;
+    return same_node(a->narith.next, b->narith.next);
+  case NERROR:
+    return a->nerror.linno == b->nerror.linno &&
+        a->nerror.diag == b->nerror.diag;
+  case NSEQ:
+    return a->nseq.count == b->nseq.count &&
+        same_child(a->nseq.child, b->nseq.child, a->nseq.count);
+  case NANDOR:
+    return a->nandor.count == b->nandor.count &&
+        !memcmp(a->nandor.op, b->nandor.op, a->nandor.count - 1) &&
+        same_child(a->nandor.child, b->nandor.child, a->nandor.count);
+  case NIFCHAIN:
+    return a->nifchain.count == b->nifchain.count &&
+        same_child(a->nifchain.child, b->nifchain.child,
+                   2 * a->nifchain.count) &&
+        same_node(a->nifchain.elsepart, b->nifchain.elsepart);
+  case NPIPELINE:
+    return a->npipeline.count == b->npipeline.count &&
+        a->npipeline.backgnd == b->npipeline.backgnd &&
+        same_child(a->npipeline.child, b->npipeline.child,
+                   a->npipeline.count);
+  default:
+    return true;
+  }
+}
+
+/* Parse the script with a context of its own, giving the context and the
+ * number of commands read or -1 if they could not all be read
+ */
+#define MAX_CMDS 64
+static long parse_script(struct parse_context **ctx,
+                         const char            *script,
+                         union parse_node     **cmd)
+{
+  union parse_node *n;
+  long count = 0;
+
+  if (!parse_new(ctx) || !parse_push_string(*ctx, script))
+    return -1;
+  while ((n = parse_next_command(*ctx)) && !parse_iseof(n)) {
+    if (count == MAX_CMDS)
+      return -1;
+    cmd[count++] = n;
+  }
+  return n ? count : -1;
+}
+
+/* Return true if the commands are those of a fresh parse of the script */
+static bool same_script(const char        *script,
+                        union parse_node **cmd,
+                        size_t             count)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *ref[MAX_CMDS];
+  long nref = parse_script(&ctx, script, ref);
+  bool ok = nref >= 0 && (size_t)nref == count;
+
+  for (; ok && nref-- > 0;)
+    ok = same_node(cmd[nref], ref[nref]);
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that a backslash-newline is removed wherever it splits a token, the
+ * lines it ends still being counted
+ */
+static bool chk_bnl(void)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *cmd[MAX_CMDS];
+  bool ok = parse_script(&ctx, "ec\\\nho a\\\nb |\\\n| c\\\nat\\\n "
+                         "<\\\n<E\nx\\\ny\nE\n", cmd) == 1 &&
+      same_script("\necho ab ||\n\n\n\ncat <<E\nxy\nE\n", cmd, 1);
+
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check the whole token stream of a script, keywords being recognised */
+static bool chk_tokenize_all(void)
+{
+  static const char script[] = "if a; then b | c >d; fi\n";
+  static const uint8_t expect[] = {
+    TIF, TWORD, TSEMI, TTHEN, TWORD, TPIPE, TWORD, TREDIR, TWORD, TSEMI, TFI,
+    TNL
+  };
+  struct parse_context *ctx = NULL;
+  struct parse_token_stream ts = { 0 };
+  bool ok = false;
+
+  if (parse_new(&ctx) && parse_push_string(ctx, script) &&
+      parse_tokenize_all(ctx, &ts))
+    ok = ts.count == sizeof(expect) && !memcmp(ts.id, expect, ts.count) &&
+        ts.start[3] == 6 && ts.length[3] == 4 &&
+        ts.start[7] == 17 && ts.length[7] == 1;
+  parse_token_stream_free(&ts);
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that interning stores repeated words once without changing them */
+static bool chk_intern(void)
+{
+  static const char script[] = "echo some-word\necho some-word some-word\n";
+  struct parse_context *ctx = NULL;
+  union parse_node *cmd[MAX_CMDS];
+  long count;
+  bool ok = false;
+
+  if (parse_new(&ctx) && parse_set_intern(ctx, true) &&
+      parse_push_string(ctx, script)) {
+    for (count = 0; count < 2; count++)
+      cmd[count] = parse_next_command(ctx);
+    ok = cmd[0] && cmd[1] && parse_intern_saved(ctx) >= 2 * 10 &&
+        cmd[0]->ncmd.args->narg.next->narg.text ==
+        cmd[1]->ncmd.args->narg.next->narg.text &&
+        same_script(script, cmd, 2);
+  }
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that an alias is expanded as its text would be read, and no longer
+ * once it is removed
+ */
+static bool chk_alias(void)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *cmd[2];
+  bool ok = false;
+
+  if (parse_new(&ctx) && parse_alias_set(ctx, "ll", "ls -l ") &&
+      parse_alias_set(ctx, "x", "| wc") &&
+      parse_push_string(ctx, "ll x\n") &&
+      (cmd[0] = parse_next_command(ctx)) &&
+      parse_alias_clear(ctx, "ll") && parse_push_string(ctx, "ll x\n") &&
+      (cmd[1] = parse_next_command(ctx)))
+    ok = same_script("ls -l | wc\n", cmd, 1) &&
+        same_script("ll x\n", cmd + 1, 1);
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that the tokens kept over edits are those of the text edited, which
+ * are only complete when the text can be read to its end
+ */
+static bool chk_relex(void)
+{
+  static const struct {
+    size_t      offset;
+    size_t      dellen;
+    const char *ins;
+  } edit[] = {
+    { 5, 1, "'x y" },
+    { 9, 0, "'; echo c" },
+    { 0, 4, "printf" },
+    { 0, 0, "a=1 \\\n" }
+  };
+  char text[256] = "echo a; ls b >c\nwhile :; do :; done\n";
+  struct parse_relex *rl = NULL;
+  struct parse_context *ctx = NULL;
+  struct parse_token_stream ts = { 0 };
+  const struct parse_token_stream *got;
+  size_t idx, len = strlen(text), inslen;
+  bool lexed, ok = parse_relex_new(&rl, text, len);
+
+  for (idx = 0; ok && idx < sizeof(edit) / sizeof(edit[0]); idx++) {
+    inslen = strlen(edit[idx].ins);
+    memmove(text + edit[idx].offset + inslen,
+            text + edit[idx].offset + edit[idx].dellen,
+            len - edit[idx].offset - edit[idx].dellen + 1);
+    memcpy(text + edit[idx].offset, edit[idx].ins, inslen);
+    len += inslen - edit[idx].dellen;
+    lexed = parse_new(&ctx) && parse_push_string(ctx, text) &&
+        parse_tokenize_all(ctx, &ts);
+    ok = parse_relex_edit(rl, edit[idx].offset, edit[idx].dellen,
+                          edit[idx].ins, inslen) &&
+        parse_relex_complete(rl) == lexed && (got = parse_relex_tokens(rl)) &&
+        (!lexed || (got->count == ts.count &&
+                    !memcmp(got->id, ts.id, ts.count) &&
+                    !memcmp(got->start, ts.start,
+                            ts.count * sizeof(uint32_t)) &&
+                    !memcmp(got->length, ts.length,
+                            ts.count * sizeof(uint32_t))));
+    parse_token_stream_free(&ts);
+    parse_free(&ctx);
+  }
+  parse_relex_free(&rl);
+  return ok;
+}
+
+/* Return the first command of the script, held by the given context */
+static union parse_node *first_command(struct parse_context **ctx,
+                                       const char            *script)
+{
+  union parse_node *cmd[MAX_CMDS];
+
+  return parse_script(ctx, script, cmd) > 0 ? cmd[0] : NULL;
+}
+
+/* Return the flags of the first arithmetic expansion in the given expression,
+ * or -1 if it could not be parsed
+ */
+static int arith_flags(const char *expr)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *n;
+  size_t len = strlen(expr);
+  char *script = malloc(len + 16);
+  int flags = -1;
+
+  if (script) {
+    sprintf(script, "echo $((%s))\n", expr);
+    if ((n = first_command(&ctx, script)) && n->type == NCMD &&
+        n->ncmd.args->narg.next && n->ncmd.args->narg.next->narg.arith)
+      flags = n->ncmd.args->narg.next->narg.arith->narith.flags;
+  }
+  parse_free(&ctx);
+  free(script);
+  return flags;
+}
+
+/* Return an expression made of the head repeated, the middle and then the
+ * tail repeated
+ */
+static char *arith_nest(const char *head, const char *mid, const char *tail,
+                        size_t count)
+{
+  size_t hlen = strlen(head), tlen = strlen(tail), idx;
+  char *expr = malloc(count * (hlen + tlen) + strlen(mid) + 1), *p = expr;
+
+  if (expr) {
+    for (idx = 0; idx < count; idx++, p += hlen)
+      memcpy(p, head, hlen);
+    p = stpcpy(p, mid);
+    for (idx = 0; idx < count; idx++, p += tlen)
+      memcpy(p, tail, tlen);
+    *p = '\0';
+  }
+  return expr;
+}
+
+/* Check that an arithmetic expansion nested too deeply is marked invalid,
+ * however it is nested, while a long chain of conditionals is not
+ */
+static bool chk_arith_depth(void)
+{
+  static const struct {
+    const char *head;
+    const char *mid;
+    const char *tail;
+    size_t      count;
+    bool        valid;
+  } test[] = {
+    { "(", "1", ")", 100, true },
+    { "(", "1", ")", 1000, false },
+    { "-", "1", "", 1000, false },
+    { "1?", "1", ":0", 100, true },
+    { "1?", "1", ":0", 1000, false },
+    { "0?0:", "1", "", 1000, true }
+  };
+  size_t idx;
+  char *expr;
+  int flags;
+  bool ok = true;
+
+  for (idx = 0; ok && idx < sizeof(test) / sizeof(test[0]); idx++) {
+    expr = arith_nest(test[idx].head, test[idx].mid, test[idx].tail,
+                      test[idx].count);
+    flags = expr ? arith_flags(expr) : -1;
+    ok = flags >= 0 && !(flags & AF_INVALID) == test[idx].valid;
+    free(expr);
+  }
+  return ok;
+}
+
+/* Check the segments of a word holding each kind of expansion */
+static bool chk_segments(void)
+{
+  static const uint8_t expect[] = {
+    SEG_LITERAL, SEG_VAR, SEG_BACKQ, SEG_ARITH, SEG_LITERAL
+  };
+  struct parse_context *ctx = NULL;
+  union parse_node *n, *arg;
+  uint32_t idx;
+  bool ok = false;
+
+  if (parse_new(&ctx) && parse_set_segments(ctx, true) &&
+      parse_push_string(ctx, "echo a${b}$(c)$((1))'d'\n") &&
+      (n = parse_next_command(ctx)) && (arg = n->ncmd.args->narg.next) &&
+      arg->narg.nseg == sizeof(expect)) {
+    for (ok = true, idx = 0; ok && idx < arg->narg.nseg; idx++)
+      ok = arg->narg.seg[idx].kind == expect[idx];
+    ok = ok && same_text(arg->narg.seg[1].name, "b");
+  }
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check the literal text of quoted words, and that a word with an expansion
+ * has none
+ */
+static bool chk_unescape(void)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *n, *arg;
+  char buf[64], out[64];
+  const char *lit;
+  size_t len;
+  bool ok = false;
+
+  if ((n = first_command(&ctx, "echo 'a b'\"c\\$\"d $e\n")) &&
+      (arg = n->ncmd.args->narg.next) &&
+      (lit = parse_word_literal(arg, buf, sizeof(buf), &len)))
+    ok = len == 6 && !memcmp(lit, "a bc$d", 6) &&
+        parse_word_unescape(arg->narg.text, strlen(arg->narg.text), out) == 6 &&
+        !memcmp(out, "a bc$d", 6) &&
+        !parse_word_literal(arg->narg.next, buf, sizeof(buf), &len);
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that the tokens compared with the reference paths agree, when the
+ * comparison is built in
+ */
+static bool chk_shadow(void)
+{
+  struct parse_context *ctx = NULL;
+  struct parse_shadow_report rep;
+  union parse_node *n;
+  bool ok = false;
+
+  if (!parse_new(&ctx))
+    return false;
+  if (!parse_set_shadow(ctx, 1)) {
+    ok = true;
+  } else if (parse_push_string(ctx, "a \\\nb 'c\nd' <<E\n$x\nE\n")) {
+    while ((n = parse_next_command(ctx)) && !parse_iseof(n))
+      ;
+    ok = n && parse_shadow_report(ctx, &rep) && rep.compared > 0 &&
+        !rep.diverged;
+  }
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Return a script of commands nested to the given depth */
+static char *nest_script(size_t depth)
+{
+  return arith_nest("( ", ":", " )", depth);
+}
+
+/* Check that the depth of nesting is limited without using the stack */
+static bool chk_maxdepth(void)
+{
+  struct parse_context *ctx = NULL, *chk = NULL;
+  struct parse_diag diag;
+  union parse_node *n = NULL;
+  char *deep = nest_script(100000), *shallow = nest_script(50);
+  bool ok = false;
+
+  if (deep && shallow && parse_new(&ctx) && parse_set_maxdepth(ctx, 60) &&
+      parse_push_string(ctx, shallow) && (n = parse_next_command(ctx)) &&
+      n->type == NSUBSHELL && parse_push_string(ctx, deep) &&
+      parse_new(&chk) && parse_set_maxdepth(chk, 60) &&
+      parse_push_string(chk, deep))
+    ok = !parse_next_command(ctx) && !parse_check(chk, &diag) &&
+        diag.code == SE_TOODEEP;
+  parse_free(&chk);
+  parse_free(&ctx);
+  free(deep);
+  free(shallow);
+  return ok;
+}
+
+/* Return a script of many top-level commands of each kind */
+static char *many_commands(size_t count)
+{
+  static const char part[] =
+    "echo $i \"$(date)\" >>log\n"
+    "f() { case $1 in a) echo a;; *) cat <<E\nbody $1\nE\n;; esac; }\n"
+    "if test -f x; then rm x; else touch x; fi &\n";
+  char *script = malloc(count * (sizeof(part) - 1) + 1), *p = script;
+
+  if (script) {
+    while (count--)
+      p = stpcpy(p, part);
+    *p = '\0';
+  }
+  return script;
+}
+
+/* Check that a script parsed in parallel gives the commands it would give
+ * when parsed in one go
+ */
+static bool chk_parallel(void)
+{
+  struct parse_command_set set = { 0 };
+  struct parse_context *ctx = NULL;
+  union parse_node *n;
+  char *script = many_commands(2000);
+  size_t idx = 0;
+  bool ok = false;
+
+  if (script && parse_parallel(NULL, script, strlen(script), 4, &set) &&
+      !set.error && set.count == 3 * 2000 && parse_new(&ctx) &&
+      parse_push_string(ctx, script)) {
+    while ((n = parse_next_command(ctx)) && !parse_iseof(n) &&
+           same_node(n, set.cmd[idx]))
+      idx++;
+    ok = n && parse_iseof(n) && idx == set.count;
+  }
+  parse_free(&ctx);
+  parse_command_set_free(&set);
+  free(script);
+  return ok;
+}
+
+/* Return true if a syntax error is found in the script */
+static bool script_fails(const char *script)
+{
+  struct parse_context *ctx = NULL;
+  struct parse_diag diag;
+  bool fails = parse_new(&ctx) && parse_push_string(ctx, script) &&
+      !parse_check(ctx, &diag) && diag.code != SE_NONE;
+
+  parse_free(&ctx);
+  return fails;
+}
+
+/* Check that the commands kept over edits are those of a fresh parse */
+static bool chk_reparse(void)
+{
+  static const struct {
+    size_t      offset;
+    size_t      dellen;
+    const char *ins;
+  } edit[] = {
+    { 5, 1, "changed" },
+    { 0, 0, "echo first\n" },
+    { 11, 0, "if :; then\n" },
+    { 43, 0, "fi\n" },
+    { 0, 11, "" },
+    { 6, 0, "'" },
+    { 6, 1, "" }
+  };
+  char text[512] = "echo a; echo b\nfor i in 1 2; do\n  echo $i\ndone\n"
+      "cat <<E\nbody\nE\necho last\n";
+  const struct parse_command_set *set;
+  struct parse_reparse *rp = NULL;
+  size_t idx, len = strlen(text), inslen;
+  bool ok = parse_reparse_new(&rp, NULL, text, len);
+
+  for (idx = 0; ok && idx < sizeof(edit) / sizeof(edit[0]); idx++) {
+    inslen = strlen(edit[idx].ins);
+    memmove(text + edit[idx].offset + inslen,
+            text + edit[idx].offset + edit[idx].dellen,
+            len - edit[idx].offset - edit[idx].dellen + 1);
+    memcpy(text + edit[idx].offset, edit[idx].ins, inslen);
+    len += inslen - edit[idx].dellen;
+    ok = parse_reparse_edit(rp, edit[idx].offset, edit[idx].dellen,
+                            edit[idx].ins, inslen) &&
+        (set = parse_reparse_commands(rp)) &&
+        (set->error ? script_fails(text) :
+         same_script(text, set->cmd, set->count));
+  }
+  parse_reparse_free(&rp);
+  return ok;
+}
+
+/* Check that a whole script is parsed into the commands read one by one */
+static bool chk_parse_all(void)
+{
+  struct parse_context *ctx = NULL;
+  struct parse_script *all = NULL;
+  char *script = many_commands(20);
+  bool ok = false;
+
+  if (script && parse_new(&ctx) && parse_push_string(ctx, script) &&
+      parse_all(ctx, &all))
+    ok = !all->error && all->count == 3 * 20 && all->memory > 0 &&
+        same_script(script, all->cmd, all->count);
+  parse_free(&ctx);
+  if (ok && parse_new(&ctx) && parse_push_string(ctx, "echo a\nfi\n"))
+    ok = parse_all(ctx, &all) && all->error && all->count == 1;
+  parse_free(&ctx);
+  free(script);
+  return ok;
+}
+
+/* Check that the commands around a syntax error are kept, the error being
+ * noted in its place
+ */
+static bool chk_recover(void)
+{
+  struct parse_context *ctx = NULL;
+  const struct parse_diag *diag;
+  union parse_node *cmd[4], *n;
+  size_t count = 0;
+  bool ok = false;
+
+  if (parse_new(&ctx) && parse_set_recover(ctx, true) &&
+      parse_push_string(ctx, "echo a\nfi; echo x\necho b\n")) {
+    while ((n = parse_next_command(ctx)) && !parse_iseof(n) && count < 4)
+      cmd[count++] = n;
+    ok = n && parse_iseof(n) && count == 4 && cmd[1]->type == NERROR &&
+        cmd[1]->nerror.linno == 2 &&
+        (diag = parse_diagnostics(ctx, &count)) && count == 1 &&
+        diag->line == 2 && diag->found == TFI &&
+        same_script("echo a\n", cmd, 1) &&
+        same_script("\necho x\necho b\n", cmd + 2, 2);
+  }
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that a command substitution is parsed with the word holding it, as
+ * the older form is
+ */
+static bool chk_cmdsubst(void)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *n, *arg;
+  bool ok = false;
+
+  if ((n = first_command(&ctx, "echo a$(echo \"$(echo ')')\"; cat)b\n")) &&
+      (arg = n->ncmd.args->narg.next) && arg->narg.backquote &&
+      !arg->narg.backquote->next)
+    ok = same_script("echo \"$(echo ')')\"; cat\n",
+                     &arg->narg.backquote->node, 1) &&
+        same_script("echo a`echo \"\\`echo ')'\\`\"; cat`b\n", &n, 1) &&
+        script_fails("echo $(echo\n") && script_fails("echo $(fi)\n");
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check the n-ary nodes built in place of chains */
+static bool chk_nary(void)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *n[4];
+  bool ok = false;
+
+  if (parse_new(&ctx) && parse_set_nary(ctx, true) &&
+      parse_push_string(ctx, "a; b; c\na && b || c\na | b | c\n"
+                        "if a; then b; elif c; then d; else e; fi\n") &&
+      (n[0] = parse_next_command(ctx)) && (n[1] = parse_next_command(ctx)) &&
+      (n[2] = parse_next_command(ctx)) && (n[3] = parse_next_command(ctx)))
+    ok = n[0]->type == NSEQ && n[0]->nseq.count == 3 &&
+        n[1]->type == NANDOR && n[1]->nandor.count == 3 &&
+        n[1]->nandor.op[0] == NAND && n[1]->nandor.op[1] == NOR &&
+        n[2]->type == NPIPELINE && n[2]->npipeline.count == 3 &&
+        n[3]->type == NIFCHAIN && n[3]->nifchain.count == 2 &&
+        n[3]->nifchain.elsepart;
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that a script is validated, the first syntax error being given */
+static bool chk_check(void)
+{
+  struct parse_context *ctx = NULL;
+  struct parse_diag diag;
+  char *script = many_commands(100);
+  bool ok = false;
+
+  if (script && parse_new(&ctx) && parse_push_string(ctx, script) &&
+      parse_check(ctx, &diag)) {
+    parse_free(&ctx);
+    ok = parse_new(&ctx) &&
+        parse_push_string(ctx, "echo a\nwhile :; do\n  :\nfi\n") &&
+        !parse_check(ctx, &diag) && diag.code == SE_EXPECTED &&
+        diag.expect == TDONE && diag.found == TFI && diag.line == 4 &&
+        diag.offset == 23;
+  }
+  parse_free(&ctx);
+  free(script);
+  return ok;
+}
+
+/* Check that the commands of an outline, and the body of its function, are
+ * those parsed in one go
+ */
+static bool chk_outline(void)
+{
+  static const char script[] = "echo a\nf() {\n  echo b\n  echo c\n}\n"
+      "cat <<E; echo d\nbody\nE\n";
+  struct parse_outline *ol = NULL;
+  struct parse_context *ctx = NULL;
+  const struct parse_outline_entry *ent;
+  union parse_node *cmd[MAX_CMDS], *n;
+  size_t count, idx;
+  bool ok = false;
+
+  if (parse_outline_new(&ol, NULL, script, strlen(script)) &&
+      !parse_outline_error(ol) &&
+      (ent = parse_outline_entries(ol, &count)) &&
+      parse_script(&ctx, script, cmd) == (long)count && count == 3 &&
+      same_text(ent[1].name, "f") && ent[1].line == 2) {
+    for (ok = true, idx = 0; ok && idx < count; idx++)
+      ok = ent[idx].kind == cmd[idx]->type &&
+          (n = parse_materialise(ol, &ent[idx], false)) &&
+          same_node(n, cmd[idx]);
+    ok = ok && (n = parse_materialise(ol, &ent[1], true)) &&
+        same_node(n, cmd[1]->ndefun.body);
+  }
+  parse_free(&ctx);
+  parse_outline_free(&ol);
+  return ok;
+}
+
+/* Count the events given for a script */
+struct event_count {
+  size_t begin;
+  size_t end;
+  size_t word;
+  size_t redir;
+  size_t pipe;
+};
+
+static bool count_begin(void *arg, int type, unsigned int line)
+{
+  ((struct event_count *)arg)->begin++;
+  return true;
+}
+
+static bool count_word(void *arg, const char *text, size_t len,
+                       unsigned int flags)
+{
+  ((struct event_count *)arg)->word++;
+  return true;
+}
+
+static bool count_redir(void *arg, int type, int fd, const char *text,
+                        size_t len)
+{
+  ((struct event_count *)arg)->redir++;
+  return true;
+}
+
+static bool count_token(void *arg, int tokid)
+{
+  if (tokid == TPIPE)
+    ((struct event_count *)arg)->pipe++;
+  return true;
+}
+
+static bool stop_word(void *arg, const char *text, size_t len,
+                       unsigned int flags)
+{
+  ((struct event_count *)arg)->word++;
+  return false;
+}
+
+static bool count_end(void *arg, int type)
+{
+  ((struct event_count *)arg)->end++;
+  return true;
+}
+
+/* Check the events given for a script, and that a callback can stop them */
+static bool chk_events(void)
+{
+  struct event_count count = { 0 };
+  struct parse_events ev = {
+    &count, count_begin, count_word, count_redir, count_token, count_end
+  };
+  struct parse_context *ctx = NULL;
+  struct parse_diag diag;
+  bool ok = false;
+
+  if (parse_new(&ctx) &&
+      parse_push_string(ctx, "echo a b | cat >out\n{ ls; }\n") &&
+      parse_events(ctx, &ev, &diag))
+    ok = count.begin && count.begin == count.end && count.word == 5 &&
+        count.redir == 1 && count.pipe == 1;
+  parse_free(&ctx);
+  ev.word = stop_word;
+  if (ok && parse_new(&ctx) && parse_push_string(ctx, "echo a\necho b\n"))
+    ok = !parse_events(ctx, &ev, &diag) && count.word == 5 + 1 &&
+        !strcmp(parse_internal_errstr(ctx), "Stopped by an event callback");
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that a checkpoint, once stored, lets another context carry on from
+ * it with the commands that follow it
+ */
+static bool chk_checkpoint(void)
+{
+  static const char script[] = "echo a\nf() {\n  :\n}\nalias x=y\n"
+      "cat <<E\nbody\nE\necho b\n";
+  struct parse_context *ctx = NULL, *resumed = NULL;
+  struct parse_checkpoint cp;
+  union parse_node *cmd[MAX_CMDS], *n;
+  unsigned char saved[sizeof(cp)];
+  long count, idx;
+  bool ok = false;
+
+  /* The checkpoint is taken after the function and kept only as bytes */
+  if (parse_new(&ctx) && parse_push_string(ctx, script) &&
+      parse_next_command(ctx) && parse_next_command(ctx) &&
+      parse_checkpoint(ctx, &cp)) {
+    memcpy(saved, &cp, sizeof(cp));
+    parse_free(&ctx);
+    count = parse_script(&ctx, script, cmd);
+    memcpy(&cp, saved, sizeof(cp));
+    ok = count == 5 && cp.index == 2 && cp.line == 5 &&
+        parse_new(&resumed) && parse_push_string(resumed, script) &&
+        parse_resume(resumed, &cp);
+    for (idx = 2; ok && idx <= count; idx++)
+      ok = (n = parse_next_command(resumed)) &&
+          (idx < count ? same_node(n, cmd[idx]) : parse_iseof(n));
+  }
+  parse_free(&resumed);
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check that each limit stops the parse of a script that goes beyond it */
+static bool chk_limits(void)
+{
+  static const struct {
+    struct parse_limits limits;
+    const char         *error;
+  } test[] = {
+    { { 0, 0, 1000, 0, 0 }, "Input limit reached" },
+    { { 0, 0, 0, 1000, 0 }, "Node limit reached" },
+    { { 0, 0, 0, 0, 100000 }, "Memory limit reached" }
+  };
+  struct parse_context *ctx = NULL;
+  union parse_node *n;
+  char *script = many_commands(100);
+  size_t idx;
+  bool ok = script != NULL;
+
+  for (idx = 0; ok && idx < sizeof(test) / sizeof(test[0]); idx++) {
+    ok = parse_new(&ctx) && parse_set_limits(ctx, &test[idx].limits) &&
+        parse_push_string(ctx, script);
+    while (ok && (n = parse_next_command(ctx)) && !parse_iseof(n))
+      ;
+    ok = ok && !n && same_text(parse_internal_errstr(ctx), test[idx].error);
+    parse_free(&ctx);
+  }
+  if (ok) {
+    struct parse_limits limits = { 0, 0, 0, 1000, 0 };
+
+    ok = parse_new(&ctx) && parse_set_limits(ctx, &limits) &&
+        parse_push_string(ctx, "echo a\n") && parse_next_command(ctx) &&
+        !parse_internal_errstr(ctx);
+    parse_free(&ctx);
+  }
+  free(script);
+  return ok;
+}
+
+/* Check that a command parsed in steps is the one parsed in one go */
+static bool chk_step(void)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *cmd[MAX_CMDS], *n;
+  char *script = many_commands(1);
+  size_t pending = 0;
+  long count = 0;
+  bool ok = false;
+
+  if (script && parse_new(&ctx) && parse_push_string(ctx, script)) {
+    while ((n = parse_step(ctx, 8)) && count < MAX_CMDS && !parse_iseof(n)) {
+      if (parse_ispending(n))
+        pending++;
+      else
+        cmd[count++] = n;
+    }
+    ok = n && parse_iseof(n) && pending > 3 && same_script(script, cmd, count);
+  }
+  parse_free(&ctx);
+  free(script);
+  return ok;
+}
+
+/* Check whether the input fed a line at a time ends within a command */
+static bool chk_feed(void)
+{
+  static const struct {
+    const char *line;
+    bool        more;
+  } test[] = {
+    { "echo a\n", false },
+    { "if true; then\n", true },
+    { "  echo 'b\n", true },
+    { "c'\n", true },
+    { "fi\n", false },
+    { "cat <<E; echo $(\n", true },
+    { "echo x)\n", true },
+    { "body\n", true },
+    { "E\n", false },
+    { "echo a |\n", true },
+    { "# comment\n", true },
+    { "cat \\\n", true },
+    { "\n", false },
+    { "# comment\n", false },
+    { "echo )\n", false }
+  };
+  struct parse_context *ctx = NULL;
+  size_t idx;
+  bool ok = parse_new(&ctx);
+
+  for (idx = 0; ok && idx < sizeof(test) / sizeof(test[0]); idx++)
+    ok = parse_feed(ctx, test[idx].line, strlen(test[idx].line)) &&
+        parse_needs_more(ctx) == test[idx].more;
+  if (ok) {
+    parse_feed_clear(ctx);
+    ok = !parse_needs_more(ctx) &&
+        parse_alias_set(ctx, "begin", "if :; then") &&
+        parse_feed(ctx, "begin\n", 6) && parse_needs_more(ctx) &&
+        parse_feed(ctx, "fi\n", 3) && !parse_needs_more(ctx);
+  }
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Check the builtin found to be run by each command */
+static bool chk_builtin(void)
+{
+  static const char *expect[] = {
+    "echo", "cd", ".", NULL, NULL, "[", "true"
+  };
+  struct parse_context *ctx = NULL;
+  union parse_node *cmd[MAX_CMDS];
+  long idx;
+  bool ok = parse_script(&ctx, "echo a\ncd /\n. x\nfoo\n$cmd\n[ -f x ]\n"
+                         "a=1 true\n", cmd) == 7;
+
+  for (idx = 0; ok && idx < 7; idx++)
+    ok = cmd[idx]->type == NCMD &&
+        same_text(parse_command_name(cmd[idx]->ncmd.cmdid), expect[idx]);
+  parse_free(&ctx);
+  return ok;
+}
+
+/* Write a file of the given text in the given directory */
+static bool write_file(const char *dir, const char *name, const char *text,
+                       char *path, size_t size)
+{
+  FILE *f;
+  bool ok;
+
+  if ((size_t)snprintf(path, size, "%s/%s", dir, name) >= size ||
+      !(f = fopen(path, "w")))
+    return false;
+  ok = fputs(text, f) >= 0;
+  return fclose(f) == 0 && ok;
+}
+
+/* Check that each file read by the dot command is parsed once, whether it
+ * is reached again through a hard link or by a cycle of files
+ */
+static bool chk_follow(void)
+{
+  char dir[] = "/tmp/chklibdashXXXXXX";
+  char main_sh[256] = "", a_sh[256] = "", b_sh[256] = "", text[600];
+  struct parse_context *ctx = NULL;
+  struct parse_sourced_set set = { 0, NULL };
+  struct parse_sourced *top, *a;
+  bool ok = false;
+
+  if (!mkdtemp(dir))
+    return false;
+  snprintf(text, sizeof(text), ". %s/a.sh\n. %s/b.sh\n", dir, dir);
+  if (write_file(dir, "main.sh", text, main_sh, sizeof(main_sh)) &&
+      snprintf(text, sizeof(text), "echo a\n. %s\n", main_sh) > 0 &&
+      write_file(dir, "a.sh", text, a_sh, sizeof(a_sh)) &&
+      snprintf(b_sh, sizeof(b_sh), "%s/b.sh", dir) > 0 &&
+      link(a_sh, b_sh) == 0 && parse_new(&ctx) &&
+      parse_follow(ctx, main_sh, "", 4, &set) && set.count == 2) {
+    top = set.file[0];
+    a = set.file[1];
+    ok = !top->error && !a->error && top->count == 2 && a->count == 2 &&
+        top->cmd[0]->ncmd.sourced == a && top->cmd[1]->ncmd.sourced == a &&
+        a->cmd[0]->ncmd.sourced == NULL && a->cmd[1]->ncmd.sourced == top;
+  }
+  parse_sourced_set_free(&set);
+  parse_free(&ctx);
+  unlink(b_sh);
+  unlink(a_sh);
+  unlink(main_sh);
+  rmdir(dir);
+  return ok;
+}
+
+/* Define the checks of the interfaces, run after the tokeniser tests */
+static const struct {
+  const char  *name;
+  bool       (*run)(void);
+} check[] = {
+  { "bnl", chk_bnl },
+  { "tokenize_all", chk_tokenize_all },
+  { "intern", chk_intern },
+  { "alias", chk_alias },
+  { "relex", chk_relex },
+  { "arith_depth", chk_arith_depth },
+  { "segments", chk_segments },
+  { "unescape", chk_unescape },
+  { "shadow", chk_shadow },
+  { "maxdepth", chk_maxdepth },
+  { "parallel", chk_parallel },
+  { "reparse", chk_reparse },
+  { "parse_all", chk_parse_all },
+  { "recover", chk_recover },
+  { "cmdsubst", chk_cmdsubst },
+  { "nary", chk_nary },
+  { "check", chk_check },
+  { "outline", chk_outline },
+  { "events", chk_events },
+  { "checkpoint", chk_checkpoint },
+  { "limits", chk_limits },
+  { "step", chk_step },
+  { "feed", chk_feed },
+  { "builtin", chk_builtin },
+  { "follow", chk_follow }
+};
+
 /* Perform the tokeniser tests */
 # define PUSH_TOKEN(cmd) \
   if (!push_and_tokenise(ctx, cmd)) { ret=numtest; goto finish; }
 
 int main(void) {
   struct parse_context *ctx = NULL;
+  size_t idx;
   int ret = 0;
 
   if (!parse_new(&ctx)) {
@@ -157,6 +1200,15 @@ int main(void) {
   PUSH_TOKEN(NULL);
   PUSH_TOKEN(NULL);
   PUSH_TOKEN(NULL);
+  for (idx = 0; idx < sizeof(check) / sizeof(check[0]); idx++) {
+    if (check[idx].run()) {
+      printf("%zd: CHECK: %s OK\n", numtest, check[idx].name);
+    } else {
+      printf("%zd: CHECK: %s FAILED\n", numtest, check[idx].name);
+      if (!ret) ret = numtest;
+    }
+    numtest++;
+  }
 finish:
   parse_free(&ctx);
   return ret;
@@ -6,9 +6,13 @@
 
 #include <stdbool.h>
 #include "enums.h"
+#include "structs.h"
 
 /* Provide opaque types to library structures and unions */
 struct parse_context;
+struct parse_relex;
+struct parse_reparse;
+struct parse_outline;
 #ifdef USE_WALKINFO
 struct parse_walkinfo;
 #else
@@ -29,6 +33,70 @@ bool parse_walk_free(struct parse_walkinfo **);
 int parse_walk_type(struct parse_walkinfo *);
 #else
 bool parse_iseof(union parse_node *);
+bool parse_ispending(union parse_node *);
 union parse_node *parse_next_command(struct parse_context *);
+union parse_node *parse_step(struct parse_context *, size_t);
 #endif
+bool parse_all(struct parse_context *, struct parse_script **);
+bool parse_check(struct parse_context *, struct parse_diag *);
+bool parse_checkpoint(struct parse_context *, struct parse_checkpoint *);
+bool parse_resume(struct parse_context *, const struct parse_checkpoint *);
+bool parse_events(struct parse_context *, const struct parse_events *,
+    struct parse_diag *);
 enum parse_tokid parse_next_token(struct parse_context *);
+bool parse_tokenize_all(struct parse_context *, struct parse_token_stream *);
+void parse_token_stream_free(struct parse_token_stream *);
+bool parse_feed(struct parse_context *, const char *, size_t);
+bool parse_needs_more(struct parse_context *);
+void parse_feed_clear(struct parse_context *);
+bool parse_set_intern(struct parse_context *, bool);
+size_t parse_intern_saved(struct parse_context *);
+bool parse_set_segments(struct parse_context *, bool);
+bool parse_set_nary(struct parse_context *, bool);
+bool parse_set_maxdepth(struct parse_context *, unsigned int);
+bool parse_set_limits(struct parse_context *, const struct parse_limits *);
+bool parse_set_recover(struct parse_context *, bool);
+const struct parse_diag *parse_diagnostics(struct parse_context *, size_t *);
+bool parse_set_shadow(struct parse_context *, unsigned int);
+bool parse_shadow_report(struct parse_context *, struct parse_shadow_report *);
+bool parse_parallel(struct parse_context *, const char *, size_t, unsigned int,
+    struct parse_command_set *);
+void parse_command_set_free(struct parse_command_set *);
+bool parse_follow(struct parse_context *, const char *, const char *,
+    unsigned int, struct parse_sourced_set *);
+void parse_sourced_set_free(struct parse_sourced_set *);
+size_t parse_word_unescape(const char *, size_t, char *);
+#ifndef USE_WALKINFO
+const char *parse_word_literal(union parse_node *, char *, size_t, size_t *);
+#endif
+const char *parse_command_name(enum parse_cmdid);
+bool parse_alias_set(struct parse_context *, const char *, const char *);
+bool parse_alias_clear(struct parse_context *, const char *);
+
+/* Provide the interface used to keep the tokens of an edited buffer */
+bool parse_relex_new(struct parse_relex **, const char *, size_t);
+bool parse_relex_edit(struct parse_relex *, size_t, size_t, const char *, size_t);
+const struct parse_token_stream *parse_relex_tokens(struct parse_relex *);
+bool parse_relex_complete(struct parse_relex *);
+size_t parse_relex_lexed(struct parse_relex *);
+void parse_relex_free(struct parse_relex **);
+
+/* Provide the interface used to keep the commands of an edited buffer */
+bool parse_reparse_new(struct parse_reparse **, struct parse_context *,
+    const char *, size_t);
+bool parse_reparse_edit(struct parse_reparse *, size_t, size_t, const char *, size_t);
+const struct parse_command_set *parse_reparse_commands(struct parse_reparse *);
+size_t parse_reparse_parsed(struct parse_reparse *);
+void parse_reparse_free(struct parse_reparse **);
+
+/* Provide the interface used to outline a script and parse its parts later */
+bool parse_outline_new(struct parse_outline **, struct parse_context *,
+    const char *, size_t);
+const struct parse_outline_entry *parse_outline_entries(struct parse_outline *,
+    size_t *);
+const struct parse_diag *parse_outline_error(struct parse_outline *);
+#ifndef USE_WALKINFO
+union parse_node *parse_materialise(struct parse_outline *,
+    const struct parse_outline_entry *, bool);
+#endif
+void parse_outline_free(struct parse_outline **);
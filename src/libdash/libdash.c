@@ -27,6 +27,47 @@ VISFUNC union parse_node *parse_next_command(struct parse_context *ctx)
   return ctx_next_command(ctx);
 }
 
+VISFUNC union parse_node *parse_step(struct parse_context *ctx, size_t max)
+{
+  return ctx_step(ctx, max);
+}
+
+VISFUNC bool parse_all(struct parse_context *ctx, struct parse_script **out)
+{
+  if (!out) return false;
+  *out = NULL;
+  if (!ctx) return false;
+  return ctx_parse_all(ctx, out);
+}
+
+VISFUNC bool parse_check(struct parse_context *ctx, struct parse_diag *diag)
+{
+  if (!ctx) return false;
+  return ctx_skim(ctx, diag, NULL, NULL);
+}
+
+VISFUNC bool parse_checkpoint(struct parse_context    *ctx,
+                              struct parse_checkpoint *cp)
+{
+  if (!ctx || !cp) return false;
+  return checkpoint_take(ctx, cp);
+}
+
+VISFUNC bool parse_resume(struct parse_context          *ctx,
+                          const struct parse_checkpoint *cp)
+{
+  if (!ctx || !cp) return false;
+  return checkpoint_resume(ctx, cp);
+}
+
+VISFUNC bool parse_events(struct parse_context     *ctx,
+                          const struct parse_events *ev,
+                          struct parse_diag         *diag)
+{
+  if (!ctx || !ev) return false;
+  return events_parse(ctx, ev, diag);
+}
+
 VISFUNC const char *parse_internal_errstr(struct parse_context *ctx)
 {
   switch (ctx->int_error) {
@@ -42,6 +83,24 @@ VISFUNC const char *parse_internal_errstr(struct parse_context *ctx)
   case IE_NOGETCHR:
     return "No get function provided";
 
+  case IE_NOMEMORY:
+    return "Unable to allocate memory";
+
+  case IE_STOPPED:
+    return "Stopped by an event callback";
+
+  case IE_TIMELIMIT:
+    return "Time limit reached";
+
+  case IE_BYTELIMIT:
+    return "Input limit reached";
+
+  case IE_NODELIMIT:
+    return "Node limit reached";
+
+  case IE_MEMLIMIT:
+    return "Memory limit reached";
+
   default:
     return "Unknown internal error";
   }
@@ -61,7 +120,301 @@ VISFUNC bool parse_push_file(struct parse_context *ctx, const char *fname)
   return true;
 }
 
-VISFUNC bool parse_node_iseof(union parse_node *node)
+VISFUNC bool parse_iseof(union parse_node *node)
 {
   return node == eof_node();
 }
+
+VISFUNC bool parse_ispending(union parse_node *node)
+{
+  return node == pending_node();
+}
+
+VISFUNC enum parse_tokid parse_next_token(struct parse_context *ctx)
+{
+  if (!ctx) return INV_PARSER_TOKEN;
+  return readtoken(ctx);
+}
+
+VISFUNC bool parse_tokenize_all(struct parse_context      *ctx,
+                                struct parse_token_stream *out)
+{
+  return tokenize_all(ctx, out);
+}
+
+VISFUNC void parse_token_stream_free(struct parse_token_stream *out)
+{
+  token_stream_free(out);
+}
+
+VISFUNC bool parse_feed(struct parse_context *ctx,
+                        const char           *text,
+                        size_t                len)
+{
+  if (!ctx || !text) return false;
+  return feed_add(ctx, text, len);
+}
+
+VISFUNC bool parse_needs_more(struct parse_context *ctx)
+{
+  if (!ctx) return false;
+  return feed_more(ctx);
+}
+
+VISFUNC void parse_feed_clear(struct parse_context *ctx)
+{
+  if (ctx) feed_clear(ctx);
+}
+
+VISFUNC bool parse_set_intern(struct parse_context *ctx, bool enable)
+{
+  if (!ctx) return false;
+  ctx->internwords = enable;
+  return true;
+}
+
+VISFUNC size_t parse_intern_saved(struct parse_context *ctx)
+{
+  if (!ctx) return 0;
+  return intern_saved(ctx);
+}
+
+VISFUNC bool parse_set_segments(struct parse_context *ctx, bool enable)
+{
+  if (!ctx) return false;
+  ctx->wordsegments = enable;
+  return true;
+}
+
+VISFUNC bool parse_set_nary(struct parse_context *ctx, bool enable)
+{
+  if (!ctx) return false;
+  ctx->narynodes = enable;
+  return true;
+}
+
+VISFUNC bool parse_set_maxdepth(struct parse_context *ctx, unsigned int depth)
+{
+  if (!ctx) return false;
+  ctx->maxdepth = depth;
+  return true;
+}
+
+VISFUNC bool parse_set_limits(struct parse_context     *ctx,
+                              const struct parse_limits *limits)
+{
+  if (!ctx) return false;
+  return budget_set(ctx, limits);
+}
+
+VISFUNC bool parse_parallel(struct parse_context     *ctx,
+                            const char               *text,
+                            size_t                    len,
+                            unsigned int              nthreads,
+                            struct parse_command_set *set)
+{
+  if (!text || !set) return false;
+  return parallel_parse(ctx, text, len, nthreads, set);
+}
+
+VISFUNC void parse_command_set_free(struct parse_command_set *set)
+{
+  if (set) parallel_free(set);
+}
+
+VISFUNC bool parse_follow(struct parse_context     *ctx,
+                          const char               *fname,
+                          const char               *path,
+                          unsigned int              nthreads,
+                          struct parse_sourced_set *set)
+{
+  if (!fname || !set) return false;
+  return follow_parse(ctx, fname, path, nthreads, set);
+}
+
+VISFUNC void parse_sourced_set_free(struct parse_sourced_set *set)
+{
+  if (set) follow_free(set);
+}
+
+VISFUNC size_t parse_word_unescape(const char *text, size_t len, char *out)
+{
+  if (!text || !out) return 0;
+  return word_unescape(text, len, out);
+}
+
+VISFUNC const char *parse_word_literal(union parse_node *node,
+                                       char             *buf,
+                                       size_t            bufsize,
+                                       size_t           *len)
+{
+  return word_literal(node, buf, bufsize, len);
+}
+
+VISFUNC const char *parse_command_name(enum parse_cmdid id)
+{
+  return builtin_idname(id);
+}
+
+VISFUNC bool parse_set_recover(struct parse_context *ctx, bool enable)
+{
+  if (!ctx) return false;
+  return recover_set(ctx, enable);
+}
+
+VISFUNC const struct parse_diag *parse_diagnostics(struct parse_context *ctx,
+                                                   size_t               *count)
+{
+  if (!count) return NULL;
+  *count = 0;
+  if (!ctx) return NULL;
+  return recover_diagnostics(ctx, count);
+}
+
+VISFUNC bool parse_set_shadow(struct parse_context *ctx, unsigned int rate)
+{
+  if (!ctx) return false;
+  return shadow_set(ctx, rate);
+}
+
+VISFUNC bool parse_shadow_report(struct parse_context       *ctx,
+                                 struct parse_shadow_report *rep)
+{
+  if (!ctx || !rep) return false;
+  return shadow_report(ctx, rep);
+}
+
+VISFUNC bool parse_alias_set(struct parse_context *ctx,
+                             const char           *name,
+                             const char           *value)
+{
+  if (!ctx) return false;
+  return alias_set(ctx, name, value);
+}
+
+VISFUNC bool parse_alias_clear(struct parse_context *ctx, const char *name)
+{
+  if (!ctx) return false;
+  return alias_clear(ctx, name);
+}
+
+VISFUNC bool parse_relex_new(struct parse_relex **rl,
+                             const char          *text,
+                             size_t               len)
+{
+  if (!rl) return false;
+  *rl = NULL;
+  return relex_new(rl, text, len);
+}
+
+VISFUNC bool parse_relex_edit(struct parse_relex *rl,
+                              size_t              offset,
+                              size_t              dellen,
+                              const char         *ins,
+                              size_t              inslen)
+{
+  if (!rl) return false;
+  return relex_edit(rl, offset, dellen, ins, inslen);
+}
+
+VISFUNC const struct parse_token_stream *parse_relex_tokens(struct parse_relex *rl)
+{
+  if (!rl) return NULL;
+  return relex_tokens(rl);
+}
+
+VISFUNC bool parse_relex_complete(struct parse_relex *rl)
+{
+  if (!rl) return false;
+  return relex_complete(rl);
+}
+
+VISFUNC size_t parse_relex_lexed(struct parse_relex *rl)
+{
+  if (!rl) return 0;
+  return relex_lexed(rl);
+}
+
+VISFUNC void parse_relex_free(struct parse_relex **rl)
+{
+  if (!rl) return;
+  relex_free(rl);
+}
+
+VISFUNC bool parse_reparse_new(struct parse_reparse **rp,
+                               struct parse_context  *ctx,
+                               const char            *text,
+                               size_t                 len)
+{
+  if (!rp) return false;
+  *rp = NULL;
+  return reparse_new(rp, ctx, text, len);
+}
+
+VISFUNC bool parse_reparse_edit(struct parse_reparse *rp,
+                                size_t                offset,
+                                size_t                dellen,
+                                const char           *ins,
+                                size_t                inslen)
+{
+  if (!rp) return false;
+  return reparse_edit(rp, offset, dellen, ins, inslen);
+}
+
+VISFUNC const struct parse_command_set *parse_reparse_commands(struct parse_reparse *rp)
+{
+  if (!rp) return NULL;
+  return reparse_commands(rp);
+}
+
+VISFUNC size_t parse_reparse_parsed(struct parse_reparse *rp)
+{
+  if (!rp) return 0;
+  return reparse_parsed(rp);
+}
+
+VISFUNC void parse_reparse_free(struct parse_reparse **rp)
+{
+  if (!rp) return;
+  reparse_free(rp);
+}
+
+VISFUNC bool parse_outline_new(struct parse_outline **ol,
+                               struct parse_context  *ctx,
+                               const char            *text,
+                               size_t                 len)
+{
+  if (!ol) return false;
+  *ol = NULL;
+  if (!text) return false;
+  return outline_new(ol, ctx, text, len);
+}
+
+VISFUNC const struct parse_outline_entry *parse_outline_entries(struct parse_outline *ol,
+                                                                size_t               *count)
+{
+  if (!count) return NULL;
+  *count = 0;
+  if (!ol) return NULL;
+  return outline_entries(ol, count);
+}
+
+VISFUNC const struct parse_diag *parse_outline_error(struct parse_outline *ol)
+{
+  if (!ol) return NULL;
+  return outline_error(ol);
+}
+
+VISFUNC union parse_node *parse_materialise(struct parse_outline             *ol,
+                                            const struct parse_outline_entry *entry,
+                                            bool                              body)
+{
+  if (!ol || !entry) return NULL;
+  return outline_materialise(ol, entry, body);
+}
+
+VISFUNC void parse_outline_free(struct parse_outline **ol)
+{
+  if (!ol) return;
+  outline_free(ol);
+}
@@ -0,0 +1,415 @@
+/*
+ * This source provides the alias table of a context. The value of each alias
+ * is split into tokens when it is defined, so that each use of the alias only
+ * replays the saved tokens rather than passing the text through the lexer.
+ */
+
+#include <obstack.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+#include "queue.h"
+
+/* Define a single token of a compiled alias value */
+struct alias_token {
+  struct parse_token   tok;           /* Token with text held by the table */
+  enum parse_nodetype  rtype;         /* Redirection type of a TREDIR token */
+  int                  rfd;           /* Redirection descriptor */
+};
+
+struct parse_alias {
+  struct parse_alias *next;           /* Next alias within the same bucket */
+  const char         *name;           /* Name of the alias */
+  const char         *value;          /* Text of the alias */
+  uint32_t            hash;           /* Hash of the name */
+  struct alias_token *tokens;         /* Compiled tokens of the value */
+  size_t              ntokens;        /* Number of compiled tokens */
+  bool                compiled;       /* Set if the tokens can be replayed */
+  bool                trailblank;     /* Set if the value ends with a blank */
+  bool                inuse;          /* Set while the alias is expanded */
+};
+
+/* Define an expansion whose tokens are still being replayed */
+struct alias_frame {
+  struct parse_alias *alias;          /* Alias being replayed */
+  size_t              pos;            /* Next token to be returned */
+  size_t              offset;         /* Offset of the word replaced */
+  size_t              length;         /* Length of the word replaced */
+};
+
+struct parse_aliases {
+  struct obstack       store;         /* Storage for the aliases */
+  struct parse_alias **table;         /* Hash buckets */
+  size_t               size;          /* Number of buckets, a power of two */
+  size_t               count;         /* Number of aliases defined */
+  struct alias_frame  *frame;         /* Stack of expansions being replayed */
+  size_t               nframe;        /* Number of expansions being replayed */
+  size_t               maxframe;      /* Number of frames allocated */
+  size_t               active;        /* Number of aliases in use */
+};
+
+#define ALIAS_INITSIZE 64
+
+/* Create the alias table for the context if it doesn't already exist */
+static struct parse_aliases *alias_table(struct parse_context *ctx)
+{
+  struct parse_aliases *tab = ctx->aliases;
+
+  if (!tab) {
+    if (!(tab = calloc(1, sizeof(struct parse_aliases))))
+      return NULL;
+    if (!(tab->table = calloc(ALIAS_INITSIZE, sizeof(struct parse_alias *)))) {
+      free(tab);
+      return NULL;
+    }
+    obstack_init(&tab->store);
+    tab->size = ALIAS_INITSIZE;
+    ctx->aliases = tab;
+  }
+  return tab;
+}
+
+/* Locate the bucket entry that refers to the named alias */
+static struct parse_alias **alias_lookup(struct parse_aliases *tab,
+                                         const char           *name,
+                                         uint32_t              hash)
+{
+  struct parse_alias **app = &tab->table[hash & (tab->size - 1)];
+
+  while (*app && ((*app)->hash != hash || strcmp((*app)->name, name)))
+    app = &(*app)->next;
+  return app;
+}
+
+/* Double the number of buckets once there are more aliases than buckets */
+static void alias_grow(struct parse_aliases *tab)
+{
+  size_t newsize = tab->size * 2;
+  struct parse_alias **newtab = calloc(newsize, sizeof(struct parse_alias *));
+  size_t idx;
+
+  if (!newtab) return;
+  for (idx = 0; idx < tab->size; idx++) {
+    struct parse_alias *ap, *nxt;
+    for (ap = tab->table[idx]; ap; ap = nxt) {
+      nxt = ap->next;
+      ap->next = newtab[ap->hash & (newsize - 1)];
+      newtab[ap->hash & (newsize - 1)] = ap;
+    }
+  }
+  free(tab->table);
+  tab->table = newtab;
+  tab->size = newsize;
+}
+
+/* Split the value of the alias into tokens. The alias is left to be pushed as
+ * text when the tokens alone cannot reproduce the way the shell reads it: a
+ * value that does not lex on its own, or whose end continues into the text
+ * that follows the alias, or that contains here documents or command
+ * substitutions, both of which are read from beyond the token itself, or
+ * arithmetic expansions, whose compiled form is held by the context that
+ * read them.
+ */
+static void alias_compile(struct parse_aliases *tab, struct parse_alias *ap)
+{
+  struct parse_context *tmp = NULL;
+  struct parse_token tok;
+  size_t len = strlen(ap->value), end = 0, bslash = 0;
+  const char *ptr;
+
+  ap->compiled = false;
+  for (ptr = ap->value + len; ptr > ap->value && ptr[-1] == '\\'; ptr--)
+    bslash++;
+  if ((bslash & 1) || !ctx_init(&tmp))
+    return;
+  if (!push_source(tmp, SRC_STRING, ap->value))
+    goto done;
+  while (true) {
+    struct alias_token *atok;
+
+    if (!int_readtoken(tmp, &tok) || tmp->synerror.code != SE_NONE)
+      goto done;
+    if (tok.id == TEOF)
+      break;
+    if (tok.id == TWORD && (tok.flags & WF_EXPAND) &&
+        (memchr(token_text(tok), CTLBACKQ, token_length(tok)) ||
+         memchr(token_text(tok), CTLARI, token_length(tok))))
+      goto done;
+    if (tok.id == TREDIR &&
+        (tmp->cur_redir.type == NHERE || tmp->cur_redir.type == NXHERE))
+      goto done;
+    obstack_blank(&tab->store, sizeof(struct alias_token));
+    atok = (struct alias_token *)obstack_next_free(&tab->store) - 1;
+    atok->tok = tok;
+    atok->rtype = tmp->cur_redir.type;
+    atok->rfd = tmp->cur_redir.nfile.fd;
+    end = tok.offset + tok.length;
+  }
+  ap->ntokens = obstack_object_size(&tab->store) / sizeof(struct alias_token);
+  ap->tokens = obstack_finish(&tab->store);
+
+  /* A comment running to the end of the value would swallow what follows */
+  if (memchr(ap->value + end, '#', len - end))
+    goto done;
+  if (ap->ntokens) {
+    struct parse_token *last = &ap->tokens[ap->ntokens - 1].tok;
+    char *txt = token_text((*last));
+
+    /* A single digit at the very end would become the descriptor of a
+     * redirection that follows the alias
+     */
+    if (last->id == TWORD && end == len && !(last->flags & WF_QUOTED) &&
+        isdigit(txt[0]) && txt[1] == '\0')
+      goto done;
+  }
+
+  /* Move the text of the words into the table, as the temporary context is
+   * about to go
+   */
+  for (size_t idx = 0; idx < ap->ntokens; idx++) {
+    struct alias_token *atok = &ap->tokens[idx];
+
+    if (atok->tok.id == TWORD)
+      token_text(atok->tok) = obstack_copy(&tab->store, token_text(atok->tok),
+          token_length(atok->tok));
+    else
+      atok->tok.val.node = NULL;
+  }
+  ap->compiled = true;
+done:
+  if (!ap->compiled) {
+    /* Only the last object within the table can be given back */
+    if (ap->tokens)
+      obstack_free(&tab->store, ap->tokens);
+    else
+      obstack_free(&tab->store, obstack_finish(&tab->store));
+    ap->tokens = NULL;
+    ap->ntokens = 0;
+  }
+  ctx_fini(&tmp);
+}
+
+/* Define or replace the named alias */
+bool alias_set(struct parse_context *ctx, const char *name, const char *value)
+{
+  struct parse_aliases *tab;
+  struct parse_alias *ap, **app;
+  size_t len;
+  uint32_t hash;
+
+  if (!name || !*name || strchr(name, '=') || !value)
+    return false;
+  if (!(tab = alias_table(ctx)))
+    return false;
+  len = strlen(value);
+  hash = fnv_hash(name, strlen(name));
+  app = alias_lookup(tab, name, hash);
+  if (*app) {
+    /* An expansion in progress keeps using the previous definition */
+    *app = (*app)->next;
+    tab->count--;
+  }
+  ap = obstack_alloc(&tab->store, sizeof(struct parse_alias));
+  memset(ap, 0, sizeof(struct parse_alias));
+  ap->name = obstack_copy0(&tab->store, name, strlen(name));
+  ap->value = obstack_copy0(&tab->store, value, len);
+  ap->hash = hash;
+  ap->trailblank = len && (value[len - 1] == ' ' || value[len - 1] == '\t');
+  alias_compile(tab, ap);
+  if (++tab->count > tab->size)
+    alias_grow(tab);
+  app = alias_lookup(tab, name, hash);
+  ap->next = *app;
+  *app = ap;
+  return true;
+}
+
+/* Give back the storage of the aliases removed, which can only be done once
+ * the table is empty and no alias is being expanded
+ */
+static void alias_reclaim(struct parse_aliases *tab)
+{
+  if (!tab->count && !tab->active) {
+    obstack_free(&tab->store, NULL);
+    obstack_init(&tab->store);
+  }
+}
+
+/* Remove the named alias, or all of them if no name is given. The storage is
+ * reclaimed once the table is empty and no alias is being expanded.
+ */
+bool alias_clear(struct parse_context *ctx, const char *name)
+{
+  struct parse_aliases *tab = ctx->aliases;
+  struct parse_alias **app;
+
+  if (!tab) return false;
+  if (name) {
+    app = alias_lookup(tab, name, fnv_hash(name, strlen(name)));
+    if (!*app) return false;
+    *app = (*app)->next;
+    tab->count--;
+  } else {
+    memset(tab->table, 0, tab->size * sizeof(struct parse_alias *));
+    tab->count = 0;
+  }
+  alias_reclaim(tab);
+  return true;
+}
+
+/* Finish an expansion of the alias, a trailing blank in its value causes the
+ * following word to be checked for an alias as well
+ */
+void alias_release(struct parse_context *ctx, struct parse_alias *ap)
+{
+  ap->inuse = false;
+  if (ap->trailblank)
+    set_tokflags_chkalias(&ctx->chkflags, true);
+  ctx->aliases->active--;
+  alias_reclaim(ctx->aliases);
+}
+
+/* Turn the expansions being replayed back into text, so that an alias
+ * pushed as text is read before the remaining tokens of the others
+ */
+static bool alias_unwind(struct parse_context *ctx)
+{
+  struct parse_aliases *tab = ctx->aliases;
+  size_t idx;
+
+  for (idx = 0; idx < tab->nframe; idx++) {
+    struct alias_frame *frm = &tab->frame[idx];
+    struct parse_alias *ap = frm->alias;
+
+    if (frm->pos < ap->ntokens) {
+      /* Resume from the end of the last token returned */
+      struct parse_token *prev = &ap->tokens[frm->pos - 1].tok;
+
+      if (!push_alias(ctx, ap->value + prev->offset + prev->length, ap))
+        return false;
+    } else {
+      alias_release(ctx, ap);
+    }
+  }
+  tab->nframe = 0;
+  return true;
+}
+
+/* Expand the word in the token if it names an alias that is not already
+ * being expanded, returns true if the caller needs to read the next token
+ */
+bool alias_expand(struct parse_context *ctx, struct parse_token *tok)
+{
+  struct parse_aliases *tab = ctx->aliases;
+  struct parse_alias *ap;
+  const char *name = token_text((*tok));
+
+  if (!tab || !tab->count || !name)
+    return false;
+  ap = *alias_lookup(tab, name, fnv_hash(name, strlen(name)));
+  if (!ap || ap->inuse)
+    return false;
+  if (!*ap->value)
+    return true;
+  if (ap->compiled) {
+    struct alias_frame *frm;
+
+    if (tab->nframe == tab->maxframe) {
+      size_t newmax = tab->maxframe ? tab->maxframe * 2 : 8;
+      frm = realloc(tab->frame, newmax * sizeof(struct alias_frame));
+      if (!frm) {
+        ctx->int_error = IE_NOMEMORY;
+        return false;
+      }
+      tab->frame = frm;
+      tab->maxframe = newmax;
+    }
+    frm = &tab->frame[tab->nframe++];
+    frm->alias = ap;
+    frm->pos = 0;
+    frm->offset = tok->offset;
+    frm->length = tok->length;
+  } else {
+    if (tab->nframe && !alias_unwind(ctx))
+      return false;
+    if (!push_alias(ctx, ap->value, ap))
+      return false;
+  }
+  ap->inuse = true;
+  tab->active++;
+  return true;
+}
+
+/* Return the next token of the innermost expansion being replayed, returns
+ * false if the token needs to be read from the source instead
+ */
+bool alias_next_token(struct parse_context *ctx, struct parse_token *tok)
+{
+  struct parse_aliases *tab = ctx->aliases;
+
+  if (!tab) return false;
+  while (tab->nframe) {
+    struct alias_frame *frm = &tab->frame[tab->nframe - 1];
+    struct alias_token *atok;
+
+    if (frm->pos == frm->alias->ntokens) {
+      tab->nframe--;
+      alias_release(ctx, frm->alias);
+      continue;
+    }
+    atok = &frm->alias->tokens[frm->pos++];
+    *tok = atok->tok;
+    tok->offset = frm->offset;
+    tok->length = frm->length;
+    if (tok->id == TREDIR) {
+      ctx->cur_redir.type = atok->rtype;
+      ctx->cur_redir.nfile.fd = atok->rfd;
+      ctx->cur_redir.nfile.next = NULL;
+    }
+    ctx->quoteflag = (tok->flags & WF_QUOTED) != 0;
+    ctx->wordflags = (enum parse_wordflags)(tok->flags & ~WF_QUOTED);
+    ctx->bqlist = NULL;
+    ctx->bqtail = &ctx->bqlist;
+    ctx->arith = NULL;
+    ctx->arithtail = &ctx->arith;
+    if (ctx->wordsegments && tok->id == TWORD)
+      seg_scan(ctx, tok->val.value.text, tok->val.value.len - 1);
+    return true;
+  }
+  return false;
+}
+
+/* Return whether any alias is being expanded */
+bool alias_active(struct parse_context *ctx)
+{
+  return ctx->aliases && ctx->aliases->active;
+}
+
+/* Define the aliases of one context in another */
+bool alias_copy(struct parse_context *dst, struct parse_context *src)
+{
+  struct parse_aliases *tab = src->aliases;
+  struct parse_alias *ap;
+  size_t idx;
+
+  for (idx = 0; tab && idx < tab->size; idx++)
+    for (ap = tab->table[idx]; ap; ap = ap->next)
+      if (!alias_set(dst, ap->name, ap->value))
+        return false;
+  return true;
+}
+
+/* Release the alias table of the context */
+void alias_free(struct parse_context *ctx)
+{
+  struct parse_aliases *tab = ctx->aliases;
+
+  if (tab) {
+    ctx->aliases = NULL;
+    obstack_free(&tab->store, NULL);
+    free(tab->frame);
+    free(tab->table);
+    free(tab);
+  }
+}
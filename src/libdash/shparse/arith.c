@@ -0,0 +1,547 @@
+/*
+ * This source provides the compiling of arithmetic expansions, $((...)), into
+ * a postfix sequence of instructions held by a NARITH node, so that the
+ * expression does not have to be parsed again by whatever uses the tree.
+ */
+
+#include <inttypes.h>
+#include <obstack.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+/* Define the tokens of an arithmetic expression */
+enum arith_tokid {
+  AT_END = 0,                         /* End of the expression */
+  AT_OPERAND,                         /* Number, name or expansion */
+  AT_BINOP,                           /* Binary operator, or unary + and - */
+  AT_ASSIGN,                          /* Assignment operator */
+  AT_NOT,                             /* Logical not */
+  AT_BNOT,                            /* Bitwise not */
+  AT_QUEST,                           /* Start of conditional */
+  AT_COLON,                           /* Else part of conditional */
+  AT_LP,                              /* Opening parenthesis */
+  AT_RP,                              /* Closing parenthesis */
+  AT_ERROR                            /* Unrecognised character */
+};
+
+/* Define the operators, longer ones appearing before their prefixes. An
+ * assignment operator holds the binary operator it applies, if any.
+ */
+static const struct arith_opinfo {
+  const char        *text;
+  enum arith_tokid   tok;
+  enum parse_arithop op;
+  unsigned char      prec;
+} arith_ops[] = {
+  { "<<=", AT_ASSIGN, AOP_SHL,    0 },
+  { ">>=", AT_ASSIGN, AOP_SHR,    0 },
+  { "||",  AT_BINOP,  AOP_LOR,    1 },
+  { "&&",  AT_BINOP,  AOP_LAND,   2 },
+  { "==",  AT_BINOP,  AOP_EQ,     6 },
+  { "!=",  AT_BINOP,  AOP_NE,     6 },
+  { "<=",  AT_BINOP,  AOP_LE,     7 },
+  { ">=",  AT_BINOP,  AOP_GE,     7 },
+  { "<<",  AT_BINOP,  AOP_SHL,    8 },
+  { ">>",  AT_BINOP,  AOP_SHR,    8 },
+  { "*=",  AT_ASSIGN, AOP_MUL,    0 },
+  { "/=",  AT_ASSIGN, AOP_DIV,    0 },
+  { "%=",  AT_ASSIGN, AOP_REM,    0 },
+  { "+=",  AT_ASSIGN, AOP_ADD,    0 },
+  { "-=",  AT_ASSIGN, AOP_SUB,    0 },
+  { "&=",  AT_ASSIGN, AOP_BAND,   0 },
+  { "^=",  AT_ASSIGN, AOP_BXOR,   0 },
+  { "|=",  AT_ASSIGN, AOP_BOR,    0 },
+  { "=",   AT_ASSIGN, AOP_ASSIGN, 0 },
+  { "|",   AT_BINOP,  AOP_BOR,    3 },
+  { "^",   AT_BINOP,  AOP_BXOR,   4 },
+  { "&",   AT_BINOP,  AOP_BAND,   5 },
+  { "<",   AT_BINOP,  AOP_LT,     7 },
+  { ">",   AT_BINOP,  AOP_GT,     7 },
+  { "+",   AT_BINOP,  AOP_ADD,    9 },
+  { "-",   AT_BINOP,  AOP_SUB,    9 },
+  { "*",   AT_BINOP,  AOP_MUL,   10 },
+  { "/",   AT_BINOP,  AOP_DIV,   10 },
+  { "%",   AT_BINOP,  AOP_REM,   10 },
+  { "!",   AT_NOT,    AOP_NOT,    0 },
+  { "~",   AT_BNOT,   AOP_BNOT,   0 },
+  { "?",   AT_QUEST,  AOP_JZ,     0 },
+  { ":",   AT_COLON,  AOP_JMP,    0 },
+  { "(",   AT_LP,     AOP_NUM,    0 },
+  { ")",   AT_RP,     AOP_NUM,    0 },
+};
+
+/* Deepest nesting of parentheses and operators that will be compiled */
+#define ARITH_MAXDEPTH 256
+
+/* Define the buffers the instructions are collected in before being copied
+ * into the node, these are kept by the context for the next expression
+ */
+struct parse_arithbuf {
+  struct parse_arith_insn *insn;
+  size_t                   ninsn, maxinsn;
+  intmax_t                *num;
+  size_t                   nnum, maxnum;
+  const char             **name;
+  size_t                   nname, maxname;
+};
+
+/* Define a token of the expression */
+struct arith_token {
+  enum arith_tokid         tok;
+  const struct arith_opinfo *info;    /* Operator details */
+  const char              *text;      /* Text of an operand */
+  size_t                   len;       /* Length of an operand */
+};
+
+/* Define the state of compiling an expression */
+struct arith_state {
+  struct parse_context    *ctx;
+  struct parse_arithbuf   *buf;
+  const char              *pos;       /* Position after the current token */
+  const char              *end;       /* End of the expression */
+  struct arith_token       cur;       /* Current token */
+  unsigned int             depth;     /* Current nesting */
+  unsigned char            flags;     /* Flags for the node */
+};
+
+/* Skip over an expansion within an expression, returning the position after
+ * it or NULL if it does not end within the expression
+ */
+static const char *arith_skipexp(const char *ptr, const char *end)
+{
+  char ctl = *ptr++;
+
+  if (ctl == CTLBACKQ)
+    return ptr;
+  if (ctl == CTLVAR) {
+    bool nested = ptr < end && (*ptr & VSTYPE) != VSNORMAL;
+
+    if (!(ptr = memchr(ptr, '=', end - ptr)))
+      return NULL;
+    if (!nested)
+      return ptr + 1;
+    ptr++;
+  }
+
+  /* Find the end of the nested word or expression */
+  while (ptr < end) {
+    switch (*ptr) {
+    case CTLESC:
+      ptr += 2;
+      break;
+
+    case CTLVAR:
+    case CTLARI:
+    case CTLBACKQ:
+      if (!(ptr = arith_skipexp(ptr, end)))
+        return NULL;
+      break;
+
+    case CTLENDVAR:
+      if (ctl == CTLVAR)
+        return ptr + 1;
+      ptr++;
+      break;
+
+    case CTLENDARI:
+      if (ctl == CTLARI)
+        return ptr + 1;
+      ptr++;
+      break;
+
+    default:
+      ptr++;
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* Read the token starting at the given position, returning the position
+ * after it
+ */
+static const char *arith_scan(const char          *ptr,
+                              const char          *end,
+                              struct arith_token  *tok)
+{
+  const char *start;
+  size_t idx;
+
+  while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' ||
+                       *ptr == CTLQUOTEMARK))
+    ptr++;
+  tok->info = NULL;
+  if (ptr == end) {
+    tok->tok = AT_END;
+    return ptr;
+  }
+
+  /* An operand runs over names, numbers and expansions */
+  for (start = ptr; ptr < end; ) {
+    if (is_in_name(*ptr) || *ptr == CTLQUOTEMARK) {
+      ptr++;
+    } else if (*ptr == CTLESC) {
+      ptr += 2;
+    } else if (*ptr == CTLVAR || *ptr == CTLARI || *ptr == CTLBACKQ) {
+      if (!(ptr = arith_skipexp(ptr, end))) {
+        tok->tok = AT_ERROR;
+        return end;
+      }
+    } else {
+      break;
+    }
+  }
+  if (ptr > start) {
+    tok->tok = AT_OPERAND;
+    tok->text = start;
+    tok->len = ptr - start;
+    return ptr;
+  }
+
+  for (idx = 0; idx < sizeof(arith_ops) / sizeof(arith_ops[0]); idx++) {
+    size_t len = strlen(arith_ops[idx].text);
+    if ((size_t)(end - ptr) >= len && !memcmp(ptr, arith_ops[idx].text, len)) {
+      tok->tok = arith_ops[idx].tok;
+      tok->info = &arith_ops[idx];
+      return ptr + len;
+    }
+  }
+  tok->tok = AT_ERROR;
+  return end;
+}
+
+/* Move on to the next token */
+static inline void arith_next(struct arith_state *st)
+{
+  st->pos = arith_scan(st->pos, st->end, &st->cur);
+}
+
+/* Add an instruction, returning its index */
+static size_t arith_emit(struct arith_state *st,
+                         enum parse_arithop  op,
+                         uint32_t            arg)
+{
+  struct parse_arithbuf *buf = st->buf;
+
+  if (buf->ninsn == buf->maxinsn) {
+    size_t newmax = buf->maxinsn ? buf->maxinsn * 2 : 32;
+    struct parse_arith_insn *newp = realloc(buf->insn,
+        newmax * sizeof(struct parse_arith_insn));
+    if (!newp) {
+      st->flags |= AF_INVALID;
+      return 0;
+    }
+    buf->insn = newp;
+    buf->maxinsn = newmax;
+  }
+  buf->insn[buf->ninsn].op = op;
+  buf->insn[buf->ninsn].arg = arg;
+  return buf->ninsn++;
+}
+
+/* Set a jump to pass over the instructions added since it */
+static inline void arith_patch(struct arith_state *st, size_t at)
+{
+  if (!(st->flags & AF_INVALID))
+    st->buf->insn[at].arg = st->buf->ninsn - at - 1;
+}
+
+/* Add an interned name, returning its index */
+static uint32_t arith_name(struct arith_state *st, const char *text, size_t len)
+{
+  struct parse_arithbuf *buf = st->buf;
+  const char *name;
+
+  if (buf->nname == buf->maxname) {
+    size_t newmax = buf->maxname ? buf->maxname * 2 : 16;
+    const char **newp = realloc(buf->name, newmax * sizeof(const char *));
+    if (!newp) {
+      st->flags |= AF_INVALID;
+      return 0;
+    }
+    buf->name = newp;
+    buf->maxname = newmax;
+  }
+  if (!(name = intern_string(st->ctx, text, len))) {
+    st->flags |= AF_INVALID;
+    return 0;
+  }
+  buf->name[buf->nname] = name;
+  return buf->nname++;
+}
+
+/* Add a number, returning its index */
+static uint32_t arith_num(struct arith_state *st, intmax_t value)
+{
+  struct parse_arithbuf *buf = st->buf;
+
+  if (buf->nnum == buf->maxnum) {
+    size_t newmax = buf->maxnum ? buf->maxnum * 2 : 16;
+    intmax_t *newp = realloc(buf->num, newmax * sizeof(intmax_t));
+    if (!newp) {
+      st->flags |= AF_INVALID;
+      return 0;
+    }
+    buf->num = newp;
+    buf->maxnum = newmax;
+  }
+  buf->num[buf->nnum] = value;
+  return buf->nnum++;
+}
+
+/* Return true if the operand is a plain name */
+static bool arith_isname(struct arith_token *tok)
+{
+  size_t idx;
+
+  if (tok->tok != AT_OPERAND || !is_name(tok->text[0]))
+    return false;
+  for (idx = 1; idx < tok->len; idx++)
+    if (!is_in_name(tok->text[idx]))
+      return false;
+  return true;
+}
+
+/* Add the instruction that pushes the value of the current operand. A lone
+ * parameter expansion is noted by name, any other expansion by its text;
+ * either way the expression is only as given if the expansion turns out to be
+ * a single value.
+ */
+static bool arith_operand(struct arith_state *st)
+{
+  struct arith_token *tok = &st->cur;
+  const char *text = tok->text;
+  size_t len = tok->len;
+
+  if (arith_isname(tok)) {
+    arith_emit(st, AOP_VAR, arith_name(st, text, len));
+  } else if (isdigit(text[0])) {
+    char digits[72], *endp;
+    intmax_t value;
+    size_t idx;
+
+    for (idx = 0; idx < len && idx < sizeof(digits) - 1; idx++)
+      if (!isalnum(digits[idx] = text[idx]))
+        return false;
+    if (idx < len)
+      return false;
+    digits[idx] = '\0';
+    value = strtoimax(digits, &endp, 0);
+    if (*endp)
+      return false;
+    arith_emit(st, AOP_NUM, arith_num(st, value));
+  } else if (text[0] == CTLVAR && len > 2 &&
+             (text[1] & (VSTYPE | VSNUL)) == VSNORMAL &&
+             text[len - 1] == '=' && !memchr(text + 2, '=', len - 3)) {
+    arith_emit(st, AOP_PARAM, arith_name(st, text + 2, len - 3));
+    st->flags |= AF_EXPAND;
+  } else {
+    arith_emit(st, AOP_EXPAND, arith_name(st, text, len));
+    st->flags |= AF_EXPAND;
+  }
+  arith_next(st);
+  return true;
+}
+
+static bool arith_assign(struct arith_state *st);
+
+/* Compile a unary operator or a primary expression */
+static bool arith_unary(struct arith_state *st)
+{
+  enum parse_arithop op;
+  bool ok;
+
+  if (++st->depth > ARITH_MAXDEPTH)
+    return false;
+  switch (st->cur.tok) {
+  case AT_OPERAND:
+    ok = arith_operand(st);
+    break;
+
+  case AT_LP:
+    arith_next(st);
+    ok = arith_assign(st) && st->cur.tok == AT_RP;
+    if (ok)
+      arith_next(st);
+    break;
+
+  case AT_BINOP:
+    if (st->cur.info->op != AOP_ADD && st->cur.info->op != AOP_SUB) {
+      ok = false;
+      break;
+    }
+    /* FALLTHROUGH */
+  case AT_NOT:
+  case AT_BNOT:
+    op = st->cur.info->op;
+    if (op == AOP_ADD)
+      op = AOP_POS;
+    else if (op == AOP_SUB)
+      op = AOP_NEG;
+    arith_next(st);
+    if ((ok = arith_unary(st)))
+      arith_emit(st, op, 0);
+    break;
+
+  default:
+    ok = false;
+    break;
+  }
+  st->depth--;
+  return ok;
+}
+
+/* Compile binary operators of at least the given precedence, the logical
+ * operators jumping over their right hand side where it has no effect
+ */
+static bool arith_binary(struct arith_state *st, unsigned char minprec)
+{
+  if (!arith_unary(st))
+    return false;
+  while (st->cur.tok == AT_BINOP && st->cur.info->prec >= minprec) {
+    const struct arith_opinfo *info = st->cur.info;
+
+    arith_next(st);
+    if (info->op == AOP_LAND || info->op == AOP_LOR) {
+      size_t at = arith_emit(st, info->op, 0);
+
+      if (!arith_binary(st, info->prec + 1))
+        return false;
+      arith_emit(st, AOP_BOOL, 0);
+      arith_patch(st, at);
+    } else {
+      if (!arith_binary(st, info->prec + 1))
+        return false;
+      arith_emit(st, info->op, 0);
+    }
+  }
+  return true;
+}
+
+/* Compile a conditional expression. The else part of each conditional is
+ * compiled in turn rather than nested, the jumps over them being linked
+ * through their arguments until the end of the last is known.
+ */
+static bool arith_cond(struct arith_state *st)
+{
+  size_t jz, jmp, link = 0;
+  bool ok = false;
+
+  if (++st->depth > ARITH_MAXDEPTH)
+    return false;
+  while (arith_binary(st, 1)) {
+    if (st->cur.tok != AT_QUEST) {
+      ok = true;
+      break;
+    }
+    arith_next(st);
+    jz = arith_emit(st, AOP_JZ, 0);
+    if (!arith_assign(st) || st->cur.tok != AT_COLON)
+      break;
+    arith_next(st);
+    jmp = arith_emit(st, AOP_JMP, link);
+    link = jmp + 1;
+    arith_patch(st, jz);
+  }
+
+  /* Point each jump over an else part at the end */
+  while (ok && link && !(st->flags & AF_INVALID)) {
+    jmp = link - 1;
+    link = st->buf->insn[jmp].arg;
+    arith_patch(st, jmp);
+  }
+  st->depth--;
+  return ok;
+}
+
+/* Compile an assignment, a compound assignment pushes the variable and
+ * applies the operator before storing the result
+ */
+static bool arith_assign(struct arith_state *st)
+{
+  struct arith_token nxt;
+  const struct arith_opinfo *info;
+  const char *pos;
+  uint32_t name;
+  bool ok;
+
+  if (!arith_isname(&st->cur))
+    return arith_cond(st);
+  pos = arith_scan(st->pos, st->end, &nxt);
+  if (nxt.tok != AT_ASSIGN)
+    return arith_cond(st);
+  if (++st->depth > ARITH_MAXDEPTH)
+    return false;
+  info = nxt.info;
+  name = arith_name(st, st->cur.text, st->cur.len);
+  st->pos = pos;
+  arith_next(st);
+  if (info->op != AOP_ASSIGN)
+    arith_emit(st, AOP_VAR, name);
+  if ((ok = arith_assign(st))) {
+    if (info->op != AOP_ASSIGN)
+      arith_emit(st, info->op, 0);
+    arith_emit(st, AOP_ASSIGN, name);
+  }
+  st->depth--;
+  return ok;
+}
+
+/* Compile the text of an arithmetic expansion into the node. An expression
+ * that does not compile is left without instructions and flagged as invalid,
+ * as the shell only reports the error when the expansion is performed.
+ */
+void arith_compile(struct parse_context *ctx,
+                   union parse_node     *node,
+                   const char           *text,
+                   size_t                len)
+{
+  struct parse_narith *n = &node->narith;
+  struct arith_state st;
+
+  n->insn = NULL;
+  n->num = NULL;
+  n->name = NULL;
+  n->ninsn = n->nnum = n->nname = 0;
+  n->flags = AF_INVALID;
+  if (!ctx->arithbuf && !(ctx->arithbuf = calloc(1, sizeof(struct parse_arithbuf))))
+    return;
+  st.ctx = ctx;
+  st.buf = ctx->arithbuf;
+  st.buf->ninsn = st.buf->nnum = st.buf->nname = 0;
+  st.pos = text;
+  st.end = text + len;
+  st.depth = 0;
+  st.flags = AF_NONE;
+  arith_next(&st);
+  if (!arith_assign(&st) || st.cur.tok != AT_END || (st.flags & AF_INVALID))
+    return;
+
+  n->flags = st.flags;
+  n->ninsn = st.buf->ninsn;
+  n->nnum = st.buf->nnum;
+  n->nname = st.buf->nname;
+  n->insn = obstack_copy(&ctx->memstack, st.buf->insn,
+      n->ninsn * sizeof(struct parse_arith_insn));
+  if (n->nnum)
+    n->num = obstack_copy(&ctx->memstack, st.buf->num,
+        n->nnum * sizeof(intmax_t));
+  if (n->nname)
+    n->name = obstack_copy(&ctx->memstack, st.buf->name,
+        n->nname * sizeof(const char *));
+}
+
+/* Release the buffers used when compiling */
+void arith_free(struct parse_context *ctx)
+{
+  struct parse_arithbuf *buf = ctx->arithbuf;
+
+  if (buf) {
+    ctx->arithbuf = NULL;
+    free(buf->insn);
+    free(buf->num);
+    free(buf->name);
+    free(buf);
+  }
+}
@@ -0,0 +1,162 @@
+/*
+ * This source provides the budget that limits what may be used in parsing a
+ * script that cannot be trusted, being the time taken, the input read, the
+ * nodes allocated and the memory taken by the obstacks of the context. The
+ * limits are checked as tokens are read and nodes are allocated, the parse
+ * failing with an internal error of its own once one of them is reached. The
+ * sources are then abandoned so that the context can be given another.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+#include "parser.h"
+#include "queue.h"
+
+/* Number of checks made between reading the clocks */
+#define BUDGET_TICKS 64
+
+/* Provide the space kept before each obstack chunk for its size */
+#define CHUNK_HDR sizeof(max_align_t)
+
+/* Return the given clock in microseconds */
+static uint64_t budget_clock(clockid_t id)
+{
+  struct timespec ts;
+
+  if (clock_gettime(id, &ts))
+    return 0;
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Return true if the internal error of the context is a limit being reached */
+static bool budget_reached(struct parse_context *ctx)
+{
+  return ctx->int_error >= IE_TIMELIMIT;
+}
+
+/* Set the limits of the context, or remove them if none are given */
+bool budget_set(struct parse_context *ctx, const struct parse_limits *limits)
+{
+  struct parse_budget *bud = ctx->budget;
+
+  if (!limits) {
+    budget_free(ctx);
+    return true;
+  }
+  if (!bud && !(bud = calloc(1, sizeof(struct parse_budget))))
+    return false;
+  bud->limits = *limits;
+  if (!bud->limits.time)
+    bud->limits.time = UINT64_MAX;
+  if (!bud->limits.cputime)
+    bud->limits.cputime = UINT64_MAX;
+  if (!bud->limits.bytes)
+    bud->limits.bytes = UINT64_MAX;
+  if (!bud->limits.nodes)
+    bud->limits.nodes = UINT64_MAX;
+  if (!bud->limits.memory)
+    bud->limits.memory = UINT64_MAX;
+  ctx->budget = bud;
+  budget_start(ctx);
+  return true;
+}
+
+/* Start the budget of the context again, clearing any limit reached */
+void budget_start(struct parse_context *ctx)
+{
+  struct parse_budget *bud = ctx->budget;
+
+  if (budget_reached(ctx))
+    ctx->int_error = IE_NONE;
+  if (!bud)
+    return;
+  bud->bytes = bud->nodes = 0;
+  bud->membase = ctx->obsmemory;
+  bud->start = bud->limits.time != UINT64_MAX ?
+      budget_clock(CLOCK_MONOTONIC) : 0;
+  bud->cpustart = bud->limits.cputime != UINT64_MAX ?
+      budget_clock(CLOCK_THREAD_CPUTIME_ID) : 0;
+  bud->tick = BUDGET_TICKS;
+}
+
+/* Note that the given limit has been reached, unless the parse has already
+ * been stopped
+ */
+void budget_exceed(struct parse_context *ctx, enum parse_interrcode code)
+{
+  if (!ctx_halted(ctx))
+    ctx->int_error = code;
+}
+
+/* Return true if a limit of the budget has been reached, the clocks being
+ * read only at every few checks
+ */
+bool budget_exceeded(struct parse_context *ctx)
+{
+  struct parse_budget *bud = ctx->budget;
+
+  if (budget_reached(ctx))
+    return true;
+  if (ctx->obsmemory > bud->membase &&
+      ctx->obsmemory - bud->membase > bud->limits.memory)
+    budget_exceed(ctx, IE_MEMLIMIT);
+  else if (!--bud->tick) {
+    bud->tick = BUDGET_TICKS;
+    if (bud->limits.time != UINT64_MAX &&
+        budget_clock(CLOCK_MONOTONIC) - bud->start > bud->limits.time)
+      budget_exceed(ctx, IE_TIMELIMIT);
+    else if (bud->limits.cputime != UINT64_MAX &&
+             budget_clock(CLOCK_THREAD_CPUTIME_ID) - bud->cpustart >
+             bud->limits.cputime)
+      budget_exceed(ctx, IE_TIMELIMIT);
+  }
+  return budget_reached(ctx);
+}
+
+/* Abandon the sources once a limit has been reached, so that the context is
+ * left to be given another source
+ */
+void budget_abandon(struct parse_context *ctx)
+{
+  if (!budget_reached(ctx))
+    return;
+  source_drop(ctx);
+  stailq_clear(ctx->lst_heredoc);
+  ctx->tokpushback = false;
+  ctx->heredoceof = false;
+}
+
+/* Release the budget of the context */
+void budget_free(struct parse_context *ctx)
+{
+  if (ctx->budget) {
+    free(ctx->budget);
+    ctx->budget = NULL;
+  }
+}
+
+/* Allocate a chunk of one of the obstacks of the context given, keeping its
+ * size before it so that the memory taken is known when it is released
+ */
+void *budget_chunk_alloc(void *arg, size_t size)
+{
+  struct parse_context *ctx = arg;
+  char *mem = malloc(CHUNK_HDR + size);
+
+  if (!mem)
+    return NULL;
+  *(size_t *)mem = size;
+  ctx->obsmemory += size;
+  return mem + CHUNK_HDR;
+}
+
+/* Release a chunk allocated by budget_chunk_alloc */
+void budget_chunk_free(void *arg, void *chunk)
+{
+  struct parse_context *ctx = arg;
+  char *mem = (char *)chunk - CHUNK_HDR;
+
+  ctx->obsmemory -= *(size_t *)mem;
+  free(mem);
+}
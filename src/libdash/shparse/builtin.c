@@ -1,67 +1,131 @@
 /*
- * This source provides the list of builtin commands
+ * This source provides the list of builtin commands, along with the words
+ * that other shells reserve but that are parsed here as the names of simple
+ * commands. They are found through a perfect hash of the first two characters,
+ * the last character and the length of the name folded to lower case. The hash
+ * is fixed for the names of the table, so the slots and the multipliers of the
+ * hash are made again by mkbuiltin.py should they change, and a debug build
+ * checks that every name is found in its slot.
  */
 
+#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include "enums.h"
 
 struct builtincmd {
   const char *name;                   /* Name of the builtin command */
   unsigned short flags;               /* Flags for the builtin command */
 };
 
+/* Provide the builtin commands and the words reserved by other shells, in the
+ * order of their identifiers
+ */
 static const struct builtincmd builtin[] = {
-  { ".",        3 },
-  { ":",        3 },
-  { "[",        0 },
-  { "alias",    6 },
-  { "bg",       2 },
-  { "break",    3 },
-  { "cd",       2 },
-  { "chdir",    0 },
-  { "command",  2 },
-  { "continue", 3 },
-  { "echo",     0 },
-  { "eval",     3 },
-  { "exec",     3 },
-  { "exit",     3 },
-  { "export",   7 },
-  { "false",    2 },
-  { "fg",       2 },
-  { "getopts",  2 },
-  { "hash",     2 },
-  { "jobs",     2 },
-  { "kill",     2 },
-  { "local",    7 },
-  { "printf",   0 },
-  { "pwd",      2 },
-  { "read",     2 },
-  { "readonly", 7 },
-  { "return",   3 },
-  { "set",      3 },
-  { "shift",    3 },
-  { "test",     0 },
-  { "times",    3 },
-  { "trap",     3 },
-  { "true",     2 },
-  { "type",     2 },
-  { "ulimit",   2 },
-  { "umask",    2 },
-  { "unalias",  2 },
-  { "unset",    3 },
-  { "wait",     2 },
+  { ".",        CF_SPECIAL | CF_REGULAR },
+  { ":",        CF_SPECIAL | CF_REGULAR },
+  { "[",        CF_NONE },
+  { "alias",    CF_REGULAR | CF_ASSIGN },
+  { "bg",       CF_REGULAR },
+  { "break",    CF_SPECIAL | CF_REGULAR },
+  { "cd",       CF_REGULAR },
+  { "chdir",    CF_NONE },
+  { "command",  CF_REGULAR },
+  { "continue", CF_SPECIAL | CF_REGULAR },
+  { "echo",     CF_NONE },
+  { "eval",     CF_SPECIAL | CF_REGULAR },
+  { "exec",     CF_SPECIAL | CF_REGULAR },
+  { "exit",     CF_SPECIAL | CF_REGULAR },
+  { "export",   CF_SPECIAL | CF_REGULAR | CF_ASSIGN },
+  { "false",    CF_REGULAR },
+  { "fg",       CF_REGULAR },
+  { "getopts",  CF_REGULAR },
+  { "hash",     CF_REGULAR },
+  { "jobs",     CF_REGULAR },
+  { "kill",     CF_REGULAR },
+  { "local",    CF_SPECIAL | CF_REGULAR | CF_ASSIGN },
+  { "printf",   CF_NONE },
+  { "pwd",      CF_REGULAR },
+  { "read",     CF_REGULAR },
+  { "readonly", CF_SPECIAL | CF_REGULAR | CF_ASSIGN },
+  { "return",   CF_SPECIAL | CF_REGULAR },
+  { "set",      CF_SPECIAL | CF_REGULAR },
+  { "shift",    CF_SPECIAL | CF_REGULAR },
+  { "test",     CF_NONE },
+  { "times",    CF_SPECIAL | CF_REGULAR },
+  { "trap",     CF_SPECIAL | CF_REGULAR },
+  { "true",     CF_REGULAR },
+  { "type",     CF_REGULAR },
+  { "ulimit",   CF_REGULAR },
+  { "umask",    CF_REGULAR },
+  { "unalias",  CF_REGULAR },
+  { "unset",    CF_SPECIAL | CF_REGULAR },
+  { "wait",     CF_REGULAR },
+  { "[[",       CF_KEYWORD },
+  { "coproc",   CF_KEYWORD },
+  { "function", CF_KEYWORD },
+  { "select",   CF_KEYWORD },
+  { "time",     CF_KEYWORD },
 };
 #define NUM_BLTIN (sizeof(builtin) / sizeof(struct builtincmd))
 
-static inline int
-bltin_compare(const void *key, const void *elem)
+/* The following is made by mkbuiltin.py from the names above */
+#define BLTIN_SLOTS 128
+#define BLTIN_MUL0  55
+#define BLTIN_MUL1  34
+
+/* Provide the identifier of the builtin command hashed to each slot */
+static const unsigned char bltin_slot[BLTIN_SLOTS] = {
+  40, 17,  0,  0, 32, 18,  0,  0,  0,  0, 13,  0,  8, 36,  0,  0,
+   0,  0,  0,  0,  0,  0, 28,  0,  0, 43,  0, 14,  0, 15,  0,  0,
+  23,  0,  6,  0,  0,  5, 19,  4,  0,  0,  0,  0,  0,  1,  0,  0,
+   0,  0,  0,  0,  0,  0, 16,  0, 38, 37,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0, 24,  0, 44,  0,  0,  0,  0, 11,  0, 30, 12,
+  25,  0,  0,  0,  0,  0, 31,  0,  0,  0,  0,  0, 27,  0,  0, 21,
+   0,  0,  0, 22,  0,  2,  0, 34,  0, 26, 42, 39, 41,  0,  9,  0,
+  10,  0,  0,  7,  0, 35,  0,  0,  0, 33,  0, 20,  0,  0, 29,  3,
+};
+/* End of the part made by mkbuiltin.py */
+
+/* Length of the longest name of a builtin command */
+#define BLTIN_MAXLEN 8
+
+static inline unsigned int
+bltin_lower(const char *name, size_t idx)
 {
-  const struct builtincmd *bkey = (const struct builtincmd *)key;
-  const struct builtincmd *belem = (const struct builtincmd *)elem;
+  return tolower((unsigned char)name[idx]);
+}
+
+/* Return the slot of the given name of the given length */
+static inline unsigned int
+bltin_hash(const char *name, size_t len)
+{
+  return (len + bltin_lower(name, 0) * BLTIN_MUL0 +
+          bltin_lower(name, len > 1) * BLTIN_MUL1 +
+          bltin_lower(name, len - 1)) % BLTIN_SLOTS;
+}
+
+/* Check if the given name of the given length is a builtin function */
+const struct builtincmd *
+find_builtin_len(const char *name, size_t len)
+{
+  const struct builtincmd *bltin;
+  unsigned char id;
+
+  if (!name || !len || len > BLTIN_MAXLEN)
+    return NULL;
+  if (!(id = bltin_slot[bltin_hash(name, len)]))
+    return NULL;
 
-  return strcasecmp(bkey->name, belem->name);
+  /* Confirm the name, since other names share the slot */
+  bltin = &builtin[id - 1];
+  if (strncasecmp(name, bltin->name, len) || bltin->name[len])
+    return NULL;
+  return bltin;
 }
 
 /* Check if given name is a builtin function */
@@ -69,16 +133,30 @@ const struct builtincmd *
 find_builtin(const char *name)
 {
   /* Check if a name was actually given */
-  if (name) {
-    /* Fill in the key value to perform search on */
-    struct builtincmd key;
-    key.name = name;
+  if (name)
+    return find_builtin_len(name, strlen(name));
+  return NULL;
+}
 
-    /* Perform the binary search */
-    return bsearch(&key, builtin, NUM_BLTIN, sizeof(struct builtincmd), bltin_compare);
+#if SHPARSE_DEBUG > 0
+/* Check once loaded that every name is found in its slot, which it will not be
+ * if the names were changed without making the slots again
+ */
+__attribute__((constructor)) static void
+bltin_check(void)
+{
+  size_t idx;
+
+  for (idx = 0; idx < NUM_BLTIN; idx++) {
+    if (find_builtin(builtin[idx].name) != &builtin[idx] ||
+        strlen(builtin[idx].name) > BLTIN_MAXLEN) {
+      fprintf(stderr, "BUILTIN: %s is not found, run mkbuiltin.py\n",
+              builtin[idx].name);
+      abort();
+    }
   }
-  return NULL;
 }
+#endif
 
 static inline bool
 in_builtin(const struct builtincmd *ptr)
@@ -93,6 +171,20 @@ builtin_name(const struct builtincmd *bltin)
   return bltin->name;
 }
 
+enum parse_cmdid
+builtin_id(const struct builtincmd *bltin)
+{
+  if (!in_builtin(bltin)) return CMD_NONE;
+  return (enum parse_cmdid)(bltin - builtin + 1);
+}
+
+const char *
+builtin_idname(enum parse_cmdid id)
+{
+  if (id <= CMD_NONE || id >= NUM_PARSER_CMDS) return NULL;
+  return builtin[id - 1].name;
+}
+
 unsigned short
 builtin_flags(const struct builtincmd *bltin)
 {
@@ -104,19 +196,19 @@ bool
 builtin_isspecial(const struct builtincmd *bltin)
 {
   if (!in_builtin(bltin)) return false;
-  return bltin->flags & 1;
+  return bltin->flags & CF_SPECIAL;
 }
 
 bool
 builtin_regular(const struct builtincmd *bltin)
 {
   if (!in_builtin(bltin)) return false;
-  return bltin->flags & 2;
+  return bltin->flags & CF_REGULAR;
 }
 
 bool
 builtin_assign(const struct builtincmd *bltin)
 {
   if (!in_builtin(bltin)) return false;
-  return bltin->flags & 4;
+  return bltin->flags & CF_ASSIGN;
 }
@@ -0,0 +1,73 @@
+/*
+ * This source provides the checkpoints taken between top-level commands. The
+ * state of the parse at that point is only the position within the source
+ * and the checks to be made on the next token, as no here document can be
+ * pending and the syntax stack is empty, so a checkpoint is a few numbers
+ * that let another context reading the same source carry on from it.
+ */
+
+#include "parser.h"
+#include "queue.h"
+
+/* Define the bits used to store the token checks */
+#define CK_ALIAS    0x01
+#define CK_KWD      0x02
+#define CK_NL       0x04
+#define CK_EOFMARK  0x08
+#define CK_ENDTOK   0x10
+
+/* Note the state of the parse after the last top-level command read, which
+ * fails if there is none to note because an alias or a here document is
+ * still being read or the source is not the only one
+ */
+bool checkpoint_take(struct parse_context *ctx, struct parse_checkpoint *cp)
+{
+  struct parse_tokflags *fl = &ctx->chkflags;
+
+  if (ctx->synerror.code != SE_NONE || ctx->bquote || !source_sole(ctx) ||
+      parse_suspended(ctx) ||
+      (ctx->lst_heredoc && stailq_head(ctx->lst_heredoc)) ||
+      (ctx->lst_syntax && dtailq_head(ctx->lst_syntax)))
+    return false;
+
+  /* Only a token without text can be pushed back */
+  cp->pushback = INV_PARSER_TOKEN;
+  if (ctx->tokpushback) {
+    if (ctx->last_token.id != TEOF && ctx->last_token.id != TNL)
+      return false;
+    cp->pushback = ctx->last_token.id;
+  }
+  cp->offset = source_curroff(ctx);
+  cp->index = ctx->ncommand;
+  cp->line = source_currline(ctx);
+  cp->version = PARSE_CHECKPOINT_VERSION;
+  cp->chkflags = (fl->chkalias ? CK_ALIAS : 0) | (fl->chkkwd ? CK_KWD : 0) |
+      (fl->chknl ? CK_NL : 0) | (fl->chkeofmark ? CK_EOFMARK : 0) |
+      (fl->chkendtok ? CK_ENDTOK : 0);
+  return true;
+}
+
+/* Carry on the parse from the given checkpoint, the context reading the same
+ * source as the one the checkpoint was taken from with nothing read from it
+ * since it was pushed
+ */
+bool checkpoint_resume(struct parse_context          *ctx,
+                       const struct parse_checkpoint *cp)
+{
+  struct parse_tokflags *fl = &ctx->chkflags;
+
+  if (cp->version != PARSE_CHECKPOINT_VERSION || !source_sole(ctx) ||
+      !source_seek(ctx, cp->offset))
+    return false;
+  source_setline(ctx, cp->line);
+  ctx->ncommand = cp->index;
+  ctx->tokpushback = cp->pushback != INV_PARSER_TOKEN;
+  if (ctx->tokpushback)
+    ctx->last_token.id = cp->pushback;
+  fl->chkalias = !!(cp->chkflags & CK_ALIAS);
+  fl->chkkwd = !!(cp->chkflags & CK_KWD);
+  fl->chknl = !!(cp->chkflags & CK_NL);
+  fl->chkeofmark = !!(cp->chkflags & CK_EOFMARK);
+  fl->chkendtok = !!(cp->chkflags & CK_ENDTOK);
+  return true;
+}
@@ -8,6 +8,32 @@
 #include "parser.h"
 #include "queue.h"
 
+/* Release the obstack of one of the internal lists */
+static inline void ctx_release_list(void *que)
+{
+  if (que)
+    obstack_free((struct obstack *)que, NULL);
+}
+
+/* Release everything held by the context apart from the context itself */
+static void ctx_release(struct parse_context *ctx)
+{
+  fini_source(ctx);
+  intern_free(ctx);
+  alias_free(ctx);
+  arith_free(ctx);
+  seg_free(ctx);
+  shadow_free(ctx);
+  recover_free(ctx);
+  budget_free(ctx);
+  feed_free(ctx);
+  parse_stack_free(ctx);
+  ctx_release_list(ctx->lst_syntax);
+  ctx_release_list(ctx->lst_heredoc);
+  obstack_free(&ctx->txtstack, NULL);
+  obstack_free(&ctx->memstack, NULL);
+}
+
 /*
  * Initialise a new context including the related obstack and internal lists
  */
@@ -19,24 +45,38 @@ bool ctx_init(struct parse_context **ctx)
   if (*ctx) {
     /* Re-initialise existing context */
     new = *ctx;
-    stailq_clear(new->source);
-    dtailq_clear(new->lst_syntax);
-    stailq_clear(new->lst_heredoc);
-    stailq_clear(new->backquote);
-    obstack_free(&new->memstack, NULL);
-    obstack_free(&new->txtstack, NULL);
-  } else {
-    /* Initialise a new context */
-    if (!(new = malloc(sizeof(struct parse_context))))
-      return false;
-    memset(new, 0, sizeof(struct parse_context));
-    obstack_init(&new->memstack);
-    obstack_init(&new->txtstack);
-    init_source(new);
-    /*new->lst_syntax = dtailq_init(new, NULL, sizeof(struct parse_syntax));  -- defer to actual usage */
-    new->lst_heredoc = stailq_init(new, NULL, sizeof(struct parse_heredoc));
-    new->backquote = stailq_init(new, NULL, sizeof(struct parse_nodelist));
-    *ctx = new;
+    ctx_release(new);
+  } else if (!(new = malloc(sizeof(struct parse_context)))) {
+    return false;
+  }
+
+  /* Initialise a new context, the memory of its obstacks being counted */
+  memset(new, 0, sizeof(struct parse_context));
+  obstack_specify_allocation_with_arg(&new->memstack, 0, 0,
+      budget_chunk_alloc, budget_chunk_free, new);
+  obstack_specify_allocation_with_arg(&new->txtstack, 0, 0,
+      budget_chunk_alloc, budget_chunk_free, new);
+  init_source(new);
+  /*new->lst_syntax = dtailq_init(new, NULL, sizeof(struct parse_syntax));  -- defer to actual usage */
+  new->lst_heredoc = stailq_init(new, NULL, sizeof(struct parse_heredoc));
+  new->bqtail = &new->bqlist;
+  *ctx = new;
+  return true;
+}
+
+/* Give the context the settings and aliases of another, if there is one */
+bool ctx_inherit(struct parse_context *ctx, struct parse_context *tmpl)
+{
+  if (!tmpl)
+    return true;
+  ctx->internwords = tmpl->internwords;
+  ctx->wordsegments = tmpl->wordsegments;
+  ctx->narynodes = tmpl->narynodes;
+  ctx->maxdepth = tmpl->maxdepth;
+  if ((tmpl->budget && !budget_set(ctx, &tmpl->budget->limits)) ||
+      !alias_copy(ctx, tmpl)) {
+    ctx->int_error = IE_NOMEMORY;
+    return false;
   }
   return true;
 }
@@ -47,12 +87,7 @@ void ctx_fini(struct parse_context **ctx)
   if (!ctx || !*ctx) return;
   fre = *ctx;
   *ctx = NULL;
-  fini_source(fre);
-  dtailq_clear(fre->lst_syntax);
-  stailq_clear(fre->lst_heredoc);
-  stailq_clear(fre->backquote);
-  obstack_free(&fre->txtstack, NULL);
-  obstack_free(&fre->memstack, NULL);
+  ctx_release(fre);
   free(fre);
 }
 
@@ -93,7 +128,7 @@ void set_synerror(struct parse_context  *ctx,
                   struct parse_token    *token,
                   char                  *errtext)
 {
-  if (ctx) {
+  if (ctx && !ctx_halted(ctx)) {
     ctx->synerror.code = code;
     if (code == SE_EXPECTED && token)
       ctx->synerror.token = *token;
@@ -106,15 +141,17 @@ void clr_synerror(struct parse_context *ctx)
 {
   if (ctx) {
     ctx->synerror.code = SE_NONE;
-    if (ctx->synerror.errtext)
+    if (ctx->synerror.errtext) {
       obstack_free(&ctx->memstack, ctx->synerror.errtext);
+      ctx->synerror.errtext = NULL;
+    }
   }
 }
 
 void ctx_synerror_expect(struct parse_context *ctx,
                          enum parse_tokid      tokid)
 {
-  if (ctx && tokid != INV_PARSER_TOKEN) {
+  if (ctx && !ctx_halted(ctx) && tokid != INV_PARSER_TOKEN) {
     ctx->synerror.code = SE_EXPECTED;
     ctx->synerror.token.id = tokid;
     if (ctx->synerror.errtext) {
@@ -129,7 +166,7 @@ void ctx_synerror(struct parse_context  *ctx,
                   enum parse_tokid       tokid,
                   char                  *errtext)
 {
-  if (ctx) {
+  if (ctx && !ctx_halted(ctx)) {
     ctx->synerror.code = errcode;
     ctx->synerror.token.id = tokid;
     if (ctx->synerror.errtext)
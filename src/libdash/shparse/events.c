@@ -0,0 +1,97 @@
+/*
+ * This source provides the parsing of a script that gives its structure to a
+ * set of callbacks in place of building its nodes. The syntax is checked as
+ * it would be by parse_check, with the start and end of each node, its words,
+ * redirections and separating tokens given as they are read, so the memory
+ * used is that of the largest top-level command rather than the script.
+ */
+
+#include "parser.h"
+
+/* Return true if events are still to be given, which they are not once the
+ * parse is stopped or a syntax error is found
+ */
+static bool event_live(struct parse_context *ctx)
+{
+  return !ctx_halted(ctx) && ctx->synerror.code == SE_NONE;
+}
+
+/* Note that a callback has asked for the parse to stop */
+static void event_stop(struct parse_context *ctx, bool ok)
+{
+  if (!ok)
+    ctx->int_error = IE_STOPPED;
+}
+
+/* Give the start of a node */
+void event_begin(struct parse_context *ctx,
+                 enum parse_nodetype   type,
+                 unsigned int          line)
+{
+  const struct parse_events *ev = ctx->events;
+
+  if (ev->begin && event_live(ctx))
+    event_stop(ctx, ev->begin(ev->arg, type, line));
+}
+
+/* Give the word of the given token along with any further flags */
+void event_word(struct parse_context *ctx,
+                struct parse_token   *tok,
+                unsigned int          flags)
+{
+  const struct parse_events *ev = ctx->events;
+
+  if (ev->word && event_live(ctx))
+    event_stop(ctx, ev->word(ev->arg, token_text((*tok)),
+        token_length((*tok)) - 1, tok->flags | flags));
+}
+
+/* Give a redirection with the word of the given token as its target */
+void event_redir(struct parse_context *ctx,
+                 union parse_node     *n,
+                 struct parse_token   *tok)
+{
+  const struct parse_events *ev = ctx->events;
+
+  if (ev->redir && event_live(ctx))
+    event_stop(ctx, ev->redir(ev->arg, n->type, n->nfile.fd,
+        token_text((*tok)), token_length((*tok)) - 1));
+}
+
+/* Give a token separating the parts of a node */
+void event_token(struct parse_context *ctx, enum parse_tokid tok)
+{
+  const struct parse_events *ev = ctx->events;
+
+  if (ev->token && event_live(ctx))
+    event_stop(ctx, ev->token(ev->arg, tok));
+}
+
+/* Give the end of a node */
+void event_end(struct parse_context *ctx, enum parse_nodetype type)
+{
+  const struct parse_events *ev = ctx->events;
+
+  if (ev->end && event_live(ctx))
+    event_stop(ctx, ev->end(ev->arg, type));
+}
+
+/* Parse the remainder of the sources giving its structure to the callbacks,
+ * returning false if there is a syntax error, which is described in the given
+ * diagnostic, or if a callback stopped the parse
+ */
+bool events_parse(struct parse_context      *ctx,
+                  const struct parse_events *ev,
+                  struct parse_diag         *diag)
+{
+  bool narynodes = ctx->narynodes, ok;
+
+  if (ctx->int_error == IE_STOPPED)
+    ctx->int_error = IE_NONE;
+  ctx->events = ev;
+  ctx->narynodes = false;
+  ok = ctx_skim(ctx, diag, NULL, NULL);
+  ctx->events = NULL;
+  ctx->narynodes = narynodes;
+  return ok;
+}
@@ -0,0 +1,138 @@
+/*
+ * This source provides the input of an interactive front end, given a line
+ * at a time, along with whether it ends within a command that needs more of
+ * it. Only the input from the end of the last complete top-level command is
+ * checked again as each line is added, so that those already complete are
+ * not read again.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+struct parse_feed {
+  char                 *text;         /* Input given so far */
+  size_t                len;          /* Length of the input */
+  size_t                maxlen;       /* Space allocated for the input */
+  size_t                done;         /* End of the complete commands */
+  bool                  more;         /* Set if the input ends within a command */
+};
+
+/* Define the state of a check of the input */
+struct feed_check {
+  size_t                mark;         /* End of the last complete command */
+  bool                  open;         /* Set if the last command ended the input */
+};
+
+/* Note the end of each command, which can be started from again when it was
+ * ended by a newline with no here-document still being read
+ */
+static bool feed_command(struct parse_context *ctx,
+                         union parse_node     *n,
+                         void                 *arg)
+{
+  struct feed_check *chk = arg;
+  struct parse_checkpoint cp;
+
+  chk->open = ctx->heredoceof ||
+              (ctx->tokpushback && ctx->last_token.id == TEOF);
+  if (!chk->open && checkpoint_take(ctx, &cp))
+    chk->mark = cp.offset;
+  return true;
+}
+
+/* Check the input from the end of the last complete command, noting whether
+ * it ends within a command. The input ends within a command when its syntax
+ * error is found once all of it has been read, when a here-document is ended
+ * by it, or when the last command is ended by it rather than by a newline.
+ */
+static bool feed_check(struct parse_context *ctx)
+{
+  struct parse_feed *fd = ctx->feed;
+  struct parse_memory mem = { fd->text + fd->done, fd->len - fd->done };
+  struct parse_context *chkctx = NULL;
+  struct feed_check chk = { 0, false };
+  bool ok = false;
+
+  if (!ctx_init(&chkctx))
+    goto done;
+  if (!ctx_inherit(chkctx, ctx) || !push_source(chkctx, SRC_MEMORY, &mem))
+    goto done;
+  if (ctx_skim(chkctx, NULL, feed_command, &chk)) {
+    fd->more = chk.open || chkctx->heredoceof;
+  } else if (chkctx->int_error == IE_NOMEMORY) {
+    goto done;
+  } else {
+    fd->more = chkctx->synerror.code != SE_NONE &&
+               chkctx->int_error == IE_NOSOURCE;
+  }
+  fd->done += chk.mark;
+  ok = true;
+
+done:
+  if (!ok)
+    ctx->int_error = IE_NOMEMORY;
+  ctx_fini(&chkctx);
+  return ok;
+}
+
+/* Add the given text to the input, checking whether it now ends within a
+ * command
+ */
+bool feed_add(struct parse_context *ctx, const char *text, size_t len)
+{
+  struct parse_feed *fd = ctx->feed;
+
+  if (!fd) {
+    if (!(fd = calloc(1, sizeof(struct parse_feed)))) {
+      ctx->int_error = IE_NOMEMORY;
+      return false;
+    }
+    ctx->feed = fd;
+  }
+  if (fd->len + len > fd->maxlen) {
+    size_t newmax = fd->maxlen ? fd->maxlen : 256;
+    char *newp;
+
+    while (newmax < fd->len + len)
+      newmax *= 2;
+    if (!(newp = realloc(fd->text, newmax))) {
+      ctx->int_error = IE_NOMEMORY;
+      return false;
+    }
+    fd->text = newp;
+    fd->maxlen = newmax;
+  }
+  memcpy(fd->text + fd->len, text, len);
+  fd->len += len;
+  return feed_check(ctx);
+}
+
+/* Return true if the input given ends within a command */
+bool feed_more(struct parse_context *ctx)
+{
+  return ctx->feed && ctx->feed->more;
+}
+
+/* Discard the input given, once the front end has taken it */
+void feed_clear(struct parse_context *ctx)
+{
+  struct parse_feed *fd = ctx->feed;
+
+  if (fd) {
+    fd->len = fd->done = 0;
+    fd->more = false;
+  }
+}
+
+/* Release the input of the context */
+void feed_free(struct parse_context *ctx)
+{
+  struct parse_feed *fd = ctx->feed;
+
+  if (fd) {
+    ctx->feed = NULL;
+    free(fd->text);
+    free(fd);
+  }
+}
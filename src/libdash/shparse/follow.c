@@ -0,0 +1,336 @@
+/*
+ * This source provides the parsing of a script along with the files that it
+ * reads with the dot command, and those that they read in turn. A file named
+ * by a literal word is found as the shell would find it, either at the path
+ * given when it holds a slash or in the directories searched, and is queued
+ * to be parsed by one of several threads. Each file is parsed only once, as
+ * files are told apart by their device, inode and time of modification, and
+ * the command that reads it is linked to it.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "parser.h"
+
+#define FOL_MINSLOT   64              /* Slots in the table of files at first */
+#define FOL_MAXTHREAD 256             /* Most threads that will be used */
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Define the work shared by the threads */
+struct parse_follow {
+  struct parse_context      *tmpl;    /* Context giving the settings to use */
+  const char                *path;    /* Directories searched for files */
+  struct parse_sourced_set  *set;     /* Files found so far */
+  size_t                     maxfile; /* Number of files allocated */
+  size_t                     next;    /* Next file to be parsed */
+  unsigned int               nbusy;   /* Number of files being parsed */
+  struct parse_sourced     **slot;    /* Table of files by their identity */
+  size_t                     nslot;   /* Number of slots in the table */
+  bool                       failed;  /* Set if memory ran out */
+  pthread_mutex_t            lock;    /* Lock for all of the above */
+  pthread_cond_t             cond;    /* Signalled as files are found or parsed */
+};
+
+/* Return the slot of the table for the given identity */
+static size_t fol_hash(struct parse_follow *fw,
+                       uint64_t             dev,
+                       uint64_t             ino,
+                       int64_t              mtime)
+{
+  uint64_t hash = (dev * 0x9e3779b97f4a7c15ULL) ^ ino;
+
+  hash = (hash * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)mtime;
+  hash ^= hash >> 29;
+  return hash & (fw->nslot - 1);
+}
+
+/* Double the table of files, placing each file again */
+static bool fol_grow(struct parse_follow *fw)
+{
+  size_t nslot = fw->nslot ? fw->nslot * 2 : FOL_MINSLOT;
+  struct parse_sourced **slot = calloc(nslot, sizeof(struct parse_sourced *));
+  size_t idx;
+
+  if (!slot)
+    return false;
+  free(fw->slot);
+  fw->slot = slot;
+  fw->nslot = nslot;
+  for (idx = 0; idx < fw->set->count; idx++) {
+    struct parse_sourced *f = fw->set->file[idx];
+    size_t pos = fol_hash(fw, f->dev, f->ino, f->mtime);
+
+    while (slot[pos])
+      pos = (pos + 1) & (nslot - 1);
+    slot[pos] = f;
+  }
+  return true;
+}
+
+/* Return the file with the identity given by the status of the given path,
+ * queueing it to be parsed if it has not been found before. The lock must be
+ * held.
+ */
+static struct parse_sourced *fol_add(struct parse_follow *fw,
+                                     const char          *path,
+                                     const struct stat   *st)
+{
+  struct parse_sourced *f;
+  int64_t mtime = (int64_t)st->st_mtim.tv_sec * 1000000000 +
+                  st->st_mtim.tv_nsec;
+  size_t pos;
+
+  if (fw->failed)
+    return NULL;
+  if ((fw->set->count + 1) * 2 > fw->nslot && !fol_grow(fw))
+    goto fail;
+  pos = fol_hash(fw, st->st_dev, st->st_ino, mtime);
+  for (; (f = fw->slot[pos]); pos = (pos + 1) & (fw->nslot - 1))
+    if (f->dev == (uint64_t)st->st_dev && f->ino == (uint64_t)st->st_ino &&
+        f->mtime == mtime)
+      return f;
+
+  if (fw->set->count == fw->maxfile) {
+    size_t newmax = fw->maxfile ? fw->maxfile * 2 : 16;
+    struct parse_sourced **newfile = realloc(fw->set->file,
+        newmax * sizeof(struct parse_sourced *));
+
+    if (!newfile)
+      goto fail;
+    fw->set->file = newfile;
+    fw->maxfile = newmax;
+  }
+  if (!(f = calloc(1, sizeof(struct parse_sourced))))
+    goto fail;
+  if (!(f->path = strdup(path))) {
+    free(f);
+    goto fail;
+  }
+  f->dev = st->st_dev;
+  f->ino = st->st_ino;
+  f->mtime = mtime;
+  fw->slot[pos] = f;
+  fw->set->file[fw->set->count++] = f;
+  pthread_cond_signal(&fw->cond);
+  return f;
+
+fail:
+  fw->failed = true;
+  return NULL;
+}
+
+/* Find the file read by the dot command with the given name, as the shell
+ * would find it, filling in its status and returning its path or NULL
+ */
+static const char *fol_find(struct parse_follow *fw,
+                            const char          *name,
+                            char                *buf,
+                            struct stat         *st)
+{
+  const char *dir = fw->path, *end;
+  size_t namelen = strlen(name);
+
+  if (strchr(name, '/'))
+    return !stat(name, st) && S_ISREG(st->st_mode) ? name : NULL;
+  for (; dir; dir = *end ? end + 1 : NULL) {
+    size_t dirlen;
+
+    if (!(end = strchr(dir, ':')))
+      end = dir + strlen(dir);
+    dirlen = end - dir;
+    if (dirlen + namelen + 2 > PATH_MAX)
+      continue;
+    if (dirlen) {
+      memcpy(buf, dir, dirlen);
+      buf[dirlen++] = '/';
+    }
+    memcpy(buf + dirlen, name, namelen + 1);
+    if (!stat(buf, st) && S_ISREG(st->st_mode))
+      return buf;
+  }
+  return NULL;
+}
+
+/* Return the literal text of the given word when it is short enough to be a
+ * path, using the given buffer if its quoting has to be removed
+ */
+static const char *fol_literal(union parse_node *n, char *buf)
+{
+  size_t len;
+  const char *text = word_literal(n, buf, PATH_MAX, &len);
+
+  return text && len < PATH_MAX ? text : NULL;
+}
+
+/* Link the given simple command to the file it reads when it is the dot
+ * command naming a file by a literal word, queueing the file to be parsed
+ */
+void follow_command(struct parse_context *ctx, union parse_node *n)
+{
+  struct parse_follow *fw = ctx->follow;
+  union parse_node *arg = n->ncmd.args;
+  char buf[PATH_MAX], found[PATH_MAX];
+  const char *name, *path;
+  struct stat st;
+
+  if (!arg)
+    return;
+  if (n->ncmd.cmdid != CMD_DOT &&
+      (!(name = fol_literal(arg, buf)) || strcmp(name, "source")))
+    return;
+  if ((arg = arg->narg.next) && (name = fol_literal(arg, buf)) &&
+      !strcmp(name, "--"))
+    arg = arg->narg.next;
+  if (!arg || !(name = fol_literal(arg, buf)) || !*name ||
+      !(path = fol_find(fw, name, found, &st)))
+    return;
+
+  pthread_mutex_lock(&fw->lock);
+  n->ncmd.sourced = fol_add(fw, path, &st);
+  pthread_mutex_unlock(&fw->lock);
+}
+
+/* Parse the commands of a file with a context of its own */
+static void fol_parse(struct parse_follow *fw, struct parse_sourced *f)
+{
+  struct parse_context *ctx = NULL;
+  union parse_node *n;
+  size_t maxcmd = 0;
+
+  f->error = true;
+  if (!ctx_init(&ctx))
+    return;
+  f->ctx = ctx;
+  if (!ctx_inherit(ctx, fw->tmpl))
+    return;
+  ctx->follow = fw;
+  if (!push_source(ctx, SRC_FILE, f->path)) {
+    ctx->int_error = IE_NOSOURCE;
+    return;
+  }
+
+  while ((n = ctx_next_command(ctx)) && n->type != NEOF) {
+    if (f->count == maxcmd) {
+      size_t newmax = maxcmd ? maxcmd * 2 : 64;
+      union parse_node **newcmd = realloc(f->cmd,
+          newmax * sizeof(union parse_node *));
+
+      if (!newcmd) {
+        ctx->int_error = IE_NOMEMORY;
+        return;
+      }
+      f->cmd = newcmd;
+      maxcmd = newmax;
+    }
+    f->cmd[f->count++] = n;
+  }
+  f->error = !n;
+}
+
+/* Parse the files queued until none are left and none are being parsed, as
+ * the files being parsed may queue more
+ */
+static void *fol_worker(void *arg)
+{
+  struct parse_follow *fw = arg;
+
+  pthread_mutex_lock(&fw->lock);
+  while (true) {
+    if (fw->next < fw->set->count) {
+      struct parse_sourced *f = fw->set->file[fw->next++];
+
+      fw->nbusy++;
+      pthread_mutex_unlock(&fw->lock);
+      fol_parse(fw, f);
+      pthread_mutex_lock(&fw->lock);
+      if (!f->ctx || f->ctx->int_error == IE_NOMEMORY)
+        fw->failed = true;
+      fw->nbusy--;
+    } else if (!fw->nbusy) {
+      break;
+    } else {
+      pthread_cond_wait(&fw->cond, &fw->lock);
+    }
+  }
+  pthread_cond_broadcast(&fw->cond);
+  pthread_mutex_unlock(&fw->lock);
+  return NULL;
+}
+
+/* Release the files parsed by following the dot command */
+void follow_free(struct parse_sourced_set *set)
+{
+  size_t idx;
+
+  for (idx = 0; idx < set->count; idx++) {
+    struct parse_sourced *f = set->file[idx];
+
+    ctx_fini(&f->ctx);
+    free(f->cmd);
+    free((char *)f->path);
+    free(f);
+  }
+  free(set->file);
+  memset(set, 0, sizeof(struct parse_sourced_set));
+}
+
+/* Parse the given script along with the files it reads with the dot command,
+ * searching the given directories for those named without a slash or the
+ * directories of PATH if none are given. Up to the given number of threads
+ * are used, or one for each processor if it is zero, with the settings and
+ * aliases of the given context if there is one. A file that could not be
+ * parsed is marked as such, its context holding the error.
+ */
+bool follow_parse(struct parse_context     *tmpl,
+                  const char               *fname,
+                  const char               *path,
+                  unsigned int              nthreads,
+                  struct parse_sourced_set *set)
+{
+  pthread_t tid[FOL_MAXTHREAD];
+  struct parse_follow fw;
+  unsigned int idx, nstarted = 0;
+  struct stat st;
+  bool result;
+
+  memset(set, 0, sizeof(struct parse_sourced_set));
+  if (stat(fname, &st) || !S_ISREG(st.st_mode))
+    return false;
+  if (!nthreads) {
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = nproc > 0 ? nproc : 1;
+  }
+  if (nthreads > FOL_MAXTHREAD)
+    nthreads = FOL_MAXTHREAD;
+
+  memset(&fw, 0, sizeof(struct parse_follow));
+  fw.tmpl = tmpl;
+  fw.path = path ? path : getenv("PATH");
+  fw.set = set;
+  pthread_mutex_init(&fw.lock, NULL);
+  pthread_cond_init(&fw.cond, NULL);
+  fol_add(&fw, fname, &st);
+
+  /* Each thread waits for more files while any are being parsed */
+  for (idx = 1; idx < nthreads; idx++)
+    if (!pthread_create(&tid[nstarted], NULL, fol_worker, &fw))
+      nstarted++;
+  fol_worker(&fw);
+  for (idx = 0; idx < nstarted; idx++)
+    pthread_join(tid[idx], NULL);
+
+  result = !fw.failed;
+  pthread_cond_destroy(&fw.cond);
+  pthread_mutex_destroy(&fw.lock);
+  free(fw.slot);
+  if (!result)
+    follow_free(set);
+  return result;
+}
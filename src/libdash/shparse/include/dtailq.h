@@ -63,6 +63,7 @@ DTAILQ_INLINE void dtailq_clear(void *que)
     struct _dtailq *hdr = (struct _dtailq *)que;
     if (hdr->first) {
       obstack_free(&hdr->memstack, NULL);
+      obstack_init(&hdr->memstack);
       hdr->first = NULL;
       hdr->last = &hdr->first;
     }
@@ -143,8 +144,11 @@ DTAILQ_INLINE void *dtailq_remove_head(void *que)
     struct _dtailq *hdr = (struct _dtailq *)que;
     if (hdr->first) {
       struct _dtailq_elm *ptr = hdr->first;
-      ptr->next->prev = NULL;
-      hdr->first = ptr->next;
+      if (!(hdr->first = ptr->next))
+        hdr->last = &hdr->first;
+      else
+        hdr->first->prev = &hdr->first;
+      ptr->prev = NULL;
       return ptr;
     }
   }
@@ -238,7 +242,7 @@ DTAILQ_INLINE void *dtailq_tail(void *que)
 {
   if (que) {
     struct _dtailq *hdr = (struct _dtailq *)que;
-    return *hdr->last;
+    return hdr->first ? (void *)hdr->last : NULL;
   } else {
     return NULL;
   }
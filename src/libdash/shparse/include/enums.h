@@ -8,7 +8,8 @@
 enum parse_nodetype {
   NCMD = 0, NPIPE, NREDIR, NBACKGND, NSUBSHELL, NAND, NOR, NSEMI, NIF, NWHILE,
   NUNTIL, NFOR, NCASE, NCLIST, NDEFUN, NARG, NTO, NCLOBBER, NFROM, NFROMTO,
-  NAPPEND, NTOFD, NFROMFD, NHERE, NXHERE, NNOT, NEOF,
+  NAPPEND, NTOFD, NFROMFD, NHERE, NXHERE, NNOT, NEOF, NARITH, NERROR,
+  NSEQ, NANDOR, NIFCHAIN, NPIPELINE,
   NUM_PARSER_NODES,                 /* Number of types of node */
   INV_PARSER_NODE                   /* Represents an invalid node */
 };
@@ -40,6 +41,7 @@ enum parse_synerrcode {
   SE_MISSING,
   SE_QUOTESTR,
   SE_BACKEOF,
+  SE_TOODEEP,
 };
 
 enum tri_value {
@@ -53,12 +55,74 @@ enum parse_interrcode {
   IE_NOSOURCE,                             /* No source stack defined */
   IE_NOUNGET,                              /* No data to unget */
   IE_NOGETCHR,                             /* No data to get */
+  IE_NOMEMORY,                             /* Unable to allocate memory */
+  IE_STOPPED,                              /* Stopped by an event callback */
+  IE_TIMELIMIT,                            /* Time allowed has been used */
+  IE_BYTELIMIT,                            /* Input allowed has been read */
+  IE_NODELIMIT,                            /* Nodes allowed have been allocated */
+  IE_MEMLIMIT,                             /* Memory allowed has been used */
+};
+
+/* Define the operations of a compiled arithmetic expression, which are
+ * evaluated in order against a stack of values
+ */
+enum parse_arithop {
+  AOP_NUM = 0,                 /* Push the number indexed by the argument */
+  AOP_VAR,                     /* Push the variable named by the argument */
+  AOP_PARAM,                   /* Push the expanded parameter named by the argument */
+  AOP_EXPAND,                  /* Push the result of the expansion text of the argument */
+  AOP_NEG,                     /* Unary operators */
+  AOP_POS,
+  AOP_NOT,
+  AOP_BNOT,
+  AOP_MUL,                     /* Binary operators */
+  AOP_DIV,
+  AOP_REM,
+  AOP_ADD,
+  AOP_SUB,
+  AOP_SHL,
+  AOP_SHR,
+  AOP_LT,
+  AOP_LE,
+  AOP_GT,
+  AOP_GE,
+  AOP_EQ,
+  AOP_NE,
+  AOP_BAND,
+  AOP_BXOR,
+  AOP_BOR,
+  AOP_LAND,                    /* If the top is zero skip argument instructions, else pop it */
+  AOP_LOR,                     /* If the top is non-zero make it 1 and skip argument instructions, else pop it */
+  AOP_BOOL,                    /* Replace the top with 0 or 1 */
+  AOP_JZ,                      /* Pop the top, skipping argument instructions if zero */
+  AOP_JMP,                     /* Skip argument instructions */
+  AOP_ASSIGN,                  /* Assign the top to the variable named by the argument */
+};
+
+/* Flags describing a compiled arithmetic expression */
+enum parse_arithflags {
+  AF_NONE        = 0,
+  AF_EXPAND      = 0x01,        /* Expression contains expansions */
+  AF_INVALID     = 0x02,        /* Expression could not be compiled */
+};
+
+/* Define the states used when tokenizing to decide where keywords may be
+ * recognised, TS_CHKKWD is added when the next word may be a keyword
+ */
+enum parse_tokstate {
+  TS_NONE = 0,                 /* Not within a for or case */
+  TS_FORVAR,                   /* Expecting the variable of a for */
+  TS_FORIN,                    /* Expecting the in of a for */
+  TS_CASEWORD,                 /* Expecting the word of a case */
+  TS_CASEIN,                   /* Expecting the in of a case */
+  TS_CHKKWD = 0x80             /* Next word may be a keyword */
 };
 
 /* Define the types of source that can be processed */
 enum parse_srctype {
   SRC_FILE = 0,                /* Source is a named file */
   SRC_STRING,                  /* Source is a string */
+  SRC_MEMORY,                  /* Source is a buffer of known length */
   SRC_NUM,                     /* Number of source types */
 #if defined(NEED_DUMMY_OPS) && NEED_DUMMY_OPS
   SRC_DUMMY                    /* Dummy source */
@@ -86,3 +150,83 @@ enum parse_varsubs {
   VSTRIMLEFTMAX  = 0x9,         /* ${var##pattern} */
   VSLENGTH       = 0xa,         /* ${#var} */
 };
+
+/* Define the kinds of segment that make up the text of a word */
+enum parse_segkind {
+  SEG_LITERAL    = 0,           /* Literal text, possibly quoted */
+  SEG_VAR,                      /* Parameter expansion */
+  SEG_BACKQ,                    /* Command substitution */
+  SEG_ARITH,                    /* Arithmetic expansion */
+};
+
+/* Flags describing the content of a word token */
+enum parse_wordflags {
+  WF_NONE        = 0,
+  WF_QUOTED      = 0x01,        /* Word contains quoting */
+  WF_CTLCHAR     = 0x02,        /* Word contains control characters */
+  WF_EXPAND      = 0x04,        /* Word contains an expansion */
+  WF_KEYWORD     = 0x08,        /* Word was recognised as a keyword */
+  WF_ASSIGN      = 0x10,        /* Word is an assignment, only given to events */
+};
+
+/* Define the builtin commands that a simple command is found to run, and the
+ * words reserved by other shells that name one here, given in the order of
+ * the table of builtins
+ */
+enum parse_cmdid {
+  CMD_NONE       = 0,           /* Not a builtin, or named by an expansion */
+  CMD_DOT,                      /* . */
+  CMD_COLON,                    /* : */
+  CMD_LBRACKET,                 /* [ */
+  CMD_ALIAS,
+  CMD_BG,
+  CMD_BREAK,
+  CMD_CD,
+  CMD_CHDIR,
+  CMD_COMMAND,
+  CMD_CONTINUE,
+  CMD_ECHO,
+  CMD_EVAL,
+  CMD_EXEC,
+  CMD_EXIT,
+  CMD_EXPORT,
+  CMD_FALSE,
+  CMD_FG,
+  CMD_GETOPTS,
+  CMD_HASH,
+  CMD_JOBS,
+  CMD_KILL,
+  CMD_LOCAL,
+  CMD_PRINTF,
+  CMD_PWD,
+  CMD_READ,
+  CMD_READONLY,
+  CMD_RETURN,
+  CMD_SET,
+  CMD_SHIFT,
+  CMD_TEST,
+  CMD_TIMES,
+  CMD_TRAP,
+  CMD_TRUE,
+  CMD_TYPE,
+  CMD_ULIMIT,
+  CMD_UMASK,
+  CMD_UNALIAS,
+  CMD_UNSET,
+  CMD_WAIT,
+  CMD_DBLBRACKET,               /* [[, reserved by other shells */
+  CMD_COPROC,                   /* Reserved by other shells */
+  CMD_FUNCTION,                 /* Reserved by other shells */
+  CMD_SELECT,                   /* Reserved by other shells */
+  CMD_TIME,                     /* Reserved by other shells */
+  NUM_PARSER_CMDS               /* Number of command identifiers */
+};
+
+/* Flags describing the builtin command run by a simple command */
+enum parse_cmdflags {
+  CF_NONE        = 0,
+  CF_SPECIAL     = 0x01,        /* Special builtin */
+  CF_REGULAR     = 0x02,        /* Regular builtin, found before the path */
+  CF_ASSIGN      = 0x04,        /* Arguments may be assignments */
+  CF_KEYWORD     = 0x08,        /* Reserved by other shells, a command here */
+};
@@ -8,13 +8,18 @@
 #include <ctype.h>
 #include <obstack.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "enums.h"
+#include "structs.h"
 
 /* Provide the various underlying parser nodes */
 struct parse_ncmd {
   enum parse_nodetype type;
   unsigned int linno;
+  enum parse_cmdid cmdid;             /* Builtin or keyword named first */
+  unsigned short cmdflags;            /* Flags of that builtin or keyword */
+  struct parse_sourced *sourced;      /* File read by the dot command if followed */
   union parse_node *assign;
   union parse_node *args;
   union parse_node *redirect;
@@ -77,9 +82,14 @@ struct parse_ndefun {
 
 struct parse_narg {
   enum parse_nodetype type;
+  uint32_t textlen;                   /* Length of the text */
   union parse_node *next;
   char *text;
   struct parse_nodelist *backquote;
+  union parse_node *arith;
+  struct parse_segment *seg;
+  uint32_t nseg;
+  unsigned char flags;
 };
 
 struct parse_nfile {
@@ -110,6 +120,67 @@ struct parse_nnot {
   union parse_node *com;
 };
 
+/* Provide the instructions of an arithmetic expansion, the argument is the
+ * index of the number or name used, or the number of instructions to skip
+ */
+struct parse_arith_insn {
+  uint8_t  op;
+  uint32_t arg;
+};
+
+struct parse_narith {
+  enum parse_nodetype type;
+  union parse_node *next;
+  struct parse_arith_insn *insn;
+  intmax_t *num;
+  const char **name;
+  uint32_t ninsn;
+  uint32_t nnum;
+  uint32_t nname;
+  unsigned char flags;
+};
+
+/* Provide the node left in place of a command that had a syntax error when
+ * recovering from errors, the argument is the index of its diagnostic
+ */
+struct parse_nerror {
+  enum parse_nodetype type;
+  unsigned int linno;
+  uint32_t diag;
+};
+
+/* Define the n-ary nodes built in place of the chains of the nodes above when
+ * they are enabled, all holding their children in an array. An and-or list
+ * has the operator joining each child to the next, and an if has the test
+ * and then part of each of its if and elif parts in turn.
+ */
+struct parse_nseq {
+  enum parse_nodetype type;
+  uint32_t count;
+  union parse_node **child;
+};
+
+struct parse_nandor {
+  enum parse_nodetype type;
+  uint32_t count;
+  union parse_node **child;
+  unsigned char *op;
+};
+
+struct parse_nifchain {
+  enum parse_nodetype type;
+  uint32_t count;
+  union parse_node **child;
+  union parse_node *elsepart;
+};
+
+struct parse_npipeline {
+  enum parse_nodetype type;
+  uint32_t count;
+  union parse_node **child;
+  bool backgnd;
+};
+
 union parse_node {
   enum parse_nodetype type;
   struct parse_ncmd ncmd;
@@ -126,6 +197,12 @@ union parse_node {
   struct parse_ndup ndup;
   struct parse_nhere nhere;
   struct parse_nnot nnot;
+  struct parse_narith narith;
+  struct parse_nerror nerror;
+  struct parse_nseq nseq;
+  struct parse_nandor nandor;
+  struct parse_nifchain nifchain;
+  struct parse_npipeline npipeline;
 };
 
 struct parse_nodelist {
@@ -149,6 +226,8 @@ struct parse_heredoc {
   union parse_node     *here;
   char                 *eofmark;
   bool                  striptabs;
+  bool                  started;
+  bool                  ended;
 };
 
 #ifdef STAILQ_HEAD
@@ -180,6 +259,8 @@ struct parse_syntax {
   bool                   innerdq;
   bool                   varpushed;
   bool                   dblquote;
+  size_t                 arithloc;
+  union parse_node      *arith;
 };
 
 #ifdef DTAILQ_HEAD
@@ -199,6 +280,12 @@ struct parse_string {
   size_t  len;
 };
 
+/* Structure describing the memory read by a SRC_MEMORY source */
+struct parse_memory {
+  const char *text;
+  size_t      len;
+};
+
 /* Structure used to provide the latest token retrieved */
 struct parse_token {
   enum parse_tokid    id;
@@ -206,6 +293,9 @@ struct parse_token {
     struct parse_string  value;
     union parse_node    *node;
   } val;
+  size_t              offset;        /* Offset of token within source */
+  size_t              length;        /* Length of token within source */
+  unsigned char       flags;         /* Word flags of token */
 };
 #define token_text(tok)   tok.val.value.text
 #define token_length(tok) tok.val.value.len
@@ -265,15 +355,39 @@ static inline void mrg_tokflags(struct parse_tokflags *flag,
 }
 static inline bool any_tokflags(struct parse_tokflags flag)
 {
-  union {
-    bool                  all;
-    struct parse_tokflags flg;
-  } chkflag = { .flg = flag };
-  return !!chkflag.all;
+  return flag.chkalias || flag.chkkwd || flag.chknl || flag.chkeofmark ||
+         flag.chkendtok;
 }
 
 struct parse_source;
 struct parse_source_cont;
+struct parse_intern;
+struct parse_alias;
+struct parse_aliases;
+struct parse_relex;
+struct parse_reparse;
+struct parse_outline;
+struct parse_arithbuf;
+struct parse_segbuf;
+struct parse_shadow;
+struct parse_stack;
+struct parse_recover;
+struct parse_bquote;
+struct parse_feed;
+struct parse_follow;
+
+/* Define the budget limiting what parsing may use, the limits of zero being
+ * held as the largest value so that each needs only a single comparison
+ */
+struct parse_budget {
+  struct parse_limits limits;         /* Limits placed on parsing */
+  uint64_t            bytes;          /* Bytes of input read */
+  uint64_t            nodes;          /* Nodes allocated */
+  size_t              membase;        /* Memory taken when the budget started */
+  uint64_t            start;          /* Elapsed time when the budget started */
+  uint64_t            cpustart;       /* CPU time when the budget started */
+  unsigned int        tick;           /* Checks left before reading the clocks */
+};
 
 struct parse_context {
   struct obstack             memstack;       /* Used for node allocation */
@@ -283,20 +397,79 @@ struct parse_context {
   struct parse_heredoc_hdr  *lst_heredoc;    /* Queue of here documents */
   struct parse_savheredoc   *sav_heredoc;    /* List of saved here documents */
   union  parse_node          cur_redir;      /* Current redirection */
+  union  parse_node          evnode;         /* Node standing for those not built */
+  union  parse_node          evredir;        /* Redirection standing for those not built */
   struct parse_heredoc       cur_heredoc;    /* Current here document */
-  struct parse_nodelist_hdr *backquote;      /* Current backquote commands */
+  struct parse_nodelist     *bqlist;         /* Command substitutions of current word */
+  struct parse_nodelist    **bqtail;         /* End of command substitution list */
+  struct parse_bquote       *bquote;         /* Backquoted commands being read */
+  struct parse_intern       *intern;         /* Table of interned strings */
+  struct parse_aliases      *aliases;        /* Table of aliases */
+  struct parse_arithbuf     *arithbuf;       /* Buffers for compiling arithmetic */
+  union  parse_node         *arith;          /* Arithmetic of current word */
+  union  parse_node        **arithtail;      /* End of arithmetic list */
+  struct parse_segbuf       *segbuf;         /* Segments of current word */
+  struct parse_shadow       *shadow;         /* Comparison with reference */
+  struct parse_stack        *pstack;         /* Frames of the parser */
+  struct parse_recover      *recover;        /* Diagnostics of errors recovered from */
+  const struct parse_events *events;         /* Events given in place of nodes */
+  struct parse_budget       *budget;         /* Limits on what parsing may use */
+  struct parse_feed         *feed;           /* Input given a line at a time */
+  struct parse_follow       *follow;         /* Files read by the dot command being followed */
+  size_t                     obsmemory;      /* Memory taken by the node and text obstacks */
+  unsigned int               maxdepth;       /* Limit on nesting of commands */
+  size_t                     defunoff;       /* Offset of last top-level function body */
+  unsigned int               defunline;      /* Line of last top-level function body */
+  size_t                     ncommand;       /* Number of top-level commands read */
+  size_t                     stepend;        /* Offset at which a step ends */
   struct parse_token         last_token;     /* Last token returned */
   struct parse_tokflags      chkflags;       /* Current parser flags */
   struct parse_synerror      synerror;       /* Syntax error status */
   enum   parse_interrcode    int_error;      /* Internal error status */
+  enum   parse_wordflags     wordflags;      /* Flags for current word */
   char                       cur_char;       /* Last character read */
   char                       lst_char[3];    /* Previous characters - extra for debugging information to be correct */
   bool                       tokpushback;    /* Set if token pushed back */
   bool                       quoteflag;      /* Set if in quote mode */
+  bool                       internwords;    /* Set to intern word text */
+  bool                       wordsegments;   /* Set to give words segments */
+  bool                       narynodes;      /* Set to build n-ary nodes */
+  bool                       checkonly;      /* Set when only checking syntax */
+  bool                       reference;      /* Set to use reference paths */
+  bool                       heredoceof;     /* Set if a here-document ended at end of input */
 };
 
 #define FAKEEOFMARK (const char *)1
 
+extern bool budget_exceeded(struct parse_context *);
+extern void budget_exceed(struct parse_context *, enum parse_interrcode);
+
+/* Return true if the parse has been stopped by a callback or a limit */
+static inline bool ctx_halted(struct parse_context *ctx)
+{
+  return ctx->int_error >= IE_STOPPED;
+}
+
+/* Return true if a limit of the budget of the context has been reached */
+static inline bool budget_check(struct parse_context *ctx)
+{
+  return ctx->budget && budget_exceeded(ctx);
+}
+
+/* Count the input read against the budget of the context */
+static inline void budget_read(struct parse_context *ctx, size_t len)
+{
+  if (ctx->budget && (ctx->budget->bytes += len) > ctx->budget->limits.bytes)
+    budget_exceed(ctx, IE_BYTELIMIT);
+}
+
+/* Count a node allocated against the budget of the context */
+static inline void budget_node(struct parse_context *ctx)
+{
+  if (ctx->budget && ++ctx->budget->nodes > ctx->budget->limits.nodes)
+    budget_exceed(ctx, IE_NODELIMIT);
+}
+
 #ifndef __CONCAT
 # define __CONCAT(a, b)  a ## b
 #endif
@@ -304,12 +477,14 @@ struct parse_context {
 #define NODEALLOC(su, type)                                                       \
 static inline union parse_node *__CONCAT(type, _alloc)(struct parse_context *ctx) \
 {                                                                                 \
+  budget_node(ctx);                                                               \
   return (union parse_node *)obstack_alloc(&ctx->memstack,                        \
                                sizeof(_SUNAME(su, type)));                        \
 }                                                                                 \
 static inline union parse_node *__CONCAT(type, _copy)(struct parse_context *ctx,  \
                                _SUNAME(su, type) *ptr)                            \
 {                                                                                 \
+  budget_node(ctx);                                                               \
   return (union parse_node *)obstack_copy(&ctx->memstack, ptr,                    \
                                sizeof(_SUNAME(su, type)));                        \
 }                                                                                 \
@@ -329,11 +504,18 @@ NODEALLOC(struct, narg)
 NODEALLOC(struct, ncase)
 NODEALLOC(struct, nclist)
 NODEALLOC(struct, ncmd)
+NODEALLOC(struct, narith)
+NODEALLOC(struct, nseq)
+NODEALLOC(struct, nandor)
+NODEALLOC(struct, nifchain)
+NODEALLOC(struct, npipeline)
 
 static inline struct parse_nodelist *nodelist_alloc(struct parse_context *ctx)
 {
-  struct parse_nodelist *node = obstack_alloc(&ctx->memstack,
-		  sizeof(struct parse_nodelist));
+  struct parse_nodelist *node;
+
+  budget_node(ctx);
+  node = obstack_alloc(&ctx->memstack, sizeof(struct parse_nodelist));
   node->next = NULL;
   node->node = NULL;
   return node;
@@ -353,6 +535,18 @@ static inline void nodelist_free(struct parse_context *ctx,
 /* Provide definitions of opaque structures */
 struct builtincmd;
 
+/* Calculate the FNV-1a hash of the given bytes */
+static inline uint32_t fnv_hash(const char *text, size_t len)
+{
+  uint32_t hash = 2166136261u;
+
+  while (len--) {
+    hash ^= (unsigned char)*text++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
 static inline bool is_name(char chr) {
   return chr == '_' || isalpha(chr);
 }
@@ -387,25 +581,149 @@ static inline void pop_heredoclist(struct parse_context *ctx)
 }
 
 /* Provide all the external symbols provided by the various sources */
-extern union parse_node *list_et(struct parse_context *);
 extern union parse_node *parse_next_command(struct parse_context *);
 extern enum parse_tokid readtoken(struct parse_context *);
+extern bool int_readtoken(struct parse_context *, struct parse_token *);
+extern bool tokenize_all(struct parse_context *, struct parse_token_stream *);
+extern void token_stream_free(struct parse_token_stream *);
+extern enum parse_tokid tokenize_next(struct parse_context *,
+    struct parse_token_stream *, unsigned char *);
+extern bool token_stream_splice(struct parse_token_stream *, size_t, size_t,
+    const struct parse_token_stream *);
+extern void parsefname(struct parse_context *, union parse_node *);
 extern bool endtoklist(enum parse_tokid);
 extern void parseheredoc(struct parse_context *);
+extern void clr_synerror(struct parse_context *);
 extern void ctx_synerror_expect(struct parse_context *, enum parse_tokid);
 extern void ctx_synerror(struct parse_context *, enum parse_synerrcode,
     enum parse_tokid, char *);
 extern bool ctx_init(struct parse_context **);
 extern void ctx_fini(struct parse_context **);
+extern bool ctx_inherit(struct parse_context *, struct parse_context *);
 extern union parse_node *ctx_next_command(struct parse_context *);
+extern union parse_node *ctx_step(struct parse_context *, size_t);
+extern bool parse_suspended(struct parse_context *);
 extern unsigned int source_currline(struct parse_context *);
+extern void source_setline(struct parse_context *, unsigned int);
+extern size_t source_size(struct parse_context *);
+extern bool source_sole(struct parse_context *);
+extern bool source_seek(struct parse_context *, size_t);
+extern size_t source_curroff(struct parse_context *);
+extern bool source_text(struct parse_context *, const char **, size_t *);
 extern const struct builtincmd *find_builtin(const char *);
+extern const struct builtincmd *find_builtin_len(const char *, size_t);
+extern enum parse_cmdid builtin_id(const struct builtincmd *);
+extern const char *builtin_idname(enum parse_cmdid);
+extern unsigned short builtin_flags(const struct builtincmd *);
 extern bool builtin_isspecial(const struct builtincmd *);
 extern char source_next_char(struct parse_context *);
+extern char source_next_char_eatbnl(struct parse_context *);
 extern void source_unget(struct parse_context *);
+extern void source_unget_char(struct parse_context *, char);
 extern int init_source(struct parse_context *);
 extern int fini_source(struct parse_context *);
 extern struct parse_source *push_source(struct parse_context *,
     enum parse_srctype, void const *);
 extern struct parse_source *pop_source(struct parse_context *);
+extern void source_drop(struct parse_context *);
+extern struct parse_source *push_alias(struct parse_context *, const char *,
+    struct parse_alias *);
 extern union parse_node *eof_node(void);
+extern union parse_node *pending_node(void);
+extern union parse_node *parse_subst(struct parse_context *, bool);
+extern void parse_stack_free(struct parse_context *);
+extern bool ctx_parse_all(struct parse_context *, struct parse_script **);
+extern bool ctx_skim(struct parse_context *, struct parse_diag *,
+    bool (*)(struct parse_context *, union parse_node *, void *), void *);
+extern bool checkpoint_take(struct parse_context *, struct parse_checkpoint *);
+extern bool checkpoint_resume(struct parse_context *,
+    const struct parse_checkpoint *);
+extern bool events_parse(struct parse_context *, const struct parse_events *,
+    struct parse_diag *);
+extern void event_begin(struct parse_context *, enum parse_nodetype,
+    unsigned int);
+extern void event_word(struct parse_context *, struct parse_token *,
+    unsigned int);
+extern void event_redir(struct parse_context *, union parse_node *,
+    struct parse_token *);
+extern void event_token(struct parse_context *, enum parse_tokid);
+extern void event_end(struct parse_context *, enum parse_nodetype);
+extern bool budget_set(struct parse_context *, const struct parse_limits *);
+extern void budget_start(struct parse_context *);
+extern void budget_abandon(struct parse_context *);
+extern void budget_free(struct parse_context *);
+extern void *budget_chunk_alloc(void *, size_t);
+extern void budget_chunk_free(void *, void *);
+extern bool feed_add(struct parse_context *, const char *, size_t);
+extern bool feed_more(struct parse_context *);
+extern void feed_clear(struct parse_context *);
+extern void feed_free(struct parse_context *);
+extern const char *intern_string(struct parse_context *, const char *, size_t);
+extern size_t intern_saved(struct parse_context *);
+extern void intern_free(struct parse_context *);
+extern bool alias_set(struct parse_context *, const char *, const char *);
+extern bool alias_clear(struct parse_context *, const char *);
+extern bool alias_expand(struct parse_context *, struct parse_token *);
+extern bool alias_next_token(struct parse_context *, struct parse_token *);
+extern void alias_release(struct parse_context *, struct parse_alias *);
+extern bool alias_active(struct parse_context *);
+extern bool alias_copy(struct parse_context *, struct parse_context *);
+extern void alias_free(struct parse_context *);
+extern void arith_compile(struct parse_context *, union parse_node *,
+    const char *, size_t);
+extern void arith_free(struct parse_context *);
+extern void seg_reset(struct parse_context *);
+extern struct parse_segment *seg_begin(struct parse_context *,
+    enum parse_segkind, size_t, bool);
+extern void seg_end(struct parse_context *, size_t);
+extern void seg_var(struct parse_context *, const char *, size_t, size_t);
+extern void seg_scan(struct parse_context *, const char *, size_t);
+extern struct parse_segment *seg_copy(struct parse_context *, size_t,
+    uint32_t *);
+extern void seg_free(struct parse_context *);
+extern bool shadow_set(struct parse_context *, unsigned int);
+extern void shadow_sample(struct parse_context *);
+extern void shadow_check(struct parse_context *, struct parse_token *);
+extern bool shadow_report(struct parse_context *, struct parse_shadow_report *);
+extern void shadow_free(struct parse_context *);
+extern bool recover_set(struct parse_context *, bool);
+extern bool recover_enabled(struct parse_context *);
+extern void recover_note(struct parse_context *, struct parse_diag *);
+extern void recover_close(struct parse_context *, char);
+extern void recover_syntax(struct parse_context *, struct parse_syntax *);
+extern void recover_heredoc(struct parse_context *);
+extern union parse_node *recover_error(struct parse_context *);
+extern const struct parse_diag *recover_diagnostics(struct parse_context *,
+    size_t *);
+extern void recover_free(struct parse_context *);
+extern bool parallel_parse(struct parse_context *, const char *, size_t,
+    unsigned int, struct parse_command_set *);
+extern void parallel_free(struct parse_command_set *);
+extern bool follow_parse(struct parse_context *, const char *, const char *,
+    unsigned int, struct parse_sourced_set *);
+extern void follow_command(struct parse_context *, union parse_node *);
+extern void follow_free(struct parse_sourced_set *);
+extern size_t word_unescape(const char *, size_t, char *);
+extern const char *word_literal(union parse_node *, char *, size_t, size_t *);
+extern bool relex_new(struct parse_relex **, const char *, size_t);
+extern bool relex_edit(struct parse_relex *, size_t, size_t, const char *,
+    size_t);
+extern const struct parse_token_stream *relex_tokens(struct parse_relex *);
+extern bool relex_complete(struct parse_relex *);
+extern size_t relex_lexed(struct parse_relex *);
+extern void relex_free(struct parse_relex **);
+extern bool reparse_new(struct parse_reparse **, struct parse_context *,
+    const char *, size_t);
+extern bool reparse_edit(struct parse_reparse *, size_t, size_t, const char *,
+    size_t);
+extern const struct parse_command_set *reparse_commands(struct parse_reparse *);
+extern size_t reparse_parsed(struct parse_reparse *);
+extern void reparse_free(struct parse_reparse **);
+extern bool outline_new(struct parse_outline **, struct parse_context *,
+    const char *, size_t);
+extern const struct parse_outline_entry *outline_entries(struct parse_outline *,
+    size_t *);
+extern const struct parse_diag *outline_error(struct parse_outline *);
+extern union parse_node *outline_materialise(struct parse_outline *,
+    const struct parse_outline_entry *, bool);
+extern void outline_free(struct parse_outline **);
@@ -62,6 +62,7 @@ STAILQ_INLINE void stailq_clear(void *que)
     struct _stailq *hdr = (struct _stailq *)que;
     if (hdr->first) {
       obstack_free(&hdr->memstack, NULL);
+      obstack_init(&hdr->memstack);
       hdr->first = NULL;
       hdr->last = &hdr->first;
     }
@@ -198,7 +199,7 @@ STAILQ_INLINE void *stailq_tail(void *que)
 {
   if (que) {
     struct _stailq *hdr = (struct _stailq *)que;
-    return *hdr->last;
+    return hdr->first ? (void *)hdr->last : NULL;
   } else {
     return NULL;
   }
@@ -0,0 +1,177 @@
+/*
+ * This header provides the structures that are shared by the parser and the
+ * public interface of the library.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Define the stream of tokens produced by tokenizing an entire source, each
+ * token is described by the same index into each of the arrays which are all
+ * allocated from a single block of memory.
+ */
+struct parse_token_stream {
+  size_t          count;          /* Number of tokens in the stream */
+  size_t          alloc;          /* Number of tokens allocated */
+  uint32_t       *start;          /* Offset of token within source */
+  uint32_t       *length;         /* Length of token within source */
+  uint8_t        *id;             /* Token identifier (parse_tokid) */
+  uint8_t        *flags;          /* Word flags (parse_wordflags) */
+  uint8_t        *redir;          /* Redirection node type for TREDIR */
+  uint8_t        *redirfd;        /* Redirected file descriptor for TREDIR */
+  void           *arena;          /* Memory holding the arrays */
+};
+
+/* Define a segment of the text of a word, either literal text or one of the
+ * expansions it contains. Expansions nested within another follow it, the
+ * literal parts are only given between the outermost expansions.
+ */
+struct parse_segment {
+  uint32_t        offset;         /* Offset of segment within the word */
+  uint32_t        length;         /* Length of segment including control characters */
+  uint8_t         kind;           /* Kind of segment (parse_segkind) */
+  uint8_t         subtype;        /* Substitution of a variable (parse_varsubs) */
+  uint16_t        nest;           /* Number of expansions it is nested within */
+  uint32_t        index;          /* Index of the command or arithmetic expansion */
+  const char     *name;           /* Interned name of a variable */
+};
+
+/* Define the results of comparing the tokenizer against its reference paths,
+ * the location and tokens being those of the first difference found
+ */
+struct parse_shadow_report {
+  size_t          compared;       /* Number of tokens compared */
+  size_t          diverged;       /* Number of tokens that differed */
+  size_t          offset;         /* Offset of first differing token in source */
+  size_t          textoff;        /* Offset of first difference within its text */
+  uint8_t         id;             /* Token read (parse_tokid) */
+  uint8_t         refid;          /* Token read by the reference (parse_tokid) */
+};
+
+/* Define a top-level command noted by the outline of a script, giving the
+ * part of the text holding it and, for a function definition, the name of
+ * the function and where its body starts. The body runs to the end of the
+ * command.
+ */
+struct parse_outline_entry {
+  size_t          offset;         /* Offset of the command within the text */
+  size_t          length;         /* Length of the text of the command */
+  const char     *name;           /* Name of the function defined or NULL */
+  size_t          bodyoff;        /* Offset of the body of the function */
+  unsigned int    line;           /* Line the command starts on */
+  unsigned int    bodyline;       /* Line the body of the function starts on */
+  uint8_t         kind;           /* Type of the top node of the command (parse_nodetype) */
+};
+
+/* Define the commands of a script that was parsed in parts, in the order
+ * they appear in the script. The nodes are held by the contexts that parsed
+ * the parts, the last of which holds the syntax error that stopped the parse.
+ */
+union parse_node;
+struct parse_context;
+struct parse_command_set {
+  size_t                  count;  /* Number of commands */
+  union parse_node      **cmd;    /* Commands in the order of the script */
+  size_t                  nctx;   /* Number of contexts */
+  struct parse_context  **ctx;    /* Contexts holding the commands */
+  struct parse_context   *error;  /* Context that stopped on an error or NULL */
+};
+
+/* Define a file read by the dot command that was followed and parsed, along
+ * with the identity of the file that it is kept once for. The nodes are held
+ * by the context that parsed the file, which holds any error that stopped it.
+ */
+struct parse_sourced {
+  const char             *path;   /* Path the file was found at */
+  uint64_t                dev;    /* Device holding the file */
+  uint64_t                ino;    /* Inode of the file */
+  int64_t                 mtime;  /* Time the file was modified in nanoseconds */
+  size_t                  count;  /* Number of commands */
+  union parse_node      **cmd;    /* Commands in the order of the file */
+  struct parse_context   *ctx;    /* Context holding the commands */
+  bool                    error;  /* Set if the file could not be parsed */
+};
+
+/* Define the files found by following the dot command from a script, the
+ * first being the script itself
+ */
+struct parse_sourced_set {
+  size_t                  count;  /* Number of files */
+  struct parse_sourced  **file;   /* Files in the order they were found */
+};
+
+/* Define a syntax error noted when recovering from errors, the error node
+ * left in place of the command giving the index of its diagnostic
+ */
+struct parse_diag {
+  size_t          offset;         /* Offset of the token found in the source */
+  unsigned int    line;           /* Line of the error, zero at end of source */
+  uint8_t         code;           /* Error found (parse_synerrcode) */
+  uint8_t         expect;         /* Token expected if any (parse_tokid) */
+  uint8_t         found;          /* Token found instead (parse_tokid) */
+};
+
+/* Define the state of the parse between two top-level commands, which can
+ * be stored and given to another context reading the same source so that it
+ * carries on from the same point. The fields have fixed sizes so that it can
+ * be written out as it is.
+ */
+#define PARSE_CHECKPOINT_VERSION 1
+struct parse_checkpoint {
+  uint64_t        offset;         /* Offset of the next character in the source */
+  uint64_t        index;          /* Number of top-level commands read before it */
+  uint32_t        line;           /* Line of the next character */
+  uint16_t        version;        /* Layout of the checkpoint */
+  uint8_t         chkflags;       /* Checks made on the next token */
+  uint8_t         pushback;       /* Token pushed back or INV_PARSER_TOKEN (parse_tokid) */
+};
+
+/* Define the limits placed on parsing a script, each being unlimited when it
+ * is zero. The input is counted as each block of it is read, a string being
+ * read as a single block, and the memory is that taken by the node and text
+ * obstacks of the context since the budget started. The budget starts again
+ * when the limits are set and when a source is pushed once the earlier ones
+ * have been read or abandoned.
+ */
+struct parse_limits {
+  uint64_t        time;           /* Microseconds of elapsed time */
+  uint64_t        cputime;        /* Microseconds of CPU time of the thread */
+  uint64_t        bytes;          /* Bytes of input read */
+  uint64_t        nodes;          /* Nodes allocated */
+  uint64_t        memory;         /* Bytes of memory taken for nodes and text */
+};
+
+/* Define the callbacks given the structure of a script as it is parsed in
+ * place of its nodes, any of which may be NULL. The start of each node is
+ * given with its type (parse_nodetype) and line, followed by its words,
+ * redirections, the tokens (parse_tokid) that separate its parts and the
+ * nodes within it, and then its end. Sequences, and-or lists and pipelines
+ * are given even when they hold a single command, and a brace group is given
+ * as NREDIR. The commands of a substitution are given as they are parsed,
+ * before the word holding them, and the body of a here document is given as
+ * a node of its own once it is read. Returning false from any of the
+ * callbacks stops the parse.
+ */
+struct parse_events {
+  void           *arg;            /* Argument given to each of the callbacks */
+  bool          (*begin)(void *, int, unsigned int);
+  bool          (*word)(void *, const char *, size_t, unsigned int);
+  bool          (*redir)(void *, int, int, const char *, size_t);
+  bool          (*token)(void *, int);
+  bool          (*end)(void *, int);
+};
+
+/* Define the commands of a whole script parsed with a single context, the
+ * array and the nodes being held by the context in chunks of its node obstack
+ * that are made larger in proportion to the length of the script.
+ */
+struct parse_script {
+  size_t                  count;  /* Number of commands */
+  union parse_node      **cmd;    /* Commands in the order of the script */
+  size_t                  length; /* Length of the script if it was known */
+  size_t                  memory; /* Bytes the context took for the script */
+  bool                    error;  /* Set if a syntax error stopped the parse */
+};
@@ -0,0 +1,128 @@
+/*
+ * This source provides the interning of strings, so that the same text seen
+ * many times within a script is only stored once per context.
+ */
+
+#include <obstack.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+/* Define an entry within the open addressing table */
+struct intern_entry {
+  const char *text;                   /* Interned string or NULL if unused */
+  uint32_t    hash;                   /* Hash of the string */
+  uint32_t    len;                    /* Length of the string */
+};
+
+struct parse_intern {
+  struct obstack       strstack;      /* Storage for the interned strings */
+  struct intern_entry *table;         /* Open addressing table */
+  size_t               size;          /* Number of slots, a power of two */
+  size_t               count;         /* Number of slots in use */
+  size_t               saved;         /* Bytes not stored due to interning */
+};
+
+#define INTERN_INITSIZE 256
+
+/* Double the size of the table and reinsert the existing entries */
+static bool intern_grow(struct parse_intern *tab)
+{
+  size_t newsize = tab->size * 2;
+  struct intern_entry *newtab = calloc(newsize, sizeof(struct intern_entry));
+  size_t idx;
+
+  if (!newtab) return false;
+  for (idx = 0; idx < tab->size; idx++) {
+    struct intern_entry *ent = &tab->table[idx];
+    if (ent->text) {
+      size_t slot = ent->hash & (newsize - 1);
+      while (newtab[slot].text)
+        slot = (slot + 1) & (newsize - 1);
+      newtab[slot] = *ent;
+    }
+  }
+  free(tab->table);
+  tab->table = newtab;
+  tab->size = newsize;
+  return true;
+}
+
+/* Create the intern table for the context if it doesn't already exist */
+static struct parse_intern *intern_table(struct parse_context *ctx)
+{
+  struct parse_intern *tab = ctx->intern;
+
+  if (!tab) {
+    if (!(tab = malloc(sizeof(struct parse_intern))))
+      return NULL;
+    if (!(tab->table = calloc(INTERN_INITSIZE, sizeof(struct intern_entry)))) {
+      free(tab);
+      return NULL;
+    }
+    obstack_init(&tab->strstack);
+    tab->size = INTERN_INITSIZE;
+    tab->count = 0;
+    tab->saved = 0;
+    ctx->intern = tab;
+  }
+  return tab;
+}
+
+/* Return the shared copy of the given text, which must not be modified */
+const char *intern_string(struct parse_context *ctx,
+                          const char           *text,
+                          size_t                len)
+{
+  struct parse_intern *tab;
+  struct intern_entry *ent;
+  uint32_t hash;
+  size_t slot;
+
+  if (!(tab = intern_table(ctx)))
+    return NULL;
+  hash = fnv_hash(text, len);
+  for (slot = hash & (tab->size - 1);
+       (ent = &tab->table[slot])->text;
+       slot = (slot + 1) & (tab->size - 1)) {
+    if (ent->hash == hash && ent->len == len && !memcmp(ent->text, text, len)) {
+      tab->saved += len + 1;
+      return ent->text;
+    }
+  }
+
+  /* Not seen before so add it, keeping the table no more than 3/4 full */
+  if ((tab->count + 1) * 4 > tab->size * 3) {
+    if (!intern_grow(tab))
+      return NULL;
+    for (slot = hash & (tab->size - 1);
+         tab->table[slot].text;
+         slot = (slot + 1) & (tab->size - 1));
+    ent = &tab->table[slot];
+  }
+  ent->text = obstack_copy0(&tab->strstack, text, len);
+  ent->hash = hash;
+  ent->len = len;
+  tab->count++;
+  return ent->text;
+}
+
+/* Return the number of bytes that interning has avoided storing */
+size_t intern_saved(struct parse_context *ctx)
+{
+  return ctx->intern ? ctx->intern->saved : 0;
+}
+
+/* Release the intern table of the context */
+void intern_free(struct parse_context *ctx)
+{
+  struct parse_intern *tab = ctx->intern;
+
+  if (tab) {
+    ctx->intern = NULL;
+    obstack_free(&tab->strstack, NULL);
+    free(tab->table);
+    free(tab);
+  }
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+#
+# Make the slots of the perfect hash of the names of builtin.c, along with the
+# multipliers of the hash, replacing those between the markers of the source.
+# The smallest table is used for which some multipliers give each name a slot
+# of its own, so the source given is changed only when the names are.
+#
+# Usage: mkbuiltin.py [builtin.c]
+
+import os
+import re
+import sys
+
+BEGIN = '/* The following is made by mkbuiltin.py from the names above */\n'
+END = '/* End of the part made by mkbuiltin.py */\n'
+
+
+def hash_name(name, mul0, mul1, slots):
+    name = name.lower()
+    return (len(name) + ord(name[0]) * mul0 + ord(name[len(name) > 1]) * mul1 +
+            ord(name[-1])) % slots
+
+
+def find_hash(names):
+    for slots in (64, 128, 256, 512):
+        for mul0 in range(1, 64):
+            for mul1 in range(1, 64):
+                used = {hash_name(name, mul0, mul1, slots) for name in names}
+                if len(used) == len(names):
+                    return slots, mul0, mul1
+    sys.exit('mkbuiltin.py: no perfect hash found for the names')
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else \
+        os.path.join(os.path.dirname(os.path.abspath(__file__)), 'builtin.c')
+    with open(path) as f:
+        text = f.read()
+    table = re.search(r'builtin\[\] = \{\n(.*?)\n\};', text, re.S).group(1)
+    names = re.findall(r'\{ "([^"]+)",', table)
+    slots, mul0, mul1 = find_hash(names)
+
+    slot = [0] * slots
+    for idx, name in enumerate(names):
+        slot[hash_name(name, mul0, mul1, slots)] = idx + 1
+    lines = [BEGIN,
+             '#define BLTIN_SLOTS %d\n' % slots,
+             '#define BLTIN_MUL0  %d\n' % mul0,
+             '#define BLTIN_MUL1  %d\n' % mul1,
+             '\n',
+             '/* Provide the identifier of the builtin command hashed to each slot */\n',
+             'static const unsigned char bltin_slot[BLTIN_SLOTS] = {\n']
+    for row in range(0, slots, 16):
+        lines.append('  ' + ' '.join('%2d,' % id for id in slot[row:row + 16]) + '\n')
+    lines += ['};\n', END]
+
+    start = text.index(BEGIN)
+    end = text.index(END) + len(END)
+    text = text[:start] + ''.join(lines) + text[end:]
+    with open(path, 'w') as f:
+        f.write(text)
+
+
+if __name__ == '__main__':
+    main()
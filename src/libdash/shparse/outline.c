@@ -0,0 +1,246 @@
+/*
+ * This source provides the outline of a script held in memory. The script is
+ * first skimmed by checking its syntax, noting where each top-level command
+ * lies in the text and what kind of command it is, along with the name and
+ * body of each function defined. Any of the commands, or the body of any of
+ * the functions, can then be parsed on its own when it is needed.
+ */
+
+#include <obstack.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+struct parse_outline {
+  struct parse_context        *tmpl;    /* Context giving the settings to use */
+  const char                  *text;    /* Text of the script */
+  size_t                       len;     /* Length of the script */
+  struct parse_outline_entry  *entry;   /* Commands of the script */
+  size_t                       count;   /* Number of commands */
+  size_t                       maxent;  /* Number of commands allocated */
+  size_t                       start;   /* Offset the next command starts from */
+  unsigned int                 line;    /* Line the next command starts from */
+  bool                         joined;  /* Set if an alias joins the commands */
+  bool                         error;   /* Set if a syntax error stopped it */
+  struct parse_diag            diag;    /* Syntax error that stopped it */
+  struct parse_context       **ctx;     /* Contexts holding parsed commands */
+  size_t                       nctx;    /* Number of contexts */
+  struct obstack               names;   /* Storage for the function names */
+};
+
+/* Skip the blanks, empty lines and comments that come before a command */
+static size_t outline_skip(struct parse_outline *ol, size_t off)
+{
+  const char *text = ol->text;
+
+  while (off < ol->len) {
+    switch (text[off]) {
+    case '\n':
+      ol->line++;
+      /* FALLTHROUGH */
+    case ' ':
+    case '\t':
+      off++;
+      break;
+
+    case '\\':
+      if (off + 1 >= ol->len || text[off + 1] != '\n')
+        return off;
+      ol->line++;
+      off += 2;
+      break;
+
+    case '#':
+      while (off < ol->len && text[off] != '\n')
+        off++;
+      break;
+
+    default:
+      return off;
+    }
+  }
+  return off;
+}
+
+/* Note a top-level command that has been skimmed */
+static bool outline_add(struct parse_context *ctx,
+                        union parse_node     *n,
+                        void                 *arg)
+{
+  struct parse_outline *ol = arg;
+  struct parse_outline_entry *ent;
+  size_t end;
+
+  if (ol->joined) {
+    /* The command started while the text of an alias was being read, so it
+     * belongs with the commands before it
+     */
+    ent = &ol->entry[ol->count - 1];
+    ent->kind = NSEQ;
+    ent->name = NULL;
+  } else {
+    if (ol->count == ol->maxent) {
+      size_t newmax = ol->maxent ? ol->maxent * 2 : 256;
+      struct parse_outline_entry *newp = realloc(ol->entry,
+          newmax * sizeof(struct parse_outline_entry));
+      if (!newp) {
+        ctx->int_error = IE_NOMEMORY;
+        return false;
+      }
+      ol->entry = newp;
+      ol->maxent = newmax;
+    }
+    ent = &ol->entry[ol->count++];
+    ent->offset = outline_skip(ol, ol->start);
+    ent->line = ol->line;
+    ent->kind = n->type;
+    ent->name = NULL;
+    ent->bodyoff = 0;
+    ent->bodyline = 0;
+    if (n->type == NDEFUN) {
+      ent->name = obstack_copy0(&ol->names, n->ndefun.text,
+          strlen(n->ndefun.text));
+      ent->bodyoff = ctx->defunoff;
+      ent->bodyline = ctx->defunline;
+    }
+  }
+
+  /* The end is only known within the text when an alias is not being read */
+  ol->joined = alias_active(ctx);
+  if (!ol->joined) {
+    end = source_curroff(ctx);
+    ent->length = end - ent->offset;
+    ol->start = end;
+    ol->line = source_currline(ctx);
+  }
+  return true;
+}
+
+/* Skim the script, noting each of its top-level commands */
+bool outline_new(struct parse_outline **olp,
+                 struct parse_context  *tmpl,
+                 const char            *text,
+                 size_t                 len)
+{
+  struct parse_outline *ol;
+  struct parse_context *ctx = NULL;
+  struct parse_memory mem = { text, len };
+  bool ok = false;
+
+  if (!(ol = calloc(1, sizeof(struct parse_outline))))
+    return false;
+  obstack_init(&ol->names);
+  ol->tmpl = tmpl;
+  ol->text = text;
+  ol->len = len;
+  ol->line = 1;
+  if (!ctx_init(&ctx))
+    goto done;
+  if (!ctx_inherit(ctx, tmpl) || !push_source(ctx, SRC_MEMORY, &mem))
+    goto done;
+  if (!ctx_skim(ctx, &ol->diag, outline_add, ol)) {
+    if (ctx->int_error == IE_NOMEMORY)
+      goto done;
+    ol->error = ctx->synerror.code != SE_NONE;
+  }
+
+  /* A command joined by an alias runs to where the skim stopped */
+  if (ol->joined)
+    ol->entry[ol->count - 1].length = source_curroff(ctx) -
+        ol->entry[ol->count - 1].offset;
+  ok = true;
+
+done:
+  ctx_fini(&ctx);
+  if (!ok) {
+    outline_free(&ol);
+    return false;
+  }
+  *olp = ol;
+  return true;
+}
+
+/* Return the commands noted, with their number stored in the given location */
+const struct parse_outline_entry *outline_entries(struct parse_outline *ol,
+                                                  size_t               *count)
+{
+  *count = ol->count;
+  return ol->entry;
+}
+
+/* Return the syntax error that stopped the skim, or NULL if there was none */
+const struct parse_diag *outline_error(struct parse_outline *ol)
+{
+  return ol->error ? &ol->diag : NULL;
+}
+
+/* Parse one of the commands noted, or the body of the function it defines,
+ * returning its node which is held until the outline is released. Commands
+ * joined by an alias are returned as a sequence.
+ */
+union parse_node *outline_materialise(struct parse_outline             *ol,
+                                      const struct parse_outline_entry *ent,
+                                      bool                              body)
+{
+  struct parse_context *ctx = NULL, **newctx;
+  struct parse_memory mem;
+  union parse_node *n, *seq = NULL, **child = NULL, **newp;
+  size_t count = 0, maxchild = 0;
+
+  if (ent < ol->entry || ent >= ol->entry + ol->count ||
+      (body && ent->kind != NDEFUN))
+    return NULL;
+  mem.text = ol->text + (body ? ent->bodyoff : ent->offset);
+  mem.len = ent->offset + ent->length - (body ? ent->bodyoff : ent->offset);
+  if (!(newctx = realloc(ol->ctx,
+                         (ol->nctx + 1) * sizeof(struct parse_context *))))
+    return NULL;
+  ol->ctx = newctx;
+  if (!ctx_init(&ctx))
+    return NULL;
+  ol->ctx[ol->nctx++] = ctx;
+  if (!ctx_inherit(ctx, ol->tmpl) || !push_source(ctx, SRC_MEMORY, &mem))
+    return NULL;
+  source_setline(ctx, body ? ent->bodyline : ent->line);
+
+  while ((n = ctx_next_command(ctx)) && n->type != NEOF) {
+    if (count == maxchild) {
+      maxchild = maxchild ? maxchild * 2 : 4;
+      if (!(newp = realloc(child, maxchild * sizeof(union parse_node *)))) {
+        ctx->int_error = IE_NOMEMORY;
+        n = NULL;
+        break;
+      }
+      child = newp;
+    }
+    child[count++] = n;
+  }
+  if (n && count == 1) {
+    seq = child[0];
+  } else if (n && count) {
+    seq = nseq_alloc(ctx);
+    seq->type = NSEQ;
+    seq->nseq.count = count;
+    seq->nseq.child = obstack_copy(&ctx->memstack, child,
+        count * sizeof(union parse_node *));
+  }
+  free(child);
+  return seq;
+}
+
+/* Release the outline and the commands parsed from it */
+void outline_free(struct parse_outline **olp)
+{
+  struct parse_outline *ol = *olp;
+  size_t idx;
+
+  if (ol) {
+    *olp = NULL;
+    for (idx = 0; idx < ol->nctx; idx++)
+      ctx_fini(&ol->ctx[idx]);
+    free(ol->ctx);
+    free(ol->entry);
+    obstack_free(&ol->names, NULL);
+    free(ol);
+  }
+}
@@ -0,0 +1,395 @@
+/*
+ * This source provides the parsing of a script held in memory by several
+ * threads. The script is split at newlines that are likely to lie between
+ * top-level commands, each part is parsed by a context of its own and the
+ * commands are gathered back into the order of the script. When a part is
+ * found to end within a command, it was split at the wrong place and the rest
+ * of it is parsed again until the end of a command agrees with the end of one
+ * found in the part that follows, as from there the two parses must be the
+ * same. The commands found are always those that parsing the whole script with
+ * a single context would find.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "parser.h"
+
+#define PAR_MINPART   (64 * 1024)     /* Smallest part worth a context */
+#define PAR_PARTS     4               /* Parts given to each thread */
+#define PAR_MAXTHREAD 256             /* Most threads that will be used */
+
+/* Define a part of the script along with the commands parsed from it */
+struct par_part {
+  size_t                 start;       /* Offset of the part in the script */
+  size_t                 len;         /* Length of the part */
+  size_t                 nlines;      /* Number of newlines in the part */
+  unsigned int           lineno;      /* Line the part starts on */
+  struct parse_context  *ctx;         /* Context that parsed the part */
+  union parse_node     **cmd;         /* Commands found in the part */
+  size_t                *end;         /* Offset just beyond each command */
+  size_t                 ncmd;        /* Number of commands found */
+  size_t                 maxcmd;      /* Number of commands allocated */
+  size_t                 good;        /* Offset beyond the last command found */
+  unsigned int           goodline;    /* Line beyond the last command found */
+  bool                   ateof;       /* Set if its end was within a command */
+};
+
+#define PAR_NOEND ((size_t)-1)        /* Command whose end can't be agreed */
+
+/* Define the work shared by the threads */
+struct par_work {
+  struct parse_context  *tmpl;        /* Context giving the settings to use */
+  const char            *text;        /* Text of the script */
+  size_t                 len;         /* Length of the script */
+  struct par_part       *part;        /* Parts of the script */
+  size_t                 npart;       /* Number of parts */
+  size_t                 next;        /* Next part to be handled */
+  pthread_mutex_t        lock;        /* Lock for the next part */
+  void                 (*func)(struct par_work *, struct par_part *);
+};
+
+/* Return whether the line starting at the given text begins with a word that
+ * can only continue a command, such as a keyword that closes a compound one
+ */
+static bool par_continues(const char *text, const char *end)
+{
+  static const char *const words[] = {
+    "then", "else", "elif", "fi", "do", "done", "esac", "in", NULL
+  };
+  const char *const *wp;
+
+  for (wp = words; *wp; wp++) {
+    size_t len = strlen(*wp);
+
+    if ((size_t)(end - text) >= len && !memcmp(text, *wp, len) &&
+        (text + len == end || strchr(" \t\n;&|)", text[len])))
+      return true;
+  }
+  return false;
+}
+
+/* Find the first newline at or after the given offset that looks to be
+ * between two top-level commands, returning the offset just beyond it or
+ * zero if there is none before the limit. Only the lines either side are
+ * looked at, as any wrong choice is found when the parts are parsed.
+ */
+static size_t par_split(const char *text, size_t len, size_t from, size_t limit)
+{
+  const char *end = text + len;
+  const char *nl = text + from;
+
+  while ((nl = memchr(nl, '\n', text + limit - nl))) {
+    const char *prev = nl, *next = nl + 1;
+    size_t nback = 0;
+
+    /* The previous line must not be continued by a backslash or operator */
+    while (prev > text && prev[-1] == '\\') {
+      prev--;
+      nback++;
+    }
+    prev = nl;
+    while (prev > text && (prev[-1] == ' ' || prev[-1] == '\t'))
+      prev--;
+
+    /* The next line must start a command in the first column */
+    if (!(nback & 1) && next < end &&
+        (prev == text || (prev[-1] != '|' && prev[-1] != '&')) &&
+        !strchr(" \t\n;&|)}", *next) && !par_continues(next, end))
+      return next - text;
+    nl++;
+  }
+  return 0;
+}
+
+/* Count the newlines within a part */
+static void par_count(struct par_work *work, struct par_part *part)
+{
+  const char *ptr = work->text + part->start;
+  const char *end = ptr + part->len;
+
+  part->nlines = 0;
+  while ((ptr = memchr(ptr, '\n', end - ptr))) {
+    part->nlines++;
+    ptr++;
+  }
+}
+
+/* Parse the commands of a part with a context of its own, stopping at the
+ * end of a command that agrees with the end of one found in the given part,
+ * returning its index or the number of commands if none agreed
+ */
+static size_t par_parse(struct par_work *work,
+                        struct par_part *part,
+                        struct par_part *sync)
+{
+  struct parse_context *ctx = NULL;
+  struct parse_memory mem;
+  union parse_node *n;
+  size_t synced = 0;
+
+  part->ncmd = 0;
+  part->good = part->start;
+  part->goodline = part->lineno;
+  part->ateof = false;
+  if (!ctx_init(&ctx))
+    return 0;
+  part->ctx = ctx;
+  if (!ctx_inherit(ctx, work->tmpl))
+    return 0;
+  mem.text = work->text + part->start;
+  mem.len = part->len;
+  if (!push_source(ctx, SRC_MEMORY, &mem)) {
+    ctx->int_error = IE_NOSOURCE;
+    return 0;
+  }
+  source_setline(ctx, part->lineno);
+
+  while ((n = ctx_next_command(ctx)) && n->type != NEOF) {
+    size_t end = PAR_NOEND;
+
+    /* A here-document ended by the end of any part but the last may continue
+     * in the next part, so the command must be parsed again with it
+     */
+    if (ctx->heredoceof && part->start + part->len < work->len) {
+      part->ateof = true;
+      break;
+    }
+    if (part->ncmd == part->maxcmd) {
+      size_t newmax = part->maxcmd ? part->maxcmd * 2 : 256;
+      union parse_node **newcmd = realloc(part->cmd,
+          newmax * sizeof(union parse_node *));
+      size_t *newend = newcmd ? realloc(part->end, newmax * sizeof(size_t))
+                              : NULL;
+      if (newcmd)
+        part->cmd = newcmd;
+      if (!newend) {
+        ctx->int_error = IE_NOMEMORY;
+        return 0;
+      }
+      part->end = newend;
+      part->maxcmd = newmax;
+    }
+
+    /* The end of a command is only known within the script when the text of
+     * an alias is not being read
+     */
+    if (!alias_active(ctx)) {
+      end = part->good = part->start + source_curroff(ctx);
+      part->goodline = source_currline(ctx);
+    }
+    part->end[part->ncmd] = end;
+    part->cmd[part->ncmd++] = n;
+
+    if (sync && end != PAR_NOEND) {
+      while (synced < sync->ncmd && sync->end[synced] < end)
+        synced++;
+      if (synced < sync->ncmd && sync->end[synced] == end) {
+        part->len = end - part->start;
+        return synced;
+      }
+    }
+  }
+  if (!n && ctx->synerror.code != SE_NONE)
+    part->ateof = source_curroff(ctx) >= part->len;
+  return sync ? sync->ncmd : 0;
+}
+
+/* Parse a part on behalf of one of the threads */
+static void par_parse_part(struct par_work *work, struct par_part *part)
+{
+  par_parse(work, part, NULL);
+}
+
+/* Handle the parts of the work until none are left */
+static void *par_worker(void *arg)
+{
+  struct par_work *work = arg;
+
+  while (true) {
+    size_t idx;
+
+    pthread_mutex_lock(&work->lock);
+    idx = work->next++;
+    pthread_mutex_unlock(&work->lock);
+    if (idx >= work->npart)
+      break;
+    work->func(work, &work->part[idx]);
+  }
+  return NULL;
+}
+
+/* Apply the given function to every part using the given number of threads,
+ * the calling thread being one of them
+ */
+static void par_run(struct par_work  *work,
+                    unsigned int      nthreads,
+                    void            (*func)(struct par_work *, struct par_part *))
+{
+  pthread_t tid[PAR_MAXTHREAD];
+  unsigned int idx, nstarted = 0;
+
+  work->func = func;
+  work->next = 0;
+  for (idx = 1; idx < nthreads; idx++)
+    if (!pthread_create(&tid[nstarted], NULL, par_worker, work))
+      nstarted++;
+  par_worker(work);
+  for (idx = 0; idx < nstarted; idx++)
+    pthread_join(tid[idx], NULL);
+}
+
+/* Release a part and the context that parsed it */
+static void par_release(struct par_part *part)
+{
+  ctx_fini(&part->ctx);
+  free(part->cmd);
+  free(part->end);
+  part->cmd = NULL;
+  part->end = NULL;
+  part->ncmd = part->maxcmd = 0;
+}
+
+/* Release the commands of a script parsed in parts */
+void parallel_free(struct parse_command_set *set)
+{
+  size_t idx;
+
+  for (idx = 0; idx < set->nctx; idx++)
+    ctx_fini(&set->ctx[idx]);
+  free(set->ctx);
+  free(set->cmd);
+  memset(set, 0, sizeof(struct parse_command_set));
+}
+
+/* Parse the given script using up to the given number of threads, or one for
+ * each processor if it is zero, with the settings and aliases of the given
+ * context if there is one. A syntax error stops the parse, the commands
+ * before it being returned with the context holding the error.
+ */
+bool parallel_parse(struct parse_context     *tmpl,
+                    const char               *text,
+                    size_t                    len,
+                    unsigned int              nthreads,
+                    struct parse_command_set *set)
+{
+  struct par_work work;
+  size_t idx, npart, count, lineno;
+  bool result = true;
+
+  memset(set, 0, sizeof(struct parse_command_set));
+  if (!nthreads) {
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = nproc > 0 ? nproc : 1;
+  }
+  if (nthreads > PAR_MAXTHREAD)
+    nthreads = PAR_MAXTHREAD;
+
+  /* Split the script into parts of about the same size */
+  npart = len / PAR_MINPART;
+  if (npart > (size_t)nthreads * PAR_PARTS)
+    npart = (size_t)nthreads * PAR_PARTS;
+  if (nthreads == 1 || !npart)
+    npart = 1;
+  memset(&work, 0, sizeof(struct par_work));
+  work.tmpl = tmpl;
+  work.text = text;
+  work.len = len;
+  /* Each part split at the wrong place can add another when it is fixed */
+  if (!(work.part = calloc(npart * 2, sizeof(struct par_part))))
+    return false;
+  for (idx = 1, count = 1; idx < npart; idx++) {
+    size_t from = work.part[count - 1].start + PAR_MINPART;
+    size_t limit = len * (idx + 1) / npart, off;
+
+    if (from < len * idx / npart)
+      from = len * idx / npart;
+    if (from < limit && (off = par_split(text, len, from, limit)))
+      work.part[count++].start = off;
+  }
+  npart = count;
+  for (idx = 0; idx < npart; idx++)
+    work.part[idx].len = (idx + 1 < npart ? work.part[idx + 1].start : len) -
+        work.part[idx].start;
+  work.npart = npart;
+  pthread_mutex_init(&work.lock, NULL);
+
+  /* Find the line each part starts on and then parse them */
+  if (npart > 1)
+    par_run(&work, nthreads, par_count);
+  for (idx = 0, lineno = 1; idx < npart; idx++) {
+    work.part[idx].lineno = lineno;
+    lineno += work.part[idx].nlines;
+  }
+  par_run(&work, nthreads, par_parse_part);
+
+  /* A part that ends within a command was split at the wrong place, so the
+   * rest of it is parsed again until a command ends where one found in the
+   * next part does, the commands of the next part before it being dropped
+   */
+  for (idx = 0; idx < npart; idx++) {
+    struct par_part *part = &work.part[idx];
+
+    if (!part->ctx || part->ctx->int_error == IE_NOMEMORY) {
+      result = false;
+      npart = idx + 1;
+      break;
+    }
+    if (part->ateof && idx + 1 < npart) {
+      struct par_part *next = &work.part[idx + 1];
+      struct par_part fix;
+      size_t synced, end = next->start + next->len;
+
+      memset(&fix, 0, sizeof(struct par_part));
+      fix.start = part->good;
+      fix.len = end - fix.start;
+      fix.lineno = part->goodline;
+      synced = par_parse(&work, &fix, next);
+      if (synced < next->ncmd) {
+        synced++;
+        next->ncmd -= synced;
+        memmove(next->cmd, next->cmd + synced,
+            next->ncmd * sizeof(union parse_node *));
+        memmove(next->end, next->end + synced, next->ncmd * sizeof(size_t));
+        next->start = fix.start + fix.len;
+        next->len = end - next->start;
+        memmove(next + 1, next, (npart - idx - 1) * sizeof(struct par_part));
+        npart++;
+      } else {
+        par_release(next);
+      }
+      *next = fix;
+      continue;
+    }
+    if (part->ctx->synerror.code != SE_NONE) {
+      set->error = part->ctx;
+      npart = idx + 1;
+      break;
+    }
+  }
+
+  /* Gather the commands in the order of the script */
+  for (idx = 0, count = 0; idx < npart; idx++)
+    count += work.part[idx].ncmd;
+  if (result &&
+      (!(set->cmd = malloc((count ? count : 1) * sizeof(union parse_node *))) ||
+       !(set->ctx = malloc(npart * sizeof(struct parse_context *)))))
+    result = false;
+  for (idx = 0; idx < npart && result; idx++) {
+    memcpy(set->cmd + set->count, work.part[idx].cmd,
+        work.part[idx].ncmd * sizeof(union parse_node *));
+    set->count += work.part[idx].ncmd;
+    set->ctx[set->nctx++] = work.part[idx].ctx;
+    work.part[idx].ctx = NULL;
+  }
+  for (idx = 0; idx < work.npart * 2; idx++)
+    par_release(&work.part[idx]);
+  pthread_mutex_destroy(&work.lock);
+  free(work.part);
+  if (!result) {
+    set->error = NULL;
+    parallel_free(set);
+  }
+  return result;
+}
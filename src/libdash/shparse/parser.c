@@ -5,9 +5,23 @@
  * suitable for conversion into an AST.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "include/parser.h"
 #include "include/queue.h"
 
+/* Define the size of the blocks used when parsing a whole script, the nodes of
+ * a script normally take about this many times its length
+ */
+#define PARSE_ALL_RATIO    16
+#define PARSE_ALL_MAXBLOCK (64 * 1024 * 1024)
+
+/* Most command substitutions that may be nested within each other whatever
+ * the limit on nesting, as each is parsed by a call made for the one it is
+ * within and so takes space on the stack of the calling thread
+ */
+#define PARSE_MAXSUBST     256
+
 static inline bool goodname(const char *word)
 {
   const char *p = word;
@@ -24,567 +38,1334 @@ static inline bool isassignment(const char *word)
   return p != word && *p == '=';
 }
 
-/* Provide forward definitions of the parser functions */
-static union parse_node *list(struct parse_context *ctx);
-static union parse_node *andor(struct parse_context *ctx);
-static union parse_node *pipeline(struct parse_context *ctx);
-static union parse_node *command(struct parse_context *ctx);
-static union parse_node *simplecmd(struct parse_context *ctx);
-
-static inline union parse_node *list_nl(struct parse_context *ctx)
-{
-  ctx->chkflags.chknl = true;
-  ctx->chkflags.chkendtok = false;
-  return list(ctx);
-}
-union parse_node *list_et(struct parse_context *ctx)
-{
-  ctx->chkflags.chknl = true;
-  ctx->chkflags.chkendtok = true;
-  return list(ctx);
-}
-
 /* Provide a unique node that represents the end of input */
 static union parse_node _eof_node = { .type = NEOF };
 union parse_node *eof_node(void) {
   return &_eof_node;
 }
 
-/* Main entry point for the parser. Read and parse a single command, returns
- * NEOF on end of file, unlike the original parser it will skip empty lines
- */
-union parse_node *ctx_next_command(struct parse_context *ctx)
-{
-  union parse_node *nxt_node;
-  
-  if (!ctx) return NULL;
-  ctx->tokpushback = false;
-  stailq_clear(ctx->lst_heredoc);
-  do {
-    ctx->chkflags.chknl = false;
-    ctx->chkflags.chkendtok = false;
-  } while (!(nxt_node = list(ctx)) && ctx->int_error == IE_NONE);
-  return nxt_node;
+/* Provide a unique node that represents a command still being parsed */
+static union parse_node _pending_node = { .type = INV_PARSER_NODE };
+union parse_node *pending_node(void) {
+  return &_pending_node;
 }
 
-static union parse_node *list(struct parse_context *ctx)
+/* Return the text of the last token, the text is shared with other words
+ * when interning is enabled so it must not be modified
+ */
+static inline char *tok_strdup(struct parse_context *ctx)
 {
-  union parse_node *n1 = NULL, *n2, *n3;
-  enum parse_tokid tok;
-
-  while (true) {
-    set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_keep, tf_keep);
-    tok = readtoken(ctx);
-    switch (tok) {
-    case TNL:
-      parseheredoc(ctx);
-      return n1;
-
-    case TEOF:
-      if (!n1 && !ctx->chkflags.chknl)
-          n1 = eof_node();
-      parseheredoc(ctx);
-      ctx->tokpushback = true;
-      ctx->last_token.id = TEOF;
-      return n1;
-
-    default:
-      break;
-    }
-    ctx->tokpushback = true;
-    if (ctx->chkflags.chkendtok && endtoklist(tok))
-      return n1;
-    else
-      ctx->chkflags.chkendtok = ctx->chkflags.chknl;
-
-    n2 = andor(ctx);
-    tok = readtoken(ctx);
-    if (tok == TBACKGND) {
-      if (n2->type == NPIPE) {
-        n2->npipe.backgnd = true;
-      } else {
-        if (n2->type != NREDIR) {
-          n3 = nredir_alloc(ctx);
-          n3->nredir.node = n2;
-          n3->nredir.redirect = NULL;
-          n2 = n3;
-        }
-        n2->type = NBACKGND;
-      }
-    }
-    if (!n1) {
-      n1 = n2;
-    } else {
-      n3 = nbinary_alloc(ctx);
-      n3->type = NSEMI;
-      n3->nbinary.ch1 = n1;
-      n3->nbinary.ch2 = n2;
-      n1 = n3;
-    }
-    switch (tok) {
-    case TEOF:
-      parseheredoc(ctx);
-      ctx->tokpushback = true;
-      ctx->last_token.id = TEOF;
-      return n1;
-
-    case TNL:
-      ctx->tokpushback = true;
-    case TBACKGND:
-    case TSEMI:
-      break;
-
-    default:
-      if (!ctx->chkflags.chknl) {
-        ctx_synerror_expect(ctx, -1);
-        return NULL;
-      }
-      ctx->tokpushback = true;
-      return n1;
-    }
+  if (ctx->checkonly)
+    return token_text(ctx->last_token);
+  if (ctx->internwords) {
+    const char *text = intern_string(ctx, token_text(ctx->last_token),
+        token_length(ctx->last_token) - 1);
+    if (text)
+      return (char *)text;
   }
+  return obstack_copy0(&ctx->memstack, token_text(ctx->last_token),
+      token_length(ctx->last_token));
 }
 
-static union parse_node *andor(struct parse_context *ctx)
+/* Allocate an argument node holding the last token */
+static union parse_node *tok_narg(struct parse_context *ctx)
 {
-  union parse_node *n1, *n2, *n3;
-  enum parse_tokid tok;
-  enum parse_nodetype toknode;
-
-  n1 = pipeline(ctx);
-  while (true) {
-    if ((tok = readtoken(ctx)) == TAND) {
-      toknode = NAND;
-    } else if (tok == TOR) {
-      toknode = NOR;
-    } else {
-      ctx->tokpushback = true;
-      return n1;
-    }
-    set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
-    n2 = pipeline(ctx);
-    n3 = nbinary_alloc(ctx);
-    n3->type = toknode;
-    n3->nbinary.ch1 = n1;
-    n3->nbinary.ch2 = n2;
-    n1 = n3;
-  }
+  union parse_node *n = ctx->events ? &ctx->evnode : narg_alloc(ctx);
+
+  n->type = NARG;
+  n->narg.next = NULL;
+  n->narg.text = tok_strdup(ctx);
+  n->narg.textlen = token_length(ctx->last_token) - 1;
+  n->narg.backquote = ctx->bqlist;
+  n->narg.arith = ctx->arith;
+  n->narg.flags = ctx->last_token.flags;
+  n->narg.seg = NULL;
+  n->narg.nseg = 0;
+  if (ctx->wordsegments)
+    n->narg.seg = seg_copy(ctx, token_length(ctx->last_token) - 1,
+        &n->narg.nseg);
+  return n;
 }
 
-static union parse_node *pipeline(struct parse_context *ctx)
+/* Return the builtin named by the last token when it holds no expansion,
+ * its quoting being removed first
+ */
+static const struct builtincmd *tok_builtin(struct parse_context *ctx)
 {
-  union parse_node *n1, *n2, *pipenode;
-  struct parse_nodelist *lp;
-  bool negate = false;
+  const char *text = token_text(ctx->last_token);
+  size_t len = token_length(ctx->last_token) - 1;
+  char buf[32];
 
-  if (readtoken(ctx) == TNOT) {
-    negate = !negate;
-    set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_false, tf_keep);
-  } else {
-    ctx->tokpushback = true;
-  }
-  n1 = command(ctx);
-  if (readtoken(ctx) == TPIPE) {
-    pipenode = npipe_alloc(ctx);
-    pipenode->type = NPIPE;
-    pipenode->npipe.backgnd = false;
-    lp = nodelist_alloc(ctx);
-    pipenode->npipe.cmdlist = lp;
-    lp->node = n1;
-    do {
-      struct parse_nodelist *prev;
-
-      prev = lp;
-      lp = nodelist_alloc(ctx);
-      lp->node = command(ctx);
-      prev->next = lp;
-    } while (readtoken(ctx) == TPIPE);
-    lp->next = NULL;
-    n1 = pipenode;
-  }
-  ctx->tokpushback = true;
-  if (negate) {
-    n2 = nnot_alloc(ctx);
-    n2->type = NNOT;
-    n2->nnot.com = n1;
-    return n2;
-  } else {
-    return n1;
+  if (ctx->last_token.flags & WF_EXPAND)
+    return NULL;
+  if (ctx->last_token.flags & WF_CTLCHAR) {
+    if (len >= sizeof(buf))
+      return NULL;
+    len = word_unescape(text, len, buf);
+    text = buf;
   }
+  return find_builtin_len(text, len);
 }
 
-static inline char *tok_strdup(struct parse_context *ctx)
-{
-  return obstack_copy0(&ctx->memstack, token_text(ctx->last_token),
-      token_length(ctx->last_token));
-}
-
-/* Behaves like original expand.c:rmescapes(s, 0) */
-static char *rmescapes(char *str)
+/* Return the node for the redirection just read. When events are given in
+ * place of nodes the one held by the context is reused, except for a here
+ * document which is kept until its body is read.
+ */
+static union parse_node *redir_node(struct parse_context *ctx)
 {
-  char *p, *q;
-  char cqchars[] = {
-#ifdef HAVE_FNMATCH
-    '^',
-#endif
-    CTLQUOTEMARK,
-    CTLESC,
-    '\0'
-  };
-
-  if (!(p = strpbrk(str, cqchars)))
-    return str;
-  q = p;
-  while (*p) {
-    if (*p == CTLQUOTEMARK) {
-      p++;
-      continue;
-    }
-    if (*p == '\\') {
-      *q++ = *p++;
-      continue;
-    }
-#ifdef HAVE_FNMATCH
-    if (*p == '^') {
-      *q++ = *p++;
-      continue;
-    }
-#endif
-    if (*p == CTLESC)
-      p++;
-    *q++ = *p++;
+  if (ctx->events && ctx->cur_redir.type != NHERE) {
+    ctx->evredir = ctx->cur_redir;
+    return &ctx->evredir;
   }
-  *q = '\0';
-  return str;
+  return node_copy(ctx, &ctx->cur_redir);
 }
 
-static void parsefname(struct parse_context *ctx)
+/* Read the word following a redirection and attach it to the given node */
+void parsefname(struct parse_context *ctx, union parse_node *n)
 {
-  union parse_node *n = &ctx->cur_redir;
-
+  if (n->type == NHERE)
+    set_tokflags_chkeofmark(&ctx->chkflags, true);
+  if (readtoken(ctx) != TWORD) {
+    set_tokflags_chkeofmark(&ctx->chkflags, false);
+    ctx_synerror_expect(ctx, -1);
+    return;
+  }
   if (n->type == NHERE) {
     struct parse_heredoc *here;
 
-    set_tokflags(&ctx->chkflags, tf_false, tf_false, tf_false, tf_true);
-    if (readtoken(ctx) != TWORD) {
-      ctx_synerror_expect(ctx, -1);
-      return;
-    }
-    if (!ctx->lst_heredoc) {
-      ctx->lst_heredoc = obstack_alloc(&ctx->memstack,
-          sizeof(struct parse_heredoc_hdr));
-    }
-    here = obstack_copy(&ctx->lst_heredoc->memstack, &ctx->cur_heredoc,
-        sizeof(struct parse_heredoc));
+    set_tokflags_chkeofmark(&ctx->chkflags, false);
     if (!ctx->quoteflag)
       n->type = NXHERE;
-    here->eofmark = tok_strdup(ctx);
-    rmescapes(here->eofmark);
-    stailq_insert_tail(ctx->lst_heredoc, here);    
+    n->nhere.doc = NULL;
+    ctx->cur_heredoc.here = n;
+    ctx->cur_heredoc.started = false;
+    ctx->cur_heredoc.ended = false;
+    here = stailq_insert_tail(ctx->lst_heredoc, &ctx->cur_heredoc);
+    here->eofmark = obstack_copy0(&ctx->memstack, token_text(ctx->last_token),
+        token_length(ctx->last_token));
+    word_unescape(here->eofmark, strlen(here->eofmark), here->eofmark);
   } else if (n->type == NTOFD || n->type == NFROMFD) {
     char *text = token_text(ctx->last_token);
 
+    n->ndup.vname = NULL;
     if (isdigit(text[0]) && text[1] == '\0') {
       n->ndup.dupfd = text[0] - '0';
     } else if (text[0] == '-' && text[1] == '\0') {
       n->ndup.dupfd = -1;
     } else {
-      union parse_node *newn;
-
-      newn = obstack_alloc(&ctx->memstack, sizeof(union parse_node));
-      newn->type = NARG;
-      newn->narg.next = NULL;
-      newn->narg.text = tok_strdup(ctx);
-      stailq_copy(&newn->narg.backquote, ctx->backquote);
-      n->ndup.vname = newn;
+      n->ndup.vname = tok_narg(ctx);
     }
+  } else {
+    n->nfile.fname = tok_narg(ctx);
+    n->nfile.expfname = NULL;
   }
 }
 
-static union parse_node *command(struct parse_context *ctx)
-{
-  union parse_node *n1, *n2;
-  union parse_node *ap, **app;
-  union parse_node *cp, **cpp;
-  union parse_node *redir = NULL, **rpp, **rpp2 = &redir;
-  enum parse_tokid tok;
-  unsigned int savelinno = source_currline(ctx);
-  bool skip_check = false;
+/*
+ * The grammar is driven by an explicit stack of frames rather than by the
+ * functions of the original parser calling each other, so that the depth of
+ * nesting that can be parsed is limited by the heap rather than by the stack
+ * of the calling thread. Each frame holds the state of one of the original
+ * functions, its state giving the point that function had reached, and calling
+ * another function pushes a frame for it with the caller noting where it is
+ * to continue once the result is available.
+ */
 
-  switch (readtoken(ctx)) {
-  default:
-    ctx_synerror_expect(ctx, -1);
-    return NULL;
+/* Define the points reached within each of the original parser functions,
+ * those from PS_COMMAND onwards belong to a command and count as nesting
+ */
+enum parse_state {
+  PS_LIST = 0,                /* list(): start of each item */
+  PS_LIST_ANDOR,              /* list(): after an and-or list */
+  PS_ANDOR,                   /* andor(): start */
+  PS_ANDOR_NEXT,              /* andor(): after a pipeline */
+  PS_PIPELINE,                /* pipeline(): start */
+  PS_PIPELINE_FIRST,          /* pipeline(): after the first command */
+  PS_PIPELINE_NEXT,           /* pipeline(): after a following command */
+  PS_COMMAND,                 /* command(): start */
+  PS_IF_TEST,                 /* command(): after an if or elif condition */
+  PS_IF_PART,                 /* command(): after a then part */
+  PS_IF_ELSE,                 /* command(): after an else part */
+  PS_LOOP_TEST,               /* command(): after a while or until condition */
+  PS_LOOP_BODY,               /* command(): after a loop body */
+  PS_CASE_BODY,               /* command(): after a case item */
+  PS_SUBSHELL,                /* command(): after a subshell list */
+  PS_BRACE,                   /* command(): after a brace group list */
+  PS_SIMPLECMD,               /* simplecmd(): start */
+  PS_DEFUN_BODY               /* simplecmd(): after a function body */
+};
+
+/* Define the state of one of the original parser functions */
+struct parse_frame {
+  enum parse_state        state;     /* Point reached */
+  enum parse_tokid        tok;       /* Closing token or and-or operator */
+  unsigned int            linno;     /* Line the command started on */
+  bool                    chknl;     /* list(): list is within a command */
+  bool                    chkendtok; /* list(): end tokens end the list */
+  bool                    negate;    /* pipeline(): pipeline is negated */
+  bool                    begun;     /* simplecmd(): start has been given */
+  bool                    held;      /* simplecmd(): first word not yet given */
+  enum parse_nodetype     type;      /* command(): type of compound command */
+  unsigned int            nargs;     /* simplecmd(): number of arguments */
+  enum parse_cmdid        cmdid;     /* simplecmd(): builtin being run */
+  unsigned short          cmdflags;  /* simplecmd(): flags of the builtin */
+  union parse_node       *n1;        /* Node being built */
+  union parse_node       *n2;        /* Current part of the node */
+  union parse_node       *args;      /* simplecmd(): arguments */
+  union parse_node       *vars;      /* simplecmd(): assignments */
+  union parse_node       *redir;     /* Redirections */
+  union parse_node      **app;       /* End of current list of nodes */
+  union parse_node      **vpp;       /* simplecmd(): end of assignments */
+  union parse_node      **rpp;       /* End of redirections */
+  struct parse_nodelist  *lp;        /* pipeline(): last command */
+  struct parse_tokflags   saveflags; /* simplecmd(): flags for next word */
+  struct parse_token      word;      /* simplecmd(): first word held back */
+  size_t                  cbase;     /* First of the children of the frame */
+};
+
+/* Define a child of an n-ary node, with the operator joining it to the one
+ * before it in an and-or list
+ */
+struct parse_child {
+  union parse_node       *node;
+  unsigned char           op;
+};
 
-  case TIF:
-    n1 = nif_alloc(ctx);
-    n1->type = NIF;
-    n1->nif.test = list_nl(ctx);
-    if (readtoken(ctx) != TTHEN) {
-      ctx_synerror_expect(ctx, TTHEN);
+struct parse_stack {
+  struct parse_frame *frame;         /* Frames in use from the bottom */
+  size_t              nframe;        /* Number of frames in use */
+  size_t              maxframe;      /* Number of frames allocated */
+  unsigned int        depth;         /* Number of commands being parsed */
+  unsigned int        nsubst;        /* Number of substitutions it is within */
+  struct parse_stack *nested;        /* Stack for command substitutions */
+  struct parse_child *child;         /* Children of the n-ary nodes being built */
+  size_t              nchild;        /* Number of children in use */
+  size_t              maxchild;      /* Number of children allocated */
+  union parse_node   *ret;           /* Result held while a step is suspended */
+  bool                suspended;     /* Set if a step left frames to carry on */
+  bool                hastext;       /* Set once the text obstack is set up */
+  struct obstack      text;          /* Text of the words of a substitution */
+  void               *textbase;      /* First object of the text obstack */
+};
+
+/* Push a frame for the given function, returning NULL once the limit on the
+ * nesting of commands has been reached or no memory is available
+ */
+static struct parse_frame *push_frame(struct parse_context *ctx,
+                                      enum parse_state      state)
+{
+  struct parse_stack *ps = ctx->pstack;
+  struct parse_frame *fr;
+
+  if (state == PS_COMMAND) {
+    if (ctx->maxdepth && ps->depth >= ctx->maxdepth) {
+      ctx_synerror(ctx, SE_TOODEEP, -1, NULL);
       return NULL;
     }
-    n1->nif.ifpart = list_nl(ctx);
-    n2 = n1;
-    while (readtoken(ctx) == TELIF) {
-      n2->nif.elsepart = nif_alloc(ctx);
-      n2 = n2->nif.elsepart;
-      n2->type = NIF;
-      n2->nif.test = list_nl(ctx);
-      if (readtoken(ctx) != TTHEN) {
-        ctx_synerror_expect(ctx, TTHEN);
-        return NULL;
-      }
-      n2->nif.ifpart = list_nl(ctx);
+    ps->depth++;
+  }
+  if (ps->nframe == ps->maxframe) {
+    size_t newmax = ps->maxframe ? ps->maxframe * 2 : 64;
+    struct parse_frame *newp = realloc(ps->frame,
+        newmax * sizeof(struct parse_frame));
+    if (!newp) {
+      ctx->int_error = IE_NOMEMORY;
+      return NULL;
     }
-    if (ctx->last_token.id == TELSE) {
-      n2->nif.elsepart = list_nl(ctx);
-    } else {
-      n2->nif.elsepart = NULL;
-      ctx->tokpushback = true;
+    ps->frame = newp;
+    ps->maxframe = newmax;
+  }
+  fr = &ps->frame[ps->nframe++];
+  fr->state = state;
+  fr->cbase = ps->nchild;
+  return fr;
+}
+
+/* Add a child to the n-ary node being built by the current frame, the frames
+ * pushed after it having taken their own children off by the time it does
+ */
+static bool push_child(struct parse_context *ctx,
+                       union parse_node     *n,
+                       enum parse_nodetype   op)
+{
+  struct parse_stack *ps = ctx->pstack;
+
+  if (ps->nchild == ps->maxchild) {
+    size_t newmax = ps->maxchild ? ps->maxchild * 2 : 64;
+    struct parse_child *newp = realloc(ps->child,
+        newmax * sizeof(struct parse_child));
+    if (!newp) {
+      ctx->int_error = IE_NOMEMORY;
+      return false;
     }
-    tok = TFI;
+    ps->child = newp;
+    ps->maxchild = newmax;
+  }
+  ps->child[ps->nchild].node = n;
+  ps->child[ps->nchild++].op = op;
+  return true;
+}
+
+/* Give the start of a simple command to the events if it has not been given,
+ * along with any word held back in case it named a function
+ */
+static void event_simplecmd(struct parse_context *ctx,
+                            struct parse_frame   *fr)
+{
+  if (!fr->begun) {
+    event_begin(ctx, NCMD, fr->linno);
+    fr->begun = true;
+  }
+  if (fr->held) {
+    event_word(ctx, &fr->word, 0);
+    fr->held = false;
+  }
+}
+
+/* Return the node built by the current frame, which is the n-ary node of the
+ * given type holding its children when it has more than one of them, and
+ * take the children off the stack. When events are given in place of nodes
+ * the end of the node is given instead.
+ */
+static union parse_node *nary_node(struct parse_context *ctx,
+                                   struct parse_frame   *fr,
+                                   enum parse_nodetype   type)
+{
+  struct parse_stack *ps = ctx->pstack;
+  struct parse_child *cp = &ps->child[fr->cbase];
+  size_t count = ps->nchild - fr->cbase, idx;
+  union parse_node *n;
+
+  ps->nchild = fr->cbase;
+  if (ctx->events && fr->n1 && fr->n1 != eof_node())
+    event_end(ctx, type);
+  if (count < 2)
+    return fr->n1;
+  switch (type) {
+  case NANDOR:
+    n = nandor_alloc(ctx);
+    n->nandor.op = obstack_alloc(&ctx->memstack, count - 1);
+    for (idx = 1; idx < count; idx++)
+      n->nandor.op[idx - 1] = cp[idx].op;
     break;
 
-  case TWHILE:
-  case TUNTIL:
-    n1 = nbinary_alloc(ctx);
-    n1->type = (ctx->last_token.id == TWHILE ? NWHILE : NUNTIL);
-    n1->nbinary.ch1 = list_nl(ctx);
-    if (readtoken(ctx) != TDO) {
-      ctx_synerror_expect(ctx, TDO);
-      return NULL;
-    }
-    n1->nbinary.ch2 = list_nl(ctx);
-    tok = TDONE;
+  case NIFCHAIN:
+    n = nifchain_alloc(ctx);
+    n->nifchain.elsepart = NULL;
     break;
 
-  case TFOR:
-    if (readtoken(ctx) != TWORD ||
-        ctx->quoteflag ||
-        !goodname(token_text(ctx->last_token))) {
-      ctx_synerror(ctx, SE_BADFORVAR, -1, NULL);
-      return NULL;
-    }
-    n1 = nfor_alloc(ctx);
-    n1->type = NFOR;
-    n1->nfor.linno = savelinno;
-    n1->nfor.var = tok_strdup(ctx);
-    set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
-    if (readtoken(ctx) == TIN) {
-      app = &ap;
-      while (readtoken(ctx) == TWORD) {
-        n2 = narg_alloc(ctx);
-        n2->type = NARG;
-        n2->narg.text = tok_strdup(ctx);
-        stailq_copy(&n2->narg.backquote, ctx->backquote);
-        *app = n2;
-        app = &n2->narg.next;
+  case NPIPELINE:
+    n = npipeline_alloc(ctx);
+    n->npipeline.backgnd = false;
+    break;
+
+  default:
+    n = nseq_alloc(ctx);
+    break;
+  }
+  n->type = type;
+  n->nseq.count = type == NIFCHAIN ? count / 2 : count;
+  n->nseq.child = obstack_alloc(&ctx->memstack,
+      count * sizeof(union parse_node *));
+  for (idx = 0; idx < count; idx++)
+    n->nseq.child[idx] = cp[idx].node;
+  return n;
+}
+
+/* Push a frame for list() */
+static inline bool push_list(struct parse_context *ctx,
+                             bool                  chknl,
+                             bool                  chkendtok)
+{
+  struct parse_frame *fr = push_frame(ctx, PS_LIST);
+
+  if (!fr)
+    return false;
+  fr->chknl = chknl;
+  fr->chkendtok = chkendtok;
+  fr->n1 = NULL;
+  return true;
+}
+
+/* Read the next token, leaving the parser on a syntax error */
+#define NEXT_TOKEN(var)                     \
+  do {                                      \
+    var = readtoken(ctx);                   \
+    if (ctx->synerror.code != SE_NONE ||    \
+        ctx_halted(ctx))                    \
+      goto fail;                            \
+  } while (0)
+
+/* Read the bodies of the pending here documents, failing on any error found
+ * within a command substitution in one of them
+ */
+#define PARSE_HEREDOC()                     \
+  do {                                      \
+    parseheredoc(ctx);                      \
+    if (ctx->synerror.code != SE_NONE ||    \
+        ctx_halted(ctx))                    \
+      goto fail;                            \
+  } while (0)
+
+/* Continue the current frame at the given state once the frame pushed for the
+ * called function has returned its result
+ */
+#define CALL(next, push)                    \
+  do {                                      \
+    fr->state = next;                       \
+    if (!(push))                            \
+      goto fail;                            \
+    goto next_frame;                          \
+  } while (0)
+#define CALL_LIST(next, nl, endtok) CALL(next, push_list(ctx, nl, endtok))
+#define CALL_FUNC(next, func)       CALL(next, push_frame(ctx, func))
+
+/* Return the result to the frame below */
+#define RETURN(node)                        \
+  do {                                      \
+    ret = (node);                           \
+    if (fr->state >= PS_COMMAND)            \
+      ps->depth--;                          \
+    ps->nframe--;                           \
+    goto next_frame;                          \
+  } while (0)
+
+/* Run the frames above the given base until the bottom one returns, the
+ * given result being that returned to the top frame. When stepping, the
+ * frames are left in place once the step has read its share of the source,
+ * with the result held by the stack, and pending_node() is returned.
+ */
+static union parse_node *parse_frames(struct parse_context *ctx,
+                                      size_t                base,
+                                      union parse_node     *ret)
+{
+  struct parse_stack *ps = ctx->pstack;
+  union parse_node *n2, *n3;
+  enum parse_tokid tok;
+
+  while (ps->nframe > base) {
+    struct parse_frame *fr = &ps->frame[ps->nframe - 1];
+
+    switch (fr->state) {
+    case PS_LIST:
+      set_tokflags(&ctx->chkflags, tf_true, tf_true,
+                   fr->chknl ? tf_true : tf_false, tf_keep);
+      NEXT_TOKEN(tok);
+      switch (tok) {
+      case TNL:
+        PARSE_HEREDOC();
+        RETURN(nary_node(ctx, fr, NSEQ));
+
+      case TEOF:
+        if (!fr->n1 && !fr->chknl)
+          fr->n1 = eof_node();
+        PARSE_HEREDOC();
+        ctx->tokpushback = true;
+        ctx->last_token.id = TEOF;
+        RETURN(nary_node(ctx, fr, NSEQ));
+
+      default:
+        break;
+      }
+      ctx->tokpushback = true;
+      if (fr->chkendtok && endtoklist(tok))
+        RETURN(nary_node(ctx, fr, NSEQ));
+      fr->chkendtok = fr->chknl;
+      if (ctx->events && !fr->n1)
+        event_begin(ctx, NSEQ, source_currline(ctx));
+      CALL_FUNC(PS_LIST_ANDOR, PS_ANDOR);
+
+    case PS_LIST_ANDOR:
+      n2 = ret;
+      NEXT_TOKEN(tok);
+      if (tok == TBACKGND && ctx->events) {
+        event_token(ctx, tok);
+      } else if (tok == TBACKGND) {
+        if (n2->type == NPIPE) {
+          n2->npipe.backgnd = true;
+        } else if (n2->type == NPIPELINE) {
+          n2->npipeline.backgnd = true;
+        } else {
+          if (n2->type != NREDIR) {
+            n3 = nredir_alloc(ctx);
+            n3->nredir.node = n2;
+            n3->nredir.redirect = NULL;
+            n2 = n3;
+          }
+          n2->type = NBACKGND;
+        }
       }
-      *app = NULL;
-      n1->nfor.args = ap;
-      if (ctx->last_token.id != TNL && ctx->last_token.id != TSEMI) {
-        ctx_synerror_expect(ctx, ctx->last_token.id);
+      if (ctx->narynodes && !push_child(ctx, n2, NSEMI))
+        goto fail;
+      if (!fr->n1) {
+        fr->n1 = n2;
+      } else if (!ctx->narynodes && !ctx->events) {
+        n3 = nbinary_alloc(ctx);
+        n3->type = NSEMI;
+        n3->nbinary.ch1 = fr->n1;
+        n3->nbinary.ch2 = n2;
+        fr->n1 = n3;
       }
-    } else {
-      char dolatstr[] = { CTLQUOTEMARK, CTLVAR, VSNORMAL | VSBIT, '@', '=',
-                          CTLQUOTEMARK };
-      n2 = narg_alloc(ctx);
-      n2->type = NARG;
-      obstack_copy0(&ctx->memstack, dolatstr, 7);
-      n2->narg.text = obstack_finish(&ctx->memstack);
-      n2->narg.backquote = NULL;
-      n2->narg.next = NULL;
-      n1->nfor.args = n2;
-      if (ctx->last_token.id != TSEMI)
+      switch (tok) {
+      case TEOF:
+        PARSE_HEREDOC();
         ctx->tokpushback = true;
-    }
-    set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
-    if (readtoken(ctx) != TDO) {
-      ctx_synerror_expect(ctx, TDO);
-      return NULL;
-    }
-    n1->nfor.body = list_nl(ctx);
-    tok = TDONE;
-    break;
+        ctx->last_token.id = TEOF;
+        RETURN(nary_node(ctx, fr, NSEQ));
 
-  case TCASE:
-    n1 = ncase_alloc(ctx);
-    n1->type = NCASE;
-    n1->ncase.linno = savelinno;
-    if (readtoken(ctx) != TWORD) {
-      ctx_synerror_expect(ctx, TWORD);
-      return NULL;
-    }
-    n1->ncase.expr = n2 = narg_alloc(ctx);
-    n2->type = NARG;
-    n2->narg.text = tok_strdup(ctx);
-    stailq_copy(&n2->narg.backquote, ctx->backquote);
-    n2->narg.next = NULL;
-    set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
-    if (readtoken(ctx) != TIN) {
-      ctx_synerror_expect(ctx, TIN);
-      return NULL;
-    }
-    cpp = &n1->ncase.cases;
-    set_tokflags(&ctx->chkflags, tf_false, tf_true, tf_true, tf_keep);
-    tok = readtoken(ctx);
-    while (tok != TESAC) {
-      if (ctx->last_token.id == TLP)
-        readtoken(ctx);
-      *cpp = cp = nclist_alloc(ctx);
-      while (true) {
-        *app = ap = narg_alloc(ctx);
-        ap->type = NARG;
-        ap->narg.text = tok_strdup(ctx);
-        stailq_copy(&ap->narg.backquote, ctx->backquote);
-        if (readtoken(ctx) != TPIPE)
-          break;
-        app = &ap->narg.next;
-        readtoken(ctx);
+      case TNL:
+        ctx->tokpushback = true;
+        /* FALLTHROUGH */
+      case TBACKGND:
+      case TSEMI:
+        fr->state = PS_LIST;
+        continue;
+
+      default:
+        if (!fr->chknl) {
+          ctx_synerror_expect(ctx, -1);
+          goto fail;
+        }
+        ctx->tokpushback = true;
+        RETURN(nary_node(ctx, fr, NSEQ));
+      }
+
+    case PS_ANDOR:
+      fr->n1 = NULL;
+      if (ctx->events)
+        event_begin(ctx, NANDOR, source_currline(ctx));
+      CALL_FUNC(PS_ANDOR_NEXT, PS_PIPELINE);
+
+    case PS_ANDOR_NEXT:
+      if (ctx->narynodes &&
+          !push_child(ctx, ret, fr->n1 && fr->tok == TAND ? NAND : NOR))
+        goto fail;
+      if (!fr->n1) {
+        fr->n1 = ret;
+      } else if (!ctx->narynodes && !ctx->events) {
+        n3 = nbinary_alloc(ctx);
+        n3->type = fr->tok == TAND ? NAND : NOR;
+        n3->nbinary.ch1 = fr->n1;
+        n3->nbinary.ch2 = ret;
+        fr->n1 = n3;
+      }
+      NEXT_TOKEN(tok);
+      if (tok != TAND && tok != TOR) {
+        ctx->tokpushback = true;
+        RETURN(nary_node(ctx, fr, NANDOR));
+      }
+      fr->tok = tok;
+      if (ctx->events)
+        event_token(ctx, tok);
+      set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
+      CALL_FUNC(PS_ANDOR_NEXT, PS_PIPELINE);
+
+    case PS_PIPELINE:
+      if (ctx->events)
+        event_begin(ctx, NPIPELINE, source_currline(ctx));
+      NEXT_TOKEN(tok);
+      fr->negate = false;
+      if (tok == TNOT) {
+        if (ctx->events)
+          event_token(ctx, tok);
+        fr->negate = true;
+        set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_false, tf_keep);
+      } else {
+        ctx->tokpushback = true;
+      }
+      CALL_FUNC(PS_PIPELINE_FIRST, PS_COMMAND);
+
+    case PS_PIPELINE_FIRST:
+      fr->n1 = ret;
+      NEXT_TOKEN(tok);
+      if (tok == TPIPE && ctx->events)
+        goto pipe_next;
+      if (tok == TPIPE && ctx->narynodes) {
+        if (!push_child(ctx, ret, NPIPE))
+          goto fail;
+        goto pipe_next;
+      }
+      if (tok == TPIPE) {
+        n2 = npipe_alloc(ctx);
+        n2->type = NPIPE;
+        n2->npipe.backgnd = false;
+        fr->lp = nodelist_alloc(ctx);
+        n2->npipe.cmdlist = fr->lp;
+        fr->lp->node = fr->n1;
+        fr->n1 = n2;
+        goto pipe_next;
+      }
+      goto pipe_done;
+
+    case PS_PIPELINE_NEXT:
+      if (ctx->narynodes) {
+        if (!push_child(ctx, ret, NPIPE))
+          goto fail;
+      } else if (!ctx->events) {
+        fr->lp->node = ret;
+      }
+      NEXT_TOKEN(tok);
+      if (tok == TPIPE) {
+    pipe_next:
+        if (ctx->events)
+          event_token(ctx, tok);
+        else if (!ctx->narynodes)
+          fr->lp = fr->lp->next = nodelist_alloc(ctx);
+        set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
+        CALL_FUNC(PS_PIPELINE_NEXT, PS_COMMAND);
+      }
+      if (ctx->narynodes)
+        fr->n1 = nary_node(ctx, fr, NPIPELINE);
+      else if (!ctx->events)
+        fr->lp->next = NULL;
+    pipe_done:
+      ctx->tokpushback = true;
+      if (ctx->events) {
+        event_end(ctx, NPIPELINE);
+        RETURN(fr->n1);
       }
-      ap->narg.next = NULL;
-      if (ctx->last_token.id != TRP) {
-        ctx_synerror_expect(ctx, TRP);
-        return NULL;
+      if (fr->negate) {
+        n2 = nnot_alloc(ctx);
+        n2->type = NNOT;
+        n2->nnot.com = fr->n1;
+        fr->n1 = n2;
       }
-      cp->nclist.body = list_et(ctx);
-      cpp = &cp->nclist.next;
+      RETURN(fr->n1);
+
+    case PS_COMMAND:
+      fr->linno = source_currline(ctx);
+      NEXT_TOKEN(tok);
+      switch (tok) {
+      default:
+        ctx_synerror_expect(ctx, -1);
+        goto fail;
+
+      case TIF:
+        fr->type = NIF;
+        if (ctx->events) {
+          event_begin(ctx, NIF, fr->linno);
+          fr->n1 = fr->n2 = &ctx->evnode;
+        } else if (!ctx->narynodes) {
+          fr->n1 = fr->n2 = nif_alloc(ctx);
+          fr->n1->type = NIF;
+        }
+        CALL_LIST(PS_IF_TEST, true, false);
+
+      case TWHILE:
+      case TUNTIL:
+        fr->type = tok == TWHILE ? NWHILE : NUNTIL;
+        if (ctx->events)
+          event_begin(ctx, fr->type, fr->linno);
+        fr->n1 = ctx->events ? &ctx->evnode : nbinary_alloc(ctx);
+        fr->n1->type = fr->type;
+        CALL_LIST(PS_LOOP_TEST, true, false);
+
+      case TFOR:
+        NEXT_TOKEN(tok);
+        if (tok != TWORD || ctx->quoteflag ||
+            !goodname(token_text(ctx->last_token))) {
+          ctx_synerror(ctx, SE_BADFORVAR, -1, NULL);
+          goto fail;
+        }
+        fr->type = NFOR;
+        if (ctx->events) {
+          event_begin(ctx, NFOR, fr->linno);
+          event_word(ctx, &ctx->last_token, 0);
+        }
+        fr->n1 = ctx->events ? &ctx->evnode : nfor_alloc(ctx);
+        fr->n1->type = NFOR;
+        fr->n1->nfor.linno = fr->linno;
+        fr->n1->nfor.var = tok_strdup(ctx);
+        set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
+        NEXT_TOKEN(tok);
+        if (tok == TIN) {
+          union parse_node *ap, **app = &ap;
+
+          if (ctx->events)
+            event_token(ctx, tok);
+          while (true) {
+            NEXT_TOKEN(tok);
+            if (tok != TWORD)
+              break;
+            if (ctx->events)
+              event_word(ctx, &ctx->last_token, 0);
+            n2 = tok_narg(ctx);
+            *app = n2;
+            app = &n2->narg.next;
+          }
+          *app = NULL;
+          fr->n1->nfor.args = ap;
+          if (tok != TNL && tok != TSEMI) {
+            ctx_synerror_expect(ctx, tok);
+            goto fail;
+          }
+        } else if (ctx->events) {
+          if (tok != TSEMI)
+            ctx->tokpushback = true;
+        } else {
+          char dolatstr[] = { CTLQUOTEMARK, CTLVAR, VSNORMAL | VSBIT, '@', '=',
+                              CTLQUOTEMARK };
+          n2 = narg_alloc(ctx);
+          n2->type = NARG;
+          n2->narg.text = obstack_copy0(&ctx->memstack, dolatstr, sizeof(dolatstr));
+          n2->narg.textlen = sizeof(dolatstr);
+          n2->narg.backquote = NULL;
+          n2->narg.arith = NULL;
+          n2->narg.flags = WF_QUOTED | WF_CTLCHAR | WF_EXPAND;
+          n2->narg.seg = NULL;
+          n2->narg.nseg = 0;
+          n2->narg.next = NULL;
+          fr->n1->nfor.args = n2;
+          if (tok != TSEMI)
+            ctx->tokpushback = true;
+        }
+        set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
+        NEXT_TOKEN(tok);
+        if (tok != TDO) {
+          ctx_synerror_expect(ctx, TDO);
+          goto fail;
+        }
+        CALL_LIST(PS_LOOP_BODY, true, false);
+
+      case TCASE:
+        fr->type = NCASE;
+        if (ctx->events)
+          event_begin(ctx, NCASE, fr->linno);
+        fr->n1 = ctx->events ? &ctx->evnode : ncase_alloc(ctx);
+        fr->n1->type = NCASE;
+        fr->n1->ncase.linno = fr->linno;
+        NEXT_TOKEN(tok);
+        if (tok != TWORD) {
+          ctx_synerror_expect(ctx, TWORD);
+          goto fail;
+        }
+        if (ctx->events)
+          event_word(ctx, &ctx->last_token, 0);
+        fr->n1->ncase.expr = tok_narg(ctx);
+        set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
+        NEXT_TOKEN(tok);
+        if (tok != TIN) {
+          ctx_synerror_expect(ctx, TIN);
+          goto fail;
+        }
+        fr->app = &fr->n1->ncase.cases;
+        set_tokflags(&ctx->chkflags, tf_false, tf_true, tf_true, tf_keep);
+        NEXT_TOKEN(tok);
+        goto case_item;
+
+      case TLP:
+        fr->type = NSUBSHELL;
+        if (ctx->events)
+          event_begin(ctx, NSUBSHELL, fr->linno);
+        fr->n1 = ctx->events ? &ctx->evnode : nredir_alloc(ctx);
+        fr->n1->type = NSUBSHELL;
+        fr->n1->nredir.linno = fr->linno;
+        fr->n1->nredir.redirect = NULL;
+        CALL_LIST(PS_SUBSHELL, true, false);
+
+      case TBEGIN:
+        fr->type = NREDIR;
+        if (ctx->events)
+          event_begin(ctx, NREDIR, fr->linno);
+        CALL_LIST(PS_BRACE, true, false);
+
+      case TWORD:
+      case TREDIR:
+        ctx->tokpushback = true;
+        fr->state = PS_SIMPLECMD;
+        continue;
+      }
+
+    case PS_IF_TEST:
+      if (ctx->narynodes) {
+        if (!push_child(ctx, ret, NIF))
+          goto fail;
+      } else {
+        fr->n2->nif.test = ret;
+      }
+      NEXT_TOKEN(tok);
+      if (tok != TTHEN) {
+        ctx_synerror_expect(ctx, TTHEN);
+        goto fail;
+      }
+      CALL_LIST(PS_IF_PART, true, false);
+
+    case PS_IF_PART:
+      if (ctx->narynodes) {
+        if (!push_child(ctx, ret, NIF))
+          goto fail;
+      } else {
+        fr->n2->nif.ifpart = ret;
+      }
+      NEXT_TOKEN(tok);
+      if ((tok == TELIF || tok == TELSE) && ctx->events)
+        event_token(ctx, tok);
+      if (tok == TELIF) {
+        if (ctx->events) {
+          fr->n2 = &ctx->evnode;
+        } else if (!ctx->narynodes) {
+          fr->n2 = fr->n2->nif.elsepart = nif_alloc(ctx);
+          fr->n2->type = NIF;
+        }
+        CALL_LIST(PS_IF_TEST, true, false);
+      }
+      if (tok == TELSE)
+        CALL_LIST(PS_IF_ELSE, true, false);
+      ctx->tokpushback = true;
+      ret = NULL;
+      /* FALLTHROUGH */
+
+    case PS_IF_ELSE:
+      if (ctx->narynodes) {
+        fr->n1 = nary_node(ctx, fr, NIFCHAIN);
+        fr->n1->nifchain.elsepart = ret;
+      } else {
+        fr->n2->nif.elsepart = ret;
+      }
+      fr->tok = TFI;
+      goto close;
+
+    case PS_LOOP_TEST:
+      fr->n1->nbinary.ch1 = ret;
+      NEXT_TOKEN(tok);
+      if (tok != TDO) {
+        ctx_synerror_expect(ctx, TDO);
+        goto fail;
+      }
+      CALL_LIST(PS_LOOP_BODY, true, false);
+
+    case PS_LOOP_BODY:
+      if (fr->type == NFOR)
+        fr->n1->nfor.body = ret;
+      else
+        fr->n1->nbinary.ch2 = ret;
+      fr->tok = TDONE;
+      goto close;
+
+    case PS_CASE_BODY:
+      if (ctx->events)
+        event_end(ctx, NCLIST);
+      fr->n2->nclist.body = ret;
+      fr->app = &fr->n2->nclist.next;
       set_tokflags(&ctx->chkflags, tf_false, tf_true, tf_true, tf_keep);
-      if ((tok = readtoken(ctx)) != TESAC) {
+      NEXT_TOKEN(tok);
+      if (tok != TESAC) {
         if (tok != TENDCASE) {
           ctx_synerror_expect(ctx, TENDCASE);
-          return NULL;
+          goto fail;
+        }
+        set_tokflags(&ctx->chkflags, tf_false, tf_true, tf_true, tf_keep);
+        NEXT_TOKEN(tok);
+      }
+    case_item:
+      if (tok != TESAC) {
+        union parse_node *ap, **app;
+
+        if (tok == TLP)
+          NEXT_TOKEN(tok);
+        if (ctx->events)
+          event_begin(ctx, NCLIST, source_currline(ctx));
+        *fr->app = fr->n2 = ctx->events ? &ctx->evnode : nclist_alloc(ctx);
+        fr->n2->type = NCLIST;
+        app = &fr->n2->nclist.pattern;
+        while (true) {
+          if (tok != TWORD) {
+            ctx_synerror_expect(ctx, TWORD);
+            goto fail;
+          }
+          if (ctx->events)
+            event_word(ctx, &ctx->last_token, 0);
+          *app = ap = tok_narg(ctx);
+          NEXT_TOKEN(tok);
+          if (tok != TPIPE)
+            break;
+          app = &ap->narg.next;
+          NEXT_TOKEN(tok);
+        }
+        ap->narg.next = NULL;
+        if (tok != TRP) {
+          ctx_synerror_expect(ctx, TRP);
+          goto fail;
+        }
+        CALL_LIST(PS_CASE_BODY, true, true);
+      }
+      *fr->app = NULL;
+      goto redir;
+
+    case PS_SUBSHELL:
+      fr->n1->nredir.node = ret;
+      fr->tok = TRP;
+      goto close;
+
+    case PS_BRACE:
+      fr->n1 = ret;
+      fr->tok = TEND;
+    close:
+      NEXT_TOKEN(tok);
+      if (tok != fr->tok) {
+        ctx_synerror_expect(ctx, fr->tok);
+        goto fail;
+      }
+
+    redir:
+      /* Check for redirections */
+      fr->redir = NULL;
+      fr->rpp = &fr->redir;
+      set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_false, tf_keep);
+      while (true) {
+        NEXT_TOKEN(tok);
+        if (tok != TREDIR)
+          break;
+        *fr->rpp = n2 = redir_node(ctx);
+        fr->rpp = &n2->nfile.next;
+        parsefname(ctx, n2);
+        if (ctx->synerror.code != SE_NONE)
+          goto fail;
+        if (ctx->events)
+          event_redir(ctx, n2, &ctx->last_token);
+      }
+      ctx->tokpushback = true;
+      *fr->rpp = NULL;
+      if (ctx->events) {
+        event_end(ctx, fr->type);
+        RETURN(fr->n1);
+      }
+      if (fr->redir) {
+        if (fr->n1->type != NSUBSHELL) {
+          n2 = nredir_alloc(ctx);
+          n2->type = NREDIR;
+          n2->nredir.linno = fr->linno;
+          n2->nredir.node = fr->n1;
+          fr->n1 = n2;
+        }
+        fr->n1->nredir.redirect = fr->redir;
+      }
+      RETURN(fr->n1);
+
+    case PS_SIMPLECMD:
+      fr->linno = source_currline(ctx);
+      fr->nargs = 0;
+      fr->cmdid = CMD_NONE;
+      fr->cmdflags = CF_NONE;
+      fr->begun = fr->held = false;
+      fr->args = fr->vars = fr->redir = NULL;
+      fr->app = &fr->args;
+      fr->vpp = &fr->vars;
+      fr->rpp = &fr->redir;
+      set_tokflags(&fr->saveflags, tf_true, tf_false, tf_false, tf_false);
+      while (true) {
+        ctx->chkflags = fr->saveflags;
+        NEXT_TOKEN(tok);
+        if (ctx->events && fr->held && tok != TLP)
+          event_simplecmd(ctx, fr);
+        if (tok == TWORD) {
+          fr->n2 = tok_narg(ctx);
+          if (any_tokflags(fr->saveflags) &&
+              isassignment(token_text(ctx->last_token))) {
+            *fr->vpp = fr->n2;
+            fr->vpp = &fr->n2->narg.next;
+            if (ctx->events) {
+              event_simplecmd(ctx, fr);
+              event_word(ctx, &ctx->last_token, WF_ASSIGN);
+            }
+          } else {
+            *fr->app = fr->n2;
+            fr->app = &fr->n2->narg.next;
+            clr_tokflags(&fr->saveflags);
+            if (!fr->nargs) {
+              const struct builtincmd *bcmd = tok_builtin(ctx);
+
+              fr->cmdid = builtin_id(bcmd);
+              fr->cmdflags = builtin_flags(bcmd);
+            }
+            if (ctx->events) {
+              /* A word that could name a function is only known to be one
+               * once the token after it has been read
+               */
+              fr->held = !fr->nargs && !fr->vars && !fr->redir &&
+                  goodname(token_text(ctx->last_token));
+              if (fr->held) {
+                fr->word = ctx->last_token;
+              } else {
+                event_simplecmd(ctx, fr);
+                event_word(ctx, &ctx->last_token, 0);
+              }
+            }
+            fr->nargs++;
+          }
+        } else if (tok == TREDIR) {
+          *fr->rpp = fr->n2 = redir_node(ctx);
+          fr->rpp = &fr->n2->nfile.next;
+          parsefname(ctx, fr->n2);
+          if (ctx->synerror.code != SE_NONE)
+            goto fail;
+          if (ctx->events) {
+            event_simplecmd(ctx, fr);
+            event_redir(ctx, fr->n2, &ctx->last_token);
+          }
         } else {
-          set_tokflags(&ctx->chkflags, tf_false, tf_true, tf_true, tf_keep);
-          tok = readtoken(ctx);
+          break;
+        }
+      }
+      if (tok == TLP && fr->nargs == 1 && !fr->vars && !fr->redir) {
+        const char *name;
+
+        /* We have a function */
+        NEXT_TOKEN(tok);
+        if (tok != TRP) {
+          ctx_synerror_expect(ctx, TRP);
+          goto fail;
+        }
+        name = fr->n2->narg.text;
+        if (!goodname(name) || (fr->cmdflags & CF_SPECIAL)) {
+          ctx_synerror(ctx, SE_BADFUNCNAME, -1, NULL);
+          goto fail;
+        }
+        fr->n2->type = NDEFUN;
+        set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
+        fr->n2->ndefun.text = fr->n2->narg.text;
+        fr->n2->ndefun.linno = source_currline(ctx);
+        if (ctx->events) {
+          event_begin(ctx, NDEFUN, fr->n2->ndefun.linno);
+          event_word(ctx, &fr->word, 0);
+        }
+        if (ps->depth == 1) {
+          ctx->defunoff = source_curroff(ctx);
+          ctx->defunline = fr->n2->ndefun.linno;
         }
+        CALL_FUNC(PS_DEFUN_BODY, PS_COMMAND);
       }
+      ctx->tokpushback = true;
+      *fr->app = NULL;
+      *fr->vpp = NULL;
+      *fr->rpp = NULL;
+      if (ctx->events) {
+        event_simplecmd(ctx, fr);
+        event_end(ctx, NCMD);
+        RETURN(&ctx->evnode);
+      }
+      n2 = ncmd_alloc(ctx);
+      n2->type = NCMD;
+      n2->ncmd.linno = fr->linno;
+      n2->ncmd.cmdid = fr->cmdid;
+      n2->ncmd.cmdflags = fr->cmdflags;
+      n2->ncmd.sourced = NULL;
+      n2->ncmd.args = fr->args;
+      n2->ncmd.assign = fr->vars;
+      n2->ncmd.redirect = fr->redir;
+      if (ctx->follow)
+        follow_command(ctx, n2);
+      RETURN(n2);
+
+    case PS_DEFUN_BODY:
+      if (ctx->events) {
+        event_end(ctx, NDEFUN);
+        RETURN(&ctx->evnode);
+      }
+      fr->n2->ndefun.body = ret;
+      RETURN(fr->n2);
     }
-    *cpp = NULL;
-    skip_check = true;
-    break;
+  next_frame:
+    if (ctx->stepend && ps->nframe > base &&
+        source_curroff(ctx) >= ctx->stepend) {
+      ps->ret = ret;
+      ps->suspended = true;
+      return pending_node();
+    }
+  }
+  return ret;
 
-  case TLP:
-    n1 = nredir_alloc(ctx);
-    n1->type = NSUBSHELL;
-    n1->nredir.linno = savelinno;
-    n1->nredir.node = list_nl(ctx);
-    n1->nredir.redirect = NULL;
-    tok = TRP;
-    break;
+fail:
+  /* Discard the frames of this parse, any nesting they counted included */
+  ps->nchild = ps->frame[base].cbase;
+  while (ps->nframe > base)
+    if (ps->frame[--ps->nframe].state >= PS_COMMAND)
+      ps->depth--;
+  return NULL;
+}
+#undef NEXT_TOKEN
+#undef PARSE_HEREDOC
+#undef CALL
+#undef CALL_LIST
+#undef CALL_FUNC
+#undef RETURN
 
-  case TBEGIN:
-    n1 = list_nl(ctx);
-    tok = TEND;
-    break;
+/* Parse a list, with newlines ending it if chknl is set and the tokens that
+ * end a list ending it if chkendtok is set, as list() does in the original
+ */
+static union parse_node *parse_list(struct parse_context *ctx,
+                                    bool                  chknl,
+                                    bool                  chkendtok)
+{
+  struct parse_stack *ps = ctx->pstack;
+  size_t base;
 
-  case TWORD:
-  case TREDIR:
-    ctx->tokpushback = true;
-    return simplecmd(ctx);
+  if (!ps) {
+    if (!(ps = calloc(1, sizeof(struct parse_stack)))) {
+      ctx->int_error = IE_NOMEMORY;
+      return NULL;
+    }
+    ctx->pstack = ps;
   }
-
-  if (!skip_check && readtoken(ctx) != tok) {
-    ctx_synerror_expect(ctx, tok);
+  base = ps->nframe;
+  if (!push_list(ctx, chknl, chkendtok))
     return NULL;
-  }
+  return parse_frames(ctx, base, NULL);
+}
 
-  /* Check for redirections */
-  set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_false, tf_keep);
-  rpp = rpp2;
-  while (readtoken(ctx) == TREDIR) {
-    *rpp = n2 = node_copy(ctx, &ctx->cur_redir);
-    rpp = &n2->nfile.next;
-    parsefname(ctx);
-  }
+/* Return true if a step has left a command part way through being parsed */
+bool parse_suspended(struct parse_context *ctx)
+{
+  return ctx->pstack && ctx->pstack->suspended;
+}
+
+/* Main entry point for the parser. Read and parse a single command, returns
+ * NEOF on end of file, unlike the original parser it will skip empty lines
+ */
+union parse_node *ctx_next_command(struct parse_context *ctx)
+{
+  return ctx_step(ctx, 0);
+}
 
-  ctx->tokpushback = true;
-  *rpp = NULL;
-  if (redir) {
-    if (n1->type != NSUBSHELL) {
-      n2 = nredir_alloc(ctx);
-      n2->type = NREDIR;
-      n2->nredir.linno = savelinno;
-      n2->nredir.node = n1;
-      n1 = n2;
+/* Read and parse a single command as ctx_next_command does, but return
+ * pending_node() once the given number of bytes of the source have been
+ * read, the command being carried on with by the next call. The source is
+ * only checked between the parts of a command, so that a step can read
+ * beyond its share by as much as a word, and a step of zero is unlimited.
+ */
+union parse_node *ctx_step(struct parse_context *ctx, size_t max)
+{
+  struct parse_stack *ps;
+  union parse_node *nxt_node;
+
+  if (!ctx) return NULL;
+  ps = ctx->pstack;
+  ctx->stepend = max ? source_curroff(ctx) + max : 0;
+  if (ps && ps->suspended) {
+    ps->suspended = false;
+    nxt_node = parse_frames(ctx, 0, ps->ret);
+  } else {
+    ctx->tokpushback = false;
+    stailq_clear(ctx->lst_heredoc);
+    nxt_node = parse_list(ctx, false, false);
+  }
+  while (!nxt_node && ctx->int_error == IE_NONE &&
+         ctx->synerror.code == SE_NONE) {
+    if (ctx->stepend && source_curroff(ctx) >= ctx->stepend) {
+      nxt_node = pending_node();
+      break;
     }
-    n1->nredir.redirect = redir;
+    nxt_node = parse_list(ctx, false, false);
   }
-  return n1;
+  ctx->stepend = 0;
+  if (nxt_node == pending_node())
+    return nxt_node;
+  if (!nxt_node && ctx->synerror.code != SE_NONE && recover_enabled(ctx))
+    nxt_node = recover_error(ctx);
+  if (!nxt_node)
+    budget_abandon(ctx);
+  if (nxt_node && nxt_node != eof_node())
+    ctx->ncommand++;
+  return nxt_node;
 }
 
-static union parse_node *simplecmd(struct parse_context *ctx)
+/* Discard the text of the words of the command substitutions read, once the
+ * commands holding them are no longer needed
+ */
+static void parse_subst_trim(struct parse_context *ctx)
 {
-  union parse_node *args = NULL, **app = &args;
-  union parse_node *node = NULL;
-  union parse_node *vars = NULL, **vpp = &vars;
-  union parse_node *redir = NULL, **rpp = &redir;
-  unsigned int savelinno = source_currline(ctx);
-  struct parse_tokflags saveflags;
-
-  set_tokflags(&saveflags, tf_true, tf_false, tf_false, tf_false);
-  while (true) {
-    ctx->chkflags = saveflags;
-    switch (readtoken(ctx)) {
-    case TWORD:
-      node = narg_alloc(ctx);
-      node->type = NARG;
-      node->narg.text = tok_strdup(ctx);
-      stailq_copy(&node->narg.backquote, ctx->backquote);
-      if (any_tokflags(saveflags) && isassignment(token_text(ctx->last_token))) {
-        *vpp = node;
-        vpp = &node->narg.next;
-      } else {
-        *app = node;
-        app = &node->narg.next;
-        clr_tokflags(&saveflags);
-      }
-      break;
+  struct parse_stack *ps;
+
+  for (ps = ctx->pstack; ps; ps = ps->nested)
+    if (ps->hastext) {
+      obstack_free(&ps->text, ps->textbase);
+      ps->textbase = obstack_alloc(&ps->text, 0);
+    }
+}
+
+/* Check the syntax of the whole of the current source without keeping any of
+ * its commands, stopping at the first syntax error which is described in the
+ * given diagnostic. The words are left in the buffer they were read into and
+ * all that is allocated for a command is released once it has been read, so
+ * the memory used does not grow with the length of the source. Each command
+ * is passed to the given function if there is one before it is released,
+ * the check stopping if it returns false.
+ */
+bool ctx_skim(struct parse_context *ctx,
+              struct parse_diag    *diag,
+              bool                (*each)(struct parse_context *,
+                                          union parse_node *, void *),
+              void                 *arg)
+{
+  bool internwords = ctx->internwords, wordsegments = ctx->wordsegments;
+  union parse_node *n;
+  void *nodemark, *textmark;
 
-    case TREDIR:
-      *rpp = node = node_copy(ctx, &ctx->cur_redir);
-      rpp = &node->nfile.next;
-      parsefname(ctx);
+  /* The syntax stack is allocated on first use, which must not be released */
+  if (!ctx->lst_syntax)
+    ctx->lst_syntax = dtailq_init(ctx, NULL, sizeof(struct parse_syntax));
+  ctx->checkonly = true;
+  ctx->internwords = ctx->wordsegments = false;
+  nodemark = obstack_alloc(&ctx->memstack, 0);
+  textmark = obstack_alloc(&ctx->txtstack, 0);
+  do {
+    ctx->tokpushback = false;
+    stailq_clear(ctx->lst_heredoc);
+    n = parse_list(ctx, false, false);
+    if (!n && (ctx->synerror.code != SE_NONE || ctx->int_error != IE_NONE))
+      break;
+    if (n && n != eof_node())
+      ctx->ncommand++;
+    if (n && n != eof_node() && each && !each(ctx, n, arg)) {
+      n = NULL;
       break;
+    }
+    obstack_free(&ctx->txtstack, textmark);
+    textmark = obstack_alloc(&ctx->txtstack, 0);
+    parse_subst_trim(ctx);
+    obstack_free(&ctx->memstack, nodemark);
+    nodemark = obstack_alloc(&ctx->memstack, 0);
+  } while (n != eof_node());
+  ctx->checkonly = false;
+  ctx->internwords = internwords;
+  ctx->wordsegments = wordsegments;
 
-    case TLP:
-      if (args && app == &args->narg.next && !vars && !redir) {
-        const struct builtincmd *bcmd;
-        const char *name;
+  if (n)
+    return true;
+  budget_abandon(ctx);
+  if (diag && ctx->synerror.code != SE_NONE)
+    recover_note(ctx, diag);
+  return false;
+}
 
-        /* We have a function */
-        if (readtoken(ctx) != TRP) {
-          ctx_synerror_expect(ctx, TRP);
-          return NULL;
-        }
-        name = tok_strdup(ctx);
-        if (!goodname(name) || ((bcmd = find_builtin(name)) && builtin_isspecial(bcmd))) {
-          ctx_synerror(ctx, SE_BADFUNCNAME, -1, NULL);
-          return NULL;
-        }
-        node->type = NDEFUN;
-        set_tokflags(&ctx->chkflags, tf_true, tf_true, tf_true, tf_keep);
-        node->ndefun.text = node->narg.text;
-        node->ndefun.linno = source_currline(ctx);
-        node->ndefun.body = command(ctx);
-        return node;
+/* Parse the whole of the current source, returning its commands in an array
+ * held by the context. There is no arena of its own, the chunk size of the
+ * node obstack is only raised in proportion to the length of the source while
+ * it is parsed, so that the nodes of the script take fewer and larger chunks.
+ * The memory reported is that the context took for the script.
+ */
+bool ctx_parse_all(struct parse_context *ctx, struct parse_script **out)
+{
+  size_t oldsize = obstack_chunk_size(&ctx->memstack);
+  size_t used = obstack_memory_used(&ctx->memstack);
+  size_t len = source_size(ctx), size = len * PARSE_ALL_RATIO;
+  size_t count = 0, maxcmd = 0;
+  union parse_node **cmd = NULL, **newp, *n;
+  struct parse_script *script = NULL;
+
+  if (size > PARSE_ALL_MAXBLOCK)
+    size = PARSE_ALL_MAXBLOCK;
+  if (size > oldsize) {
+    obstack_chunk_size(&ctx->memstack) = size;
+    if (obstack_room(&ctx->memstack) < size)
+      obstack_make_room(&ctx->memstack, size);
+  }
+
+  while ((n = ctx_next_command(ctx)) && n->type != NEOF) {
+    if (count == maxcmd) {
+      maxcmd = maxcmd ? maxcmd * 2 : 256;
+      if (!(newp = realloc(cmd, maxcmd * sizeof(union parse_node *)))) {
+        ctx->int_error = IE_NOMEMORY;
+        goto done;
       }
+      cmd = newp;
+    }
+    cmd[count++] = n;
+  }
+  if (ctx->int_error == IE_NOMEMORY)
+    goto done;
 
-    default:
-      ctx->tokpushback = true;
-      goto out;
+  /* The array follows the nodes of the script */
+  script = obstack_alloc(&ctx->memstack, sizeof(struct parse_script));
+  script->count = count;
+  script->cmd = obstack_alloc(&ctx->memstack,
+      (count ? count : 1) * sizeof(union parse_node *));
+  if (count)
+    memcpy(script->cmd, cmd, count * sizeof(union parse_node *));
+  script->length = len;
+  script->memory = obstack_memory_used(&ctx->memstack) - used;
+  script->error = !n && ctx->synerror.code != SE_NONE;
+done:
+  obstack_chunk_size(&ctx->memstack) = oldsize;
+  free(cmd);
+  *out = script;
+  return script != NULL;
+}
+
+/* Parse the commands of a command substitution, which end at the closing
+ * parenthesis or at the end of the text of a backquoted command. The frames
+ * of the command containing the substitution must stay where they are while
+ * its word is read, so the commands are parsed with a stack of their own.
+ */
+union parse_node *parse_subst(struct parse_context *ctx, bool oldstyle)
+{
+  struct parse_stack *outer = ctx->pstack, *ps;
+  struct obstack text;
+  union parse_node *n;
+  size_t stepend;
+
+  if (!outer) {
+    if (!(outer = calloc(1, sizeof(struct parse_stack)))) {
+      ctx->int_error = IE_NOMEMORY;
+      return NULL;
     }
+    ctx->pstack = outer;
+  }
+
+  /* The substitution counts as a level of nesting, being parsed by a call */
+  if ((ctx->maxdepth && outer->depth >= ctx->maxdepth) ||
+      outer->nsubst >= PARSE_MAXSUBST) {
+    ctx_synerror(ctx, SE_TOODEEP, -1, NULL);
+    return NULL;
+  }
+  if (!outer->nested &&
+      !(outer->nested = calloc(1, sizeof(struct parse_stack)))) {
+    ctx->int_error = IE_NOMEMORY;
+    return NULL;
+  }
+  ps = outer->nested;
+  ps->nframe = 0;
+  ps->depth = outer->depth + 1;
+  ps->nsubst = outer->nsubst + 1;
+  if (!ps->hastext) {
+    obstack_specify_allocation_with_arg(&ps->text, 0, 0,
+        budget_chunk_alloc, budget_chunk_free, ctx);
+    ps->textbase = obstack_alloc(&ps->text, 0);
+    ps->hastext = true;
+  }
+  ctx->pstack = ps;
+
+  /* The word holding the substitution is left open while its commands are
+   * read, so the text of their words is kept on an obstack of their own
+   */
+  text = ctx->txtstack;
+  ctx->txtstack = ps->text;
+  /* The commands of a substitution are within a word, so are not stepped */
+  stepend = ctx->stepend;
+  ctx->stepend = 0;
+  n = parse_list(ctx, true, true);
+  if (ctx->synerror.code == SE_NONE && readtoken(ctx) != (oldstyle ? TEOF : TRP))
+    ctx_synerror_expect(ctx, oldstyle ? TENDBQUOTE : TRP);
+  ctx->tokpushback = false;
+  ctx->stepend = stepend;
+  ps->text = ctx->txtstack;
+  ctx->txtstack = text;
+  ctx->pstack = outer;
+  return n;
+}
+
+/* Release the stack used by the parser */
+void parse_stack_free(struct parse_context *ctx)
+{
+  struct parse_stack *ps = ctx->pstack, *nested;
+
+  ctx->pstack = NULL;
+  for (; ps; ps = nested) {
+    nested = ps->nested;
+    if (ps->hastext)
+      obstack_free(&ps->text, NULL);
+    free(ps->child);
+    free(ps->frame);
+    free(ps);
   }
-out:
-  *app = NULL;
-  *vpp = NULL;
-  *rpp = NULL;
-  node = ncmd_alloc(ctx);
-  node->type = NCMD;
-  node->ncmd.linno = savelinno;
-  node->ncmd.args = args;
-  node->ncmd.assign = vars;
-  node->ncmd.redirect = redir;
-  return node;
 }
@@ -0,0 +1,281 @@
+/*
+ * This source provides the recovery from syntax errors, so that the rest of a
+ * script can still be parsed. Each error is noted in the list of diagnostics
+ * of the context, the source is skipped up to the next newline or semicolon
+ * that is not quoted or nested, and an error node is returned in place of the
+ * command that could not be parsed. The quotes and substitutions left open by
+ * the error are noted as the parse unwinds, so that the skipping starts from
+ * within them, and the bodies of any here documents still to be read are
+ * skipped along with the line that holds them.
+ */
+
+#include <obstack.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+#include "queue.h"
+
+/* Define the diagnostics noted by the context */
+struct parse_recover {
+  struct parse_diag *diag;            /* Errors in the order found */
+  size_t             ndiag;           /* Number of errors noted */
+  size_t             maxdiag;         /* Number of errors allocated */
+  char              *close;           /* Characters closing what was left open */
+  size_t             nclose;          /* Number of closing characters */
+  size_t             maxclose;        /* Number of closing characters allocated */
+  bool               resync;          /* Set if parsing can resume where it is */
+  bool               enabled;         /* Set if errors are recovered from */
+};
+
+/* Enable or disable the recovery from syntax errors */
+bool recover_set(struct parse_context *ctx, bool enable)
+{
+  if (!ctx->recover && !(ctx->recover = calloc(1, sizeof(struct parse_recover))))
+    return false;
+  ctx->recover->enabled = enable;
+  return true;
+}
+
+/* Return true if syntax errors are to be recovered from */
+bool recover_enabled(struct parse_context *ctx)
+{
+  return ctx->recover && ctx->recover->enabled;
+}
+
+/* Note that the given character closes something that was left open by the
+ * error, those within being noted first
+ */
+void recover_close(struct parse_context *ctx, char chr)
+{
+  struct parse_recover *rec = ctx->recover;
+
+  if (rec->nclose == rec->maxclose) {
+    size_t newmax = rec->maxclose ? rec->maxclose * 2 : 16;
+    char *newp = realloc(rec->close, newmax);
+    if (!newp) {
+      ctx->int_error = IE_NOMEMORY;
+      return;
+    }
+    rec->close = newp;
+    rec->maxclose = newmax;
+  }
+  rec->close[rec->nclose++] = chr;
+}
+
+/* Note the quotes, substitutions and expansions of the given syntax that were
+ * left open by the error, those within being noted first
+ */
+void recover_syntax(struct parse_context *ctx, struct parse_syntax *syn)
+{
+  unsigned int idx;
+
+  if (syn->type == SYN_SQUOTE)
+    recover_close(ctx, '\'');
+  if (syn->innerdq)
+    recover_close(ctx, '"');
+  for (idx = 0; idx < syn->varnest; idx++)
+    recover_close(ctx, '}');
+  if (!syn->varpushed &&
+      (syn->dqvarnest || (syn->type == SYN_DQUOTE && !syn->innerdq)))
+    recover_close(ctx, '"');
+  if (syn->type == SYN_ARITH)
+    for (idx = 0; idx < syn->parenlevel + 2; idx++)
+      recover_close(ctx, ')');
+}
+
+/* Skip the source up to and including the next line that is the given end
+ * mark, with any leading tabs removed if they are to be stripped
+ */
+static void recover_skipdoc(struct parse_context *ctx,
+                            struct parse_heredoc *here)
+{
+  char chr;
+
+  do {
+    const char *ptr = here->eofmark;
+
+    chr = source_next_char(ctx);
+    if (here->striptabs)
+      while (chr == '\t')
+        chr = source_next_char(ctx);
+    for (; *ptr && chr == *ptr; ptr++)
+      chr = source_next_char(ctx);
+    if (!*ptr && (chr == '\n' || chr == PEOF))
+      return;
+    while (chr != '\n' && chr != PEOF)
+      chr = source_next_char(ctx);
+  } while (chr != PEOF);
+}
+
+/* Skip the bodies of the here documents that have not been read, one of
+ * which may have been read up to the error, and discard them
+ */
+void recover_heredoc(struct parse_context *ctx)
+{
+  struct parse_heredoc *here;
+  char chr;
+
+  STAILQ_FOREACH(here, ctx->lst_heredoc) {
+    if (here->ended)
+      continue;
+    if (here->started) {
+      while ((chr = source_next_char(ctx)) != '\n' && chr != PEOF);
+      if (chr == PEOF)
+        break;
+    }
+    if (here->eofmark && here->eofmark != FAKEEOFMARK)
+      recover_skipdoc(ctx, here);
+  }
+  stailq_clear(ctx->lst_heredoc);
+  ctx->recover->nclose = 0;
+  ctx->recover->resync = true;
+}
+
+/* Skip the source up to and including the next newline or semicolon that is
+ * neither quoted nor within what was left open by the error or opened since,
+ * only a newline being taken if here documents are to follow it
+ */
+static void recover_skip(struct parse_context *ctx)
+{
+  struct parse_recover *rec = ctx->recover;
+  bool heredoc = ctx->lst_heredoc && !stailq_empty(ctx->lst_heredoc);
+  char chr, top, prev = ' ';
+  size_t idx;
+
+  /* The innermost of what was left open is to be closed first */
+  for (idx = 0; idx < rec->nclose / 2; idx++) {
+    chr = rec->close[idx];
+    rec->close[idx] = rec->close[rec->nclose - idx - 1];
+    rec->close[rec->nclose - idx - 1] = chr;
+  }
+
+  while ((chr = source_next_char(ctx)) != PEOF) {
+    top = rec->nclose ? rec->close[rec->nclose - 1] : '\0';
+    if (top == '\'') {
+      if (chr == '\'')
+        rec->nclose--;
+    } else if (chr == '\\') {
+      if (source_next_char(ctx) == PEOF)
+        break;
+      chr = ' ';
+    } else if (chr == top && (top == '"' || top == '`' || top == ')' ||
+                              top == '}')) {
+      rec->nclose--;
+    } else if (chr == '`' || (chr == '"' && top != '"')) {
+      recover_close(ctx, chr);
+    } else if (chr == '(' && (prev == '$' || top != '"')) {
+      recover_close(ctx, ')');
+    } else if (chr == '{' && (prev == '$' || top != '"')) {
+      recover_close(ctx, '}');
+    } else if (top != '"') {
+      switch (chr) {
+      case '\'':
+        recover_close(ctx, chr);
+        break;
+
+      case '#':
+        if (prev == ' ' || prev == '\t' || prev == ';' || prev == '\n')
+          while ((chr = source_next_char(ctx)) != '\n' && chr != PEOF);
+        if (chr != '\n')
+          break;
+        /* FALLTHROUGH */
+
+      case '\n':
+      case ';':
+        if (!rec->nclose && (chr == '\n' || !heredoc))
+          goto done;
+        break;
+      }
+    }
+    prev = chr;
+  }
+done:
+  rec->nclose = 0;
+  if (heredoc && chr == '\n')
+    recover_heredoc(ctx);
+  else if (heredoc)
+    stailq_clear(ctx->lst_heredoc);
+}
+
+/* Describe the syntax error of the context in the given diagnostic */
+void recover_note(struct parse_context *ctx, struct parse_diag *diag)
+{
+  diag->code = ctx->synerror.code;
+  diag->expect = INV_PARSER_TOKEN;
+  if (ctx->synerror.code == SE_EXPECTED &&
+      (unsigned int)ctx->synerror.token.id < NUM_PARSER_TOKEN)
+    diag->expect = ctx->synerror.token.id;
+  diag->found = ctx->last_token.id;
+  diag->offset = ctx->last_token.offset;
+  if (!(diag->line = source_currline(ctx)) && ctx->int_error == IE_NOSOURCE)
+    ctx->int_error = IE_NONE;
+}
+
+/* Note the syntax error of the context and skip to where parsing can resume,
+ * returning the error node that stands for the command or NULL if there is
+ * no memory for it
+ */
+union parse_node *recover_error(struct parse_context *ctx)
+{
+  struct parse_recover *rec = ctx->recover;
+  struct parse_diag *diag;
+  union parse_node *n;
+  bool heredoc;
+
+  if (rec->ndiag == rec->maxdiag) {
+    size_t newmax = rec->maxdiag ? rec->maxdiag * 2 : 16;
+    struct parse_diag *newp = realloc(rec->diag, newmax * sizeof(struct parse_diag));
+    if (!newp) {
+      ctx->int_error = IE_NOMEMORY;
+      return NULL;
+    }
+    rec->diag = newp;
+    rec->maxdiag = newmax;
+  }
+  diag = &rec->diag[rec->ndiag];
+  recover_note(ctx, diag);
+
+  /* The text of the error is released along with anything allocated since */
+  clr_synerror(ctx);
+  n = obstack_alloc(&ctx->memstack, sizeof(struct parse_nerror));
+  n->type = NERROR;
+  n->nerror.linno = diag->line;
+  n->nerror.diag = rec->ndiag++;
+
+  /* The token that was found may already be where parsing can resume, unless
+   * it was found within something left open or here documents are to follow
+   * it, while the here documents may already have been skipped
+   */
+  heredoc = ctx->lst_heredoc && !stailq_empty(ctx->lst_heredoc);
+  if (rec->nclose || (!rec->resync && ctx->last_token.id != TNL &&
+                      (heredoc || (ctx->last_token.id != TSEMI &&
+                                   ctx->last_token.id != TEOF))))
+    recover_skip(ctx);
+  else if (heredoc)
+    recover_heredoc(ctx);
+  rec->resync = false;
+  return n;
+}
+
+/* Return the syntax errors noted, with their number stored in the given
+ * location
+ */
+const struct parse_diag *recover_diagnostics(struct parse_context *ctx,
+                                             size_t               *count)
+{
+  *count = ctx->recover ? ctx->recover->ndiag : 0;
+  return ctx->recover ? ctx->recover->diag : NULL;
+}
+
+/* Release the diagnostics of the context */
+void recover_free(struct parse_context *ctx)
+{
+  struct parse_recover *rec = ctx->recover;
+
+  if (rec) {
+    ctx->recover = NULL;
+    free(rec->close);
+    free(rec->diag);
+    free(rec);
+  }
+}
@@ -0,0 +1,259 @@
+/*
+ * This source provides the incremental tokenizing of a buffer that is being
+ * edited. The state of the tokenizer is noted at the start of each line that
+ * begins at a token boundary, so that after an edit tokenizing restarts from
+ * the last such line before the edit and stops at the first line after it
+ * where the state matches that of the previous run.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+/* Define the state of the tokenizer at the start of a line, lines that start
+ * within a token or here document are not noted as they cannot be restarted
+ */
+struct relex_line {
+  uint32_t      offset;               /* Offset of the start of the line */
+  uint32_t      token;                /* Index of the first token of the line */
+  unsigned char state;                /* Tokenizer state (parse_tokstate) */
+};
+
+struct parse_relex {
+  struct parse_context      *ctx;     /* Context used for tokenizing */
+  char                      *text;    /* Copy of the buffer */
+  size_t                     len;     /* Length of the buffer */
+  size_t                     alloc;   /* Size allocated for the buffer */
+  struct parse_token_stream  tokens;  /* Tokens of the whole buffer */
+  struct relex_line         *line;    /* Lines that tokenizing can start at */
+  size_t                     nline;   /* Number of lines noted */
+  size_t                     maxline; /* Number of lines allocated */
+  size_t                     lexed;   /* Bytes tokenized by the last update */
+  bool                       valid;   /* Set if the whole buffer tokenized */
+};
+
+/* Add a line to the list of lines */
+static bool relex_addline(struct relex_line **line,
+                          size_t             *nline,
+                          size_t             *maxline,
+                          size_t              offset,
+                          size_t              token,
+                          unsigned char       state)
+{
+  if (*nline == *maxline) {
+    size_t newmax = *maxline ? *maxline * 2 : 256;
+    struct relex_line *newp = realloc(*line, newmax * sizeof(struct relex_line));
+    if (!newp) return false;
+    *line = newp;
+    *maxline = newmax;
+  }
+  (*line)[*nline].offset = offset;
+  (*line)[*nline].token = token;
+  (*line)[*nline].state = state;
+  (*nline)++;
+  return true;
+}
+
+/* Return the index of the last line starting at or before the offset */
+static size_t relex_findline(struct parse_relex *rl, size_t offset)
+{
+  size_t low = 0, high = rl->nline;
+
+  while (high - low > 1) {
+    size_t mid = low + (high - low) / 2;
+    if (rl->line[mid].offset <= offset)
+      low = mid;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/* Tokenize from the given line, which must be before the edit, until the
+ * state converges with that of the previous run beyond the end of the edit.
+ * The end of the edit and the change in length are given in terms of the new
+ * text, the lines and tokens from the previous run are updated in place.
+ */
+static bool relex_from(struct parse_relex *rl,
+                       size_t              first,
+                       size_t              editend,
+                       ptrdiff_t           delta)
+{
+  struct parse_token_stream scratch;
+  struct relex_line *line = NULL;
+  size_t nline = 0, maxline = 0;
+  size_t base = rl->line[first].offset, old = first + 1, last, idx;
+  unsigned char state = rl->line[first].state;
+  struct parse_memory mem = { rl->text + base, rl->len - base };
+  enum parse_tokid tokid;
+  bool ok = false, converged = false;
+
+  memset(&scratch, 0, sizeof(struct parse_token_stream));
+  if (!ctx_init(&rl->ctx) || !push_source(rl->ctx, SRC_MEMORY, &mem))
+    return false;
+  while ((tokid = tokenize_next(rl->ctx, &scratch, &state)) != TEOF) {
+    size_t offset;
+
+    if (tokid == INV_PARSER_TOKEN)
+      break;
+    if (tokid != TNL)
+      continue;
+
+    /* A here document that runs to the end of the buffer would continue
+     * into anything added there, so that is not a line that can be started
+     * at, nor one that the previous run can be converged with
+     */
+    offset = base + source_curroff(rl->ctx);
+    if (offset == rl->len &&
+        base + scratch.start[scratch.count - 1] + 1 != offset)
+      continue;
+
+    /* Check if the start of the next line was seen by the previous run, and
+     * in the same state, once beyond the end of the edit
+     */
+    while (old < rl->nline && (ptrdiff_t)rl->line[old].offset + delta < (ptrdiff_t)offset)
+      old++;
+    if (offset >= editend && old < rl->nline &&
+        (ptrdiff_t)rl->line[old].offset + delta == (ptrdiff_t)offset &&
+        rl->line[old].state == state) {
+      converged = true;
+      break;
+    }
+    if (!relex_addline(&line, &nline, &maxline, offset,
+                       rl->line[first].token + scratch.count, state))
+      goto done;
+  }
+  /* On converging the rest of the previous run is kept, including whether
+   * it reached the end
+   */
+  if (!converged)
+    rl->valid = tokid == TEOF;
+  rl->lexed = converged ? rl->line[old].offset + delta - base : rl->len - base;
+
+  /* The tokens were found relative to the line tokenizing started at */
+  for (idx = 0; idx < scratch.count; idx++)
+    scratch.start[idx] += base;
+
+  /* Replace the tokens and lines between the line started at and the line
+   * converged at, moving those that follow by the changes in length
+   */
+  last = converged ? old : rl->nline;
+  if (!token_stream_splice(&rl->tokens, rl->line[first].token,
+                           converged ? rl->line[old].token : rl->tokens.count,
+                           &scratch))
+    goto done;
+  if (converged) {
+    ptrdiff_t tokdelta = (ptrdiff_t)(rl->line[first].token + scratch.count) -
+                         (ptrdiff_t)rl->line[old].token;
+
+    for (idx = rl->line[first].token + scratch.count;
+         idx < rl->tokens.count; idx++)
+      rl->tokens.start[idx] += delta;
+    for (idx = old; idx < rl->nline; idx++) {
+      rl->line[idx].offset += delta;
+      rl->line[idx].token += tokdelta;
+    }
+  }
+  if (rl->nline - last + first + 1 + nline > rl->maxline) {
+    size_t newmax = rl->nline - last + first + 1 + nline;
+    struct relex_line *newp = realloc(rl->line, newmax * sizeof(struct relex_line));
+    if (!newp) goto done;
+    rl->line = newp;
+    rl->maxline = newmax;
+  }
+  memmove(rl->line + first + 1 + nline, rl->line + last,
+          (rl->nline - last) * sizeof(struct relex_line));
+  if (nline)
+    memcpy(rl->line + first + 1, line, nline * sizeof(struct relex_line));
+  rl->nline = first + 1 + nline + (rl->nline - last);
+  ok = true;
+done:
+  free(line);
+  token_stream_free(&scratch);
+  return ok;
+}
+
+/* Create the tokens of the given buffer */
+bool relex_new(struct parse_relex **rlp, const char *text, size_t len)
+{
+  struct parse_relex *rl;
+
+  if (!(rl = calloc(1, sizeof(struct parse_relex))))
+    return false;
+  rl->alloc = len + 1;
+  if (!text || !(rl->text = malloc(rl->alloc)) ||
+      !relex_addline(&rl->line, &rl->nline, &rl->maxline, 0, 0,
+                     TS_NONE | TS_CHKKWD)) {
+    relex_free(&rl);
+    return false;
+  }
+  memcpy(rl->text, text, len);
+  rl->text[len] = '\0';
+  rl->len = len;
+  *rlp = rl;
+  return relex_from(rl, 0, 0, 0);
+}
+
+/* Replace part of the buffer and update the tokens */
+bool relex_edit(struct parse_relex *rl,
+                size_t              offset,
+                size_t              dellen,
+                const char         *ins,
+                size_t              inslen)
+{
+  size_t len;
+
+  if (offset > rl->len || dellen > rl->len - offset || (inslen && !ins))
+    return false;
+  len = rl->len - dellen + inslen;
+  if (len + 1 > rl->alloc) {
+    size_t newalloc = rl->alloc * 2 > len + 1 ? rl->alloc * 2 : len + 1;
+    char *newp = realloc(rl->text, newalloc);
+    if (!newp) return false;
+    rl->text = newp;
+    rl->alloc = newalloc;
+  }
+  memmove(rl->text + offset + inslen, rl->text + offset + dellen,
+          rl->len - offset - dellen + 1);
+  if (inslen)
+    memcpy(rl->text + offset, ins, inslen);
+  rl->len = len;
+  return relex_from(rl, relex_findline(rl, offset), offset + inslen,
+                    (ptrdiff_t)inslen - (ptrdiff_t)dellen);
+}
+
+/* Return the tokens of the whole buffer */
+const struct parse_token_stream *relex_tokens(struct parse_relex *rl)
+{
+  return &rl->tokens;
+}
+
+/* Return true if the whole buffer could be tokenized, otherwise the tokens
+ * stop where tokenizing failed
+ */
+bool relex_complete(struct parse_relex *rl)
+{
+  return rl->valid;
+}
+
+/* Return the number of bytes tokenized by the last update */
+size_t relex_lexed(struct parse_relex *rl)
+{
+  return rl->lexed;
+}
+
+/* Release everything associated with the buffer */
+void relex_free(struct parse_relex **rlp)
+{
+  struct parse_relex *rl = *rlp;
+
+  if (rl) {
+    *rlp = NULL;
+    ctx_fini(&rl->ctx);
+    token_stream_free(&rl->tokens);
+    free(rl->line);
+    free(rl->text);
+    free(rl);
+  }
+}
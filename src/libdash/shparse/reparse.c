@@ -0,0 +1,441 @@
+/*
+ * This source provides the incremental parsing of a script that is being
+ * edited. The offset and line just beyond each top-level command are noted,
+ * so that after an edit parsing restarts from the end of the last command
+ * before the edit and stops at the first command after it whose end agrees
+ * with that of a command from the previous parse. The commands beyond it are
+ * kept as they were, with their line numbers moved by the lines added or
+ * removed, while the commands parsed again replace those between.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+#define REPARSE_NOEND ((size_t)-1)     /* Command whose end can't be agreed */
+#define REPARSE_MAXCTX 64              /* Contexts kept before parsing it all */
+
+/* Define where a command ends and the context holding its nodes */
+struct reparse_cmd {
+  size_t        end;                  /* Offset just beyond the command */
+  unsigned int  line;                 /* Line just beyond the command */
+  unsigned int  ctx;                  /* Index of the context holding it */
+};
+
+struct parse_reparse {
+  struct parse_context      *tmpl;    /* Context giving the settings to use */
+  char                      *text;    /* Copy of the buffer */
+  size_t                     len;     /* Length of the buffer */
+  size_t                     alloc;   /* Size allocated for the buffer */
+  struct parse_command_set   set;     /* Commands of the whole buffer */
+  struct reparse_cmd        *info;    /* Where each of the commands ends */
+  size_t                     maxcmd;  /* Number of commands allocated */
+  size_t                     parsed;  /* Bytes parsed by the last update */
+};
+
+/* Make room for the given number of commands */
+static bool reparse_reserve(union parse_node   ***cmd,
+                            struct reparse_cmd  **info,
+                            size_t               *maxcmd,
+                            size_t                count)
+{
+  size_t newmax;
+  union parse_node **newcmd;
+  struct reparse_cmd *newinfo;
+
+  if (count <= *maxcmd)
+    return true;
+  newmax = *maxcmd ? *maxcmd * 2 : 256;
+  if (newmax < count)
+    newmax = count;
+  if (!(newcmd = realloc(*cmd, newmax * sizeof(union parse_node *))))
+    return false;
+  *cmd = newcmd;
+  if (!(newinfo = realloc(*info, newmax * sizeof(struct reparse_cmd))))
+    return false;
+  *info = newinfo;
+  *maxcmd = newmax;
+  return true;
+}
+
+/* Move the line numbers of the nodes of a command by the given amount */
+static bool reparse_shift(union parse_node *cmd, int delta)
+{
+  union parse_node **stack, **newp, *n;
+  size_t depth = 0, maxdepth = 64, idx;
+  struct parse_nodelist *lp;
+
+#define PUSH(node)                                                             \
+  do {                                                                         \
+    if ((node)) {                                                              \
+      if (depth == maxdepth) {                                                 \
+        if (!(newp = realloc(stack, maxdepth * 2 * sizeof(union parse_node *)))) \
+          goto fail;                                                           \
+        stack = newp;                                                          \
+        maxdepth *= 2;                                                         \
+      }                                                                        \
+      stack[depth++] = (node);                                                 \
+    }                                                                          \
+  } while (0)
+
+  if (!(stack = malloc(maxdepth * sizeof(union parse_node *))))
+    return false;
+  PUSH(cmd);
+  while (depth) {
+    n = stack[--depth];
+    switch (n->type) {
+    case NCMD:
+      n->ncmd.linno += delta;
+      PUSH(n->ncmd.assign);
+      PUSH(n->ncmd.args);
+      PUSH(n->ncmd.redirect);
+      break;
+
+    case NPIPE:
+      for (lp = n->npipe.cmdlist; lp; lp = lp->next)
+        PUSH(lp->node);
+      break;
+
+    case NREDIR:
+    case NBACKGND:
+    case NSUBSHELL:
+      n->nredir.linno += delta;
+      PUSH(n->nredir.node);
+      PUSH(n->nredir.redirect);
+      break;
+
+    case NAND:
+    case NOR:
+    case NSEMI:
+    case NWHILE:
+    case NUNTIL:
+      PUSH(n->nbinary.ch1);
+      PUSH(n->nbinary.ch2);
+      break;
+
+    case NIF:
+      PUSH(n->nif.test);
+      PUSH(n->nif.ifpart);
+      PUSH(n->nif.elsepart);
+      break;
+
+    case NFOR:
+      n->nfor.linno += delta;
+      PUSH(n->nfor.args);
+      PUSH(n->nfor.body);
+      break;
+
+    case NCASE:
+      n->ncase.linno += delta;
+      PUSH(n->ncase.expr);
+      PUSH(n->ncase.cases);
+      break;
+
+    case NCLIST:
+      PUSH(n->nclist.next);
+      PUSH(n->nclist.pattern);
+      PUSH(n->nclist.body);
+      break;
+
+    case NDEFUN:
+      n->ndefun.linno += delta;
+      PUSH(n->ndefun.body);
+      break;
+
+    case NARG:
+      PUSH(n->narg.next);
+      for (lp = n->narg.backquote; lp; lp = lp->next)
+        PUSH(lp->node);
+      break;
+
+    case NTO:
+    case NCLOBBER:
+    case NFROM:
+    case NFROMTO:
+    case NAPPEND:
+      PUSH(n->nfile.next);
+      PUSH(n->nfile.fname);
+      break;
+
+    case NTOFD:
+    case NFROMFD:
+      PUSH(n->ndup.next);
+      PUSH(n->ndup.vname);
+      break;
+
+    case NHERE:
+    case NXHERE:
+      PUSH(n->nhere.next);
+      PUSH(n->nhere.doc);
+      break;
+
+    case NNOT:
+      PUSH(n->nnot.com);
+      break;
+
+    case NERROR:
+      n->nerror.linno += delta;
+      break;
+
+    case NSEQ:
+    case NANDOR:
+    case NPIPELINE:
+      for (idx = 0; idx < n->nseq.count; idx++)
+        PUSH(n->nseq.child[idx]);
+      break;
+
+    case NIFCHAIN:
+      for (idx = 0; idx < n->nifchain.count * 2; idx++)
+        PUSH(n->nifchain.child[idx]);
+      PUSH(n->nifchain.elsepart);
+      break;
+
+    default:
+      break;
+    }
+  }
+#undef PUSH
+  free(stack);
+  return true;
+fail:
+  free(stack);
+  return false;
+}
+
+/* Release the contexts that no longer hold any of the commands, other than
+ * the one holding the syntax error
+ */
+static void reparse_compact(struct parse_reparse *rp)
+{
+  struct parse_command_set *set = &rp->set;
+  unsigned int *map;
+  size_t idx, count;
+
+  if (!(map = calloc(set->nctx, sizeof(unsigned int))))
+    return;
+  for (idx = 0; idx < set->count; idx++)
+    map[rp->info[idx].ctx] = 1;
+  for (idx = 0, count = 0; idx < set->nctx; idx++) {
+    if (map[idx] || set->ctx[idx] == set->error) {
+      map[idx] = count;
+      set->ctx[count++] = set->ctx[idx];
+    } else {
+      ctx_fini(&set->ctx[idx]);
+    }
+  }
+  set->nctx = count;
+  for (idx = 0; idx < set->count; idx++)
+    rp->info[idx].ctx = map[rp->info[idx].ctx];
+  free(map);
+}
+
+/* Parse from the end of the given number of commands, which are all before
+ * the edit, until a command ends where one from the previous parse did once
+ * beyond the end of the edit. The end of the edit and the change in length
+ * are given in terms of the new text, the commands from the previous parse
+ * are updated in place.
+ */
+static bool reparse_from(struct parse_reparse *rp,
+                         size_t                keep,
+                         size_t                editend,
+                         ptrdiff_t             delta)
+{
+  struct parse_command_set *set = &rp->set;
+  struct parse_context *ctx = NULL, **newctx;
+  union parse_node **cmd = NULL, *n;
+  struct reparse_cmd *info = NULL;
+  size_t ncmd = 0, maxcmd = 0, old = keep, last, idx;
+  size_t base = keep ? rp->info[keep - 1].end : 0;
+  unsigned int line = keep ? rp->info[keep - 1].line : 1;
+  struct parse_memory mem = { rp->text + base, rp->len - base };
+  bool ok = false, converged = false;
+
+  if (!(newctx = realloc(set->ctx,
+                         (set->nctx + 1) * sizeof(struct parse_context *))))
+    return false;
+  set->ctx = newctx;
+  if (!ctx_init(&ctx))
+    return false;
+  set->ctx[set->nctx++] = ctx;
+  if (!ctx_inherit(ctx, rp->tmpl) || !push_source(ctx, SRC_MEMORY, &mem))
+    goto done;
+  source_setline(ctx, line);
+
+  while ((n = ctx_next_command(ctx)) && n->type != NEOF) {
+    size_t end = REPARSE_NOEND;
+
+    if (!reparse_reserve(&cmd, &info, &maxcmd, ncmd + 1))
+      goto done;
+    cmd[ncmd] = n;
+    info[ncmd].ctx = set->nctx - 1;
+
+    /* The end of a command is only known within the buffer when the text of
+     * an alias is not being read
+     */
+    if (!alias_active(ctx)) {
+      end = base + source_curroff(ctx);
+      line = source_currline(ctx);
+    }
+    info[ncmd].end = end;
+    info[ncmd++].line = line;
+
+    /* Check if the end of the command was seen by the previous parse once
+     * beyond the end of the edit
+     */
+    if (end == REPARSE_NOEND || end < editend)
+      continue;
+    while (old < set->count && (rp->info[old].end == REPARSE_NOEND ||
+           (ptrdiff_t)rp->info[old].end + delta < (ptrdiff_t)end))
+      old++;
+    if (old < set->count && (ptrdiff_t)rp->info[old].end + delta == (ptrdiff_t)end) {
+      converged = true;
+      break;
+    }
+  }
+  if (ctx->int_error == IE_NOMEMORY)
+    goto done;
+  rp->parsed = (converged ? info[ncmd - 1].end : rp->len) - base;
+
+  /* On converging the rest of the previous parse is kept, including the
+   * error that stopped it, with its offsets and lines moved by the change
+   */
+  last = converged ? old + 1 : set->count;
+  if (!converged)
+    set->error = ctx->synerror.code != SE_NONE ? ctx : NULL;
+
+  /* Replace the commands between the one started after and the one
+   * converged at
+   */
+  if (!reparse_reserve(&set->cmd, &rp->info, &rp->maxcmd,
+                       set->count - last + keep + ncmd))
+    goto done;
+  if (converged) {
+    int linedelta = (int)line - (int)rp->info[old].line;
+
+    for (idx = last; idx < set->count; idx++) {
+      if (rp->info[idx].end != REPARSE_NOEND)
+        rp->info[idx].end += delta;
+      rp->info[idx].line += linedelta;
+      if (linedelta && !reparse_shift(set->cmd[idx], linedelta))
+        goto done;
+    }
+  }
+  memmove(set->cmd + keep + ncmd, set->cmd + last,
+          (set->count - last) * sizeof(union parse_node *));
+  memmove(rp->info + keep + ncmd, rp->info + last,
+          (set->count - last) * sizeof(struct reparse_cmd));
+  if (ncmd) {
+    memcpy(set->cmd + keep, cmd, ncmd * sizeof(union parse_node *));
+    memcpy(rp->info + keep, info, ncmd * sizeof(struct reparse_cmd));
+  }
+  set->count = keep + ncmd + (set->count - last);
+  reparse_compact(rp);
+  ok = true;
+done:
+  free(cmd);
+  free(info);
+  return ok;
+}
+
+/* Return the number of commands that end before the given offset and after
+ * which parsing can restart
+ */
+static size_t reparse_findcmd(struct parse_reparse *rp, size_t offset)
+{
+  size_t idx, keep = 0;
+
+  for (idx = 0; idx < rp->set.count; idx++) {
+    if (rp->info[idx].end == REPARSE_NOEND)
+      continue;
+    if (rp->info[idx].end >= offset)
+      break;
+    keep = idx + 1;
+  }
+  return keep;
+}
+
+/* Parse the given buffer, with the settings and aliases of the given context
+ * if there is one, which must remain until the buffer is released
+ */
+bool reparse_new(struct parse_reparse **rpp,
+                 struct parse_context  *tmpl,
+                 const char            *text,
+                 size_t                 len)
+{
+  struct parse_reparse *rp;
+
+  if (!(rp = calloc(1, sizeof(struct parse_reparse))))
+    return false;
+  rp->tmpl = tmpl;
+  rp->alloc = len + 1;
+  if (!text || !(rp->text = malloc(rp->alloc))) {
+    reparse_free(&rp);
+    return false;
+  }
+  memcpy(rp->text, text, len);
+  rp->text[len] = '\0';
+  rp->len = len;
+  *rpp = rp;
+  return reparse_from(rp, 0, 0, 0);
+}
+
+/* Replace part of the buffer and update the commands */
+bool reparse_edit(struct parse_reparse *rp,
+                  size_t                offset,
+                  size_t                dellen,
+                  const char           *ins,
+                  size_t                inslen)
+{
+  size_t len;
+
+  if (offset > rp->len || dellen > rp->len - offset || (inslen && !ins))
+    return false;
+  len = rp->len - dellen + inslen;
+  if (len + 1 > rp->alloc) {
+    size_t newalloc = rp->alloc * 2 > len + 1 ? rp->alloc * 2 : len + 1;
+    char *newp = realloc(rp->text, newalloc);
+    if (!newp) return false;
+    rp->text = newp;
+    rp->alloc = newalloc;
+  }
+  memmove(rp->text + offset + inslen, rp->text + offset + dellen,
+          rp->len - offset - dellen + 1);
+  if (inslen)
+    memcpy(rp->text + offset, ins, inslen);
+  rp->len = len;
+
+  /* The nodes of the commands replaced are only released with the context
+   * holding them, so once too many are held the whole buffer is parsed again
+   */
+  if (rp->set.nctx >= REPARSE_MAXCTX)
+    return reparse_from(rp, 0, len, (ptrdiff_t)inslen - (ptrdiff_t)dellen);
+  return reparse_from(rp, reparse_findcmd(rp, offset), offset + inslen,
+                      (ptrdiff_t)inslen - (ptrdiff_t)dellen);
+}
+
+/* Return the commands of the whole buffer */
+const struct parse_command_set *reparse_commands(struct parse_reparse *rp)
+{
+  return &rp->set;
+}
+
+/* Return the number of bytes parsed by the last update */
+size_t reparse_parsed(struct parse_reparse *rp)
+{
+  return rp->parsed;
+}
+
+/* Release everything associated with the buffer */
+void reparse_free(struct parse_reparse **rpp)
+{
+  struct parse_reparse *rp = *rpp;
+
+  if (rp) {
+    *rpp = NULL;
+    parallel_free(&rp->set);
+    free(rp->info);
+    free(rp->text);
+    free(rp);
+  }
+}
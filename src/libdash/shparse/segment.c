@@ -0,0 +1,234 @@
+/*
+ * This source provides the segment tables of words, which describe where the
+ * literal text and each expansion lie within the text of a word so that the
+ * expansions can be found without scanning for the control characters. The
+ * tokenizer notes each expansion as it adds the control characters, and the
+ * table is completed with the literal parts when the word node is created.
+ */
+
+#include <obstack.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+/* Define the segments noted for the current word, along with those that are
+ * still open as their end has not been reached
+ */
+struct parse_segbuf {
+  struct parse_segment *seg;          /* Expansions in order of their start */
+  size_t                nseg;         /* Number of expansions noted */
+  size_t                maxseg;       /* Number of expansions allocated */
+  uint32_t             *open;         /* Indexes of the open expansions */
+  size_t                nopen;        /* Number of open expansions */
+  size_t                maxopen;      /* Number of open expansions allocated */
+  uint32_t              narith;       /* Arithmetic expansions in the word */
+  uint32_t              nbackq;       /* Command substitutions in the word */
+};
+
+/* Return the segment buffer of the context, creating it if needed */
+static struct parse_segbuf *seg_buffer(struct parse_context *ctx)
+{
+  if (!ctx->segbuf && !(ctx->segbuf = calloc(1, sizeof(struct parse_segbuf))))
+    ctx->int_error = IE_NOMEMORY;
+  return ctx->segbuf;
+}
+
+/* Start noting the segments of a new word */
+void seg_reset(struct parse_context *ctx)
+{
+  struct parse_segbuf *buf = ctx->segbuf;
+
+  if (buf) {
+    buf->nseg = 0;
+    buf->nopen = 0;
+    buf->narith = 0;
+    buf->nbackq = 0;
+  }
+}
+
+/* Note the start of an expansion at the given offset of the word, returning
+ * the segment which is open if its end is still to be seen
+ */
+struct parse_segment *seg_begin(struct parse_context *ctx,
+                                enum parse_segkind    kind,
+                                size_t                offset,
+                                bool                  open)
+{
+  struct parse_segbuf *buf;
+  struct parse_segment *seg;
+
+  if (!(buf = seg_buffer(ctx)))
+    return NULL;
+  if (buf->nseg == buf->maxseg) {
+    size_t newmax = buf->maxseg ? buf->maxseg * 2 : 16;
+    struct parse_segment *newp = realloc(buf->seg,
+        newmax * sizeof(struct parse_segment));
+    if (!newp) {
+      ctx->int_error = IE_NOMEMORY;
+      return NULL;
+    }
+    buf->seg = newp;
+    buf->maxseg = newmax;
+  }
+  if (open && buf->nopen == buf->maxopen) {
+    size_t newmax = buf->maxopen ? buf->maxopen * 2 : 8;
+    uint32_t *newp = realloc(buf->open, newmax * sizeof(uint32_t));
+    if (!newp) {
+      ctx->int_error = IE_NOMEMORY;
+      return NULL;
+    }
+    buf->open = newp;
+    buf->maxopen = newmax;
+  }
+  seg = &buf->seg[buf->nseg];
+  seg->offset = offset;
+  seg->length = 0;
+  seg->kind = kind;
+  seg->subtype = VSNONE;
+  seg->nest = buf->nopen;
+  seg->index = 0;
+  seg->name = NULL;
+  if (kind == SEG_ARITH)
+    seg->index = buf->narith++;
+  else if (kind == SEG_BACKQ)
+    seg->index = buf->nbackq++;
+  if (open)
+    buf->open[buf->nopen++] = buf->nseg;
+  buf->nseg++;
+  return seg;
+}
+
+/* Note the end of the innermost open expansion, the offset being that just
+ * beyond its last character
+ */
+void seg_end(struct parse_context *ctx, size_t offset)
+{
+  struct parse_segbuf *buf = ctx->segbuf;
+
+  if (buf && buf->nopen) {
+    struct parse_segment *seg = &buf->seg[buf->open[--buf->nopen]];
+    seg->length = offset - seg->offset;
+  }
+}
+
+/* Note a parameter expansion whose control character is at the given offset
+ * and whose type byte and name are followed by the end of the word
+ */
+void seg_var(struct parse_context *ctx,
+             const char           *text,
+             size_t                offset,
+             size_t                len)
+{
+  char subtype = text[offset + 1] & (VSTYPE | VSNUL);
+  struct parse_segment *seg;
+
+  if ((seg = seg_begin(ctx, SEG_VAR, offset, (subtype & VSTYPE) != VSNORMAL))) {
+    seg->subtype = subtype;
+    seg->name = intern_string(ctx, text + offset + 2, len - offset - 3);
+    if ((subtype & VSTYPE) == VSNORMAL)
+      seg->length = len - offset;
+  }
+}
+
+/* Note the segments of a word that was not read by the tokenizer, such as
+ * those replayed from an alias, from the control characters of its text
+ */
+void seg_scan(struct parse_context *ctx, const char *text, size_t len)
+{
+  size_t pos;
+
+  seg_reset(ctx);
+  for (pos = 0; pos < len; pos++) {
+    switch (text[pos]) {
+    case CTLESC:
+      pos++;
+      break;
+
+    case CTLVAR: {
+      const char *eq = memchr(text + pos, '=', len - pos);
+      if (!eq)
+        return;
+      seg_var(ctx, text, pos, eq - text + 1);
+      pos = eq - text;
+      break;
+    }
+
+    case CTLARI:
+      seg_begin(ctx, SEG_ARITH, pos, true);
+      break;
+
+    case CTLBACKQ:
+      if (seg_begin(ctx, SEG_BACKQ, pos, false))
+        ctx->segbuf->seg[ctx->segbuf->nseg - 1].length = 1;
+      break;
+
+    case CTLENDVAR:
+    case CTLENDARI:
+      seg_end(ctx, pos + 1);
+      break;
+    }
+  }
+}
+
+/* Return the segments of the word of the given length, the literal parts
+ * between the outermost expansions being added, with the number of segments
+ * stored in the given location
+ */
+struct parse_segment *seg_copy(struct parse_context *ctx,
+                               size_t                len,
+                               uint32_t             *nseg)
+{
+  struct parse_segbuf *buf = ctx->segbuf;
+  struct parse_segment *seg, *dst;
+  size_t count = 0, idx, pos = 0;
+
+  /* Count the literal parts to know the size of the table */
+  for (idx = 0; buf && idx < buf->nseg; idx++) {
+    if (buf->seg[idx].nest)
+      continue;
+    if (buf->seg[idx].offset > pos)
+      count++;
+    pos = buf->seg[idx].offset + buf->seg[idx].length;
+  }
+  if (len > pos)
+    count++;
+  count += buf ? buf->nseg : 0;
+  *nseg = count;
+  if (!count)
+    return NULL;
+
+  dst = seg = obstack_alloc(&ctx->memstack, count * sizeof(struct parse_segment));
+  for (idx = 0, pos = 0; buf && idx < buf->nseg; idx++) {
+    if (!buf->seg[idx].nest) {
+      if (buf->seg[idx].offset > pos) {
+        memset(dst, 0, sizeof(struct parse_segment));
+        dst->kind = SEG_LITERAL;
+        dst->offset = pos;
+        dst->length = buf->seg[idx].offset - pos;
+        dst++;
+      }
+      pos = buf->seg[idx].offset + buf->seg[idx].length;
+    }
+    *dst++ = buf->seg[idx];
+  }
+  if (len > pos) {
+    memset(dst, 0, sizeof(struct parse_segment));
+    dst->kind = SEG_LITERAL;
+    dst->offset = pos;
+    dst->length = len - pos;
+  }
+  return seg;
+}
+
+/* Release the segment buffer of the context */
+void seg_free(struct parse_context *ctx)
+{
+  struct parse_segbuf *buf = ctx->segbuf;
+
+  if (buf) {
+    ctx->segbuf = NULL;
+    free(buf->seg);
+    free(buf->open);
+    free(buf);
+  }
+}
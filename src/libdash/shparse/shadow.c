@@ -0,0 +1,150 @@
+/*
+ * This source provides the checking of the tokenizer against its reference
+ * paths. A sample of the tokens read from a source held in memory are read
+ * again by a separate context that has the reference paths enabled, and the
+ * two tokens compared, so that faster paths can be checked against real
+ * scripts before they are relied upon.
+ */
+
+#include <obstack.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+#if SHADOW_LEXER
+struct parse_shadow {
+  struct parse_context        *ref;     /* Context using the reference paths */
+  unsigned int                 rate;    /* Compare one token in this many */
+  unsigned int                 count;   /* Tokens until the next comparison */
+  const char                  *text;    /* Text of the source being sampled */
+  size_t                       len;     /* Length of the text */
+  bool                         sample;  /* Set if the current token is sampled */
+  struct parse_shadow_report   report;  /* Results of the comparisons */
+};
+
+/* Set how often tokens are compared, zero stopping the comparisons */
+bool shadow_set(struct parse_context *ctx, unsigned int rate)
+{
+  struct parse_shadow *sh = ctx->shadow;
+
+  if (!rate) {
+    shadow_free(ctx);
+    return true;
+  }
+  if (!sh) {
+    if (!(sh = calloc(1, sizeof(struct parse_shadow))))
+      return false;
+    ctx->shadow = sh;
+  }
+  sh->rate = rate;
+  sh->count = 0;
+  return true;
+}
+
+/* Decide whether the token about to be read is to be compared, noting the
+ * text of the source it will be read from
+ */
+void shadow_sample(struct parse_context *ctx)
+{
+  struct parse_shadow *sh = ctx->shadow;
+
+  sh->sample = false;
+  if (sh->count--)
+    return;
+  sh->count = sh->rate - 1;
+  sh->sample = source_text(ctx, &sh->text, &sh->len);
+}
+
+/* Read the token again using the reference paths and compare the two, the
+ * first difference being kept in the report
+ */
+void shadow_check(struct parse_context *ctx, struct parse_token *tok)
+{
+  struct parse_shadow *sh = ctx->shadow;
+  struct parse_shadow_report *rep = &sh->report;
+  struct parse_memory mem;
+  struct parse_token ref;
+  const char *text;
+  size_t len;
+  bool same;
+
+  /* Only tokens wholly within the text noted are compared */
+  if (!sh->sample || ctx->synerror.code != SE_NONE ||
+      !source_text(ctx, &text, &len) || text != sh->text ||
+      tok->offset + tok->length > len)
+    return;
+  mem.text = text + tok->offset;
+  mem.len = len - tok->offset;
+  if (!ctx_init(&sh->ref) || !push_source(sh->ref, SRC_MEMORY, &mem))
+    return;
+  sh->ref->reference = true;
+  sh->ref->chkflags.chkeofmark = ctx->chkflags.chkeofmark;
+  if (!int_readtoken(sh->ref, &ref))
+    ref.id = INV_PARSER_TOKEN;
+
+  rep->compared++;
+  same = ref.id == tok->id && ref.length == tok->length;
+  if (same && tok->id == TWORD)
+    same = ref.flags == tok->flags &&
+           token_length(ref) == token_length((*tok)) &&
+           !memcmp(token_text(ref), token_text((*tok)), token_length(ref));
+  else if (same && tok->id == TREDIR)
+    same = sh->ref->cur_redir.type == ctx->cur_redir.type &&
+           sh->ref->cur_redir.nfile.fd == ctx->cur_redir.nfile.fd;
+  if (same)
+    return;
+
+  /* Note where the first difference was found */
+  if (!rep->diverged++) {
+    size_t idx = 0;
+
+    if (ref.id == TWORD && tok->id == TWORD)
+      while (idx < token_length(ref) && idx < token_length((*tok)) &&
+             token_text(ref)[idx] == token_text((*tok))[idx])
+        idx++;
+    rep->offset = tok->offset;
+    rep->textoff = idx;
+    rep->id = tok->id;
+    rep->refid = ref.id;
+  }
+#if SHPARSE_DEBUG > 0
+  fprintf(stderr, "SHADOW: token %d at offset %zu differs from reference %d\n",
+          tok->id, tok->offset, ref.id);
+#endif
+}
+
+/* Return the results of the comparisons */
+bool shadow_report(struct parse_context *ctx, struct parse_shadow_report *rep)
+{
+  if (!ctx->shadow)
+    return false;
+  *rep = ctx->shadow->report;
+  return true;
+}
+
+/* Release the shadow state of the context */
+void shadow_free(struct parse_context *ctx)
+{
+  struct parse_shadow *sh = ctx->shadow;
+
+  if (sh) {
+    ctx->shadow = NULL;
+    ctx_fini(&sh->ref);
+    free(sh);
+  }
+}
+#else
+bool shadow_set(struct parse_context *ctx, unsigned int rate)
+{
+  return false;
+}
+
+bool shadow_report(struct parse_context *ctx, struct parse_shadow_report *rep)
+{
+  return false;
+}
+
+void shadow_free(struct parse_context *ctx)
+{
+}
+#endif
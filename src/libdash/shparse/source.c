@@ -5,9 +5,13 @@
 
 #include <obstack.h>
 #include <stdlib.h>
-#include <sys/types.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "parser.h"
 #include "queue.h"
 
@@ -23,8 +27,7 @@ struct parse_source_cont;
 struct parse_source_ops {
   enum srcflag (*init)(struct parse_source_cont *, struct parse_source *);
   enum srcflag (*fini)(struct parse_source_cont *, struct parse_source *);
-  enum srcflag (*read_char)(struct parse_source *, char *);
-  enum srcflag (*unget_char)(struct parse_source *, char);
+  enum srcflag (*fill)(struct parse_source *);
   enum srcflag (*tell)(struct parse_source *, off_t *);
   enum srcflag (*seek)(struct parse_source *, off_t);
   enum srcflag (*open)(struct parse_source *, void const *);
@@ -39,17 +42,37 @@ struct _source_ungot {
   size_t                 curpos;           /* Length of ungot data */
 };
 
+/* Size of each block read from a file source */
+#define SRC_BLKSIZE 4096
+
+/* Provide the block of data currently available to the tokenizer, the
+ * positions of every backslash-newline pair within the block are found when
+ * the block is filled so that logical characters can be read without having
+ * to peek at the following character.
+ */
+struct _source_block {
+  const char            *buf;              /* Start of the buffered data */
+  size_t                 len;              /* Amount of data in the buffer */
+  size_t                 pos;              /* Current position within buffer */
+  size_t                *splice;           /* Offsets of backslash-newlines */
+  size_t                 nsplice;          /* Number of splices in block */
+  size_t                 cursplice;        /* First splice at or after pos */
+  size_t                 maxsplice;        /* Allocated size of splice list */
+};
+
 struct parse_source {
   struct parse_source     *next;             /* Previous source in list */
   struct parse_source_ops *ops;              /* Related operations */
-  struct _source_ungot     ungot;            /* Ungot data for source */
+  struct _source_block     block;            /* Currently buffered data */
   struct _source_data {
     void const            *data;             /* Underlying data */
-    off_t                  baseoff;          /* Base offset for position */
-    size_t                 remain;           /* Amount of data remaining */
-    size_t                 curpos;           /* Current position within data */
+    char                  *mem;              /* Buffer owned by the source */
+    off_t                  baseoff;          /* Offset of the buffer start */
+    size_t                 size;             /* Size of a memory source */
+    bool                   held;             /* Set if a backslash was held */
   } data;
   unsigned int             lineno;           /* Current line within data */
+  struct parse_alias      *alias;            /* Alias whose text is read */
   bool                     isclosed;         /* Set if source has been closed */
   /* ... */
 };
@@ -70,6 +93,7 @@ struct parse_source_hdr {
 struct parse_source_cont {
   struct parse_source_hdr lifo;       /* LIFO of sources */
   struct _source_ungot    ungot;      /* Global UNGOT data */
+  off_t                   endoff;     /* Offset reached by last source */
 };
 
 /* Provide the shared functionality of using UNGOT data */
@@ -91,6 +115,70 @@ static enum srcflag pop_ungot(struct _source_ungot *ungot, char *chr)
   return SF_NODATA;
 }
 
+/* Record the position of a backslash-newline pair within the block */
+static bool add_splice(struct _source_block *blk, size_t off)
+{
+  if (blk->nsplice >= blk->maxsplice) {
+    size_t newmax = blk->maxsplice ? blk->maxsplice * 2 : 16;
+    size_t *newp = realloc(blk->splice, newmax * sizeof(size_t));
+    if (!newp) return false;
+    blk->splice = newp;
+    blk->maxsplice = newmax;
+  }
+  blk->splice[blk->nsplice++] = off;
+  return true;
+}
+
+/* Find all the backslash-newline pairs from the given offset to the end of
+ * the block, sixteen bytes at a time where the compiler provides SSE2
+ */
+static enum srcflag scan_splices(struct _source_block *blk, size_t from)
+{
+  const char *buf = blk->buf;
+  size_t len = blk->len;
+  size_t idx = from;
+
+  blk->nsplice = 0;
+  blk->cursplice = 0;
+#if defined(__SSE2__)
+  {
+    const __m128i bsl = _mm_set1_epi8('\\');
+    const __m128i eol = _mm_set1_epi8('\n');
+
+    for (; idx + 17 <= len; idx += 16) {
+      __m128i cur = _mm_loadu_si128((const __m128i *)(buf + idx));
+      __m128i nxt = _mm_loadu_si128((const __m128i *)(buf + idx + 1));
+      unsigned int mask = _mm_movemask_epi8(
+          _mm_and_si128(_mm_cmpeq_epi8(cur, bsl), _mm_cmpeq_epi8(nxt, eol)));
+      while (mask) {
+        if (!add_splice(blk, idx + __builtin_ctz(mask))) return SF_ERROR;
+        mask &= mask - 1;
+      }
+    }
+  }
+#endif
+  for (; idx + 1 < len; idx++) {
+    if (buf[idx] == '\\' && buf[idx + 1] == '\n' && !add_splice(blk, idx))
+      return SF_ERROR;
+  }
+  return SF_TRUE;
+}
+
+/* Reposition the splice cursor after the position has been moved */
+static void seek_splice(struct _source_block *blk)
+{
+  size_t low = 0, high = blk->nsplice;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (blk->splice[mid] < blk->pos)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  blk->cursplice = low;
+}
+
 #if defined(NEED_DUMMY_OPS) && NEED_DUMMY_OPS
 /* Provide some dummy functions that can be used in place of open/close */
 static enum srcflag dum_init(struct parse_source_cont *hdr,
@@ -103,13 +191,9 @@ static enum srcflag dum_fini(struct parse_source_cont *hdr,
 {
   return SF_TRUE;
 }
-static enum srcflag dum_read_char(struct parse_source *src, char *chr)
-{
-  return SF_TRUE;
-}
-static enum srcflag dum_unget_char(struct parse_source *src, char)
+static enum srcflag dum_fill(struct parse_source *src)
 {
-  return SF_TRUE;
+  return SF_NODATA;
 }
 static enum srcflag dum_tell(struct parse_source *src, off_t *pos)
 { 
@@ -129,72 +213,39 @@ static enum srcflag dum_close(struct parse_source *src)
 }
 #endif
 
-/* Define the operations that can be performed on a string source */
-static enum srcflag str_read_char(struct parse_source *src, char *chr)
-{
-  if (!src || !chr ) return SF_FALSE;
-  if (src->ungot.curpos > 0) {
-    /* Attempt to use ungot data first */
-    *chr = src->ungot.data[--src->ungot.curpos];
-  } else if (src->isclosed) {
-    /* Unable to fetch more data if it has been closed */
-    return SF_FALSE;
-  } else if (!src->data.remain) {
-    return SF_NODATA;
-  } else {
-    /* Use the next character from the data object */
-    *chr = *((char *)src->data.data + src->data.baseoff + src->data.curpos++);
-    src->data.remain--;
-  }
-  return SF_TRUE;
-}
-static enum srcflag str_unget_char(struct parse_source *src, char chr)
+/* Define the operations that can be performed on a string source, the whole
+ * string is treated as a single block
+ */
+static enum srcflag str_fill(struct parse_source *src)
 {
-  if (!src) {
-    return SF_FALSE;
-  } else if (!src->isclosed && src->data.curpos) {
-    /* Move back in the actual data */
-    src->data.curpos--;
-    src->data.remain++;
-  } else if (push_ungot(&src->ungot, chr) != SF_TRUE) {
-    /* Add to the ungot buffer */
-    return SF_FALSE;
-  }
-  return SF_TRUE;
+  if (!src || src->isclosed) return SF_FALSE;
+  return SF_NODATA;
 }
 static enum srcflag str_tell(struct parse_source *src, off_t *off)
 {
-  if (!src || !off) return SF_FALSE;
-  if (src->isclosed) {
-    if (src->ungot.curpos) {
-      *off = src->ungot.curpos;
-    } else {
-      return SF_FALSE;
-    }
-  } else if (src->data.remain) {
-    *off = src->data.baseoff + src->data.curpos;
-  } else {
-    return SF_FALSE;
-  }
+  if (!src || !off || src->isclosed) return SF_FALSE;
+  *off = src->data.baseoff + src->block.pos;
   return SF_TRUE;
 }
 static enum srcflag str_seek(struct parse_source *src, off_t off)
 {
-  if (!src || src->isclosed || off > src->data.remain)
+  if (!src || src->isclosed || off < src->data.baseoff ||
+      off - src->data.baseoff > src->block.len)
     return SF_FALSE;
-  src->data.curpos = off - src->data.baseoff;
+  src->block.pos = off - src->data.baseoff;
+  seek_splice(&src->block);
   return SF_TRUE;
 }
 static enum srcflag str_open(struct parse_source *src, void const *data)
 {
   if (!src || !data) return SF_FALSE;
   src->data.data = data;
-  src->data.remain = strlen((char *)data);
   src->data.baseoff = 0;
-  src->data.curpos = 0;
-  src->ungot.curpos = 0;
+  src->block.buf = data;
+  src->block.len = strlen((char *)data);
+  src->block.pos = 0;
   src->isclosed = false;
-  return SF_TRUE;
+  return scan_splices(&src->block, 0);
 }
 static enum srcflag str_close(struct parse_source *src)
 {
@@ -203,69 +254,145 @@ static enum srcflag str_close(struct parse_source *src)
   return SF_TRUE;
 }
 
-/* Define the operations that can be performed on a file source */
-static enum srcflag fyl_read_char(struct parse_source *src, char *chr)
+/* Define the operations that can be performed on a memory source, the block
+ * is a window onto the memory that is moved along as it is consumed so that
+ * opening the source does not have to scan the whole of the memory
+ */
+static enum srcflag mem_window(struct parse_source *src, off_t start, size_t pos)
 {
-  if (!src || !chr) return SF_FALSE;
-  if (pop_ungot(&src->ungot, chr) == SF_TRUE) {
-    return SF_TRUE;
-  } else if (src->isclosed) {
-    /* Unable to fetch more data if it has been closed */
-    return SF_FALSE;
-  } else if (!src->data.remain) {
+  struct _source_block *blk = &src->block;
+  size_t avail = src->data.size - start;
+
+  src->data.baseoff = start;
+  blk->buf = (const char *)src->data.data + start;
+  blk->pos = pos;
+  blk->len = avail < pos + SRC_BLKSIZE ? avail : pos + SRC_BLKSIZE;
+
+  /* A backslash ending the window is left for the next one, as its newline
+   * would be beyond the end of this one
+   */
+  if (blk->len < avail && blk->len > pos + 1 && blk->buf[blk->len - 1] == '\\')
+    blk->len--;
+  return scan_splices(blk, pos);
+}
+static enum srcflag mem_fill(struct parse_source *src)
+{
+  struct _source_block *blk;
+  size_t keep;
+
+  if (!src || !src->data.data || src->isclosed) return SF_FALSE;
+  blk = &src->block;
+  if (src->data.baseoff + blk->pos >= src->data.size) {
+    blk->nsplice = blk->cursplice = 0;
     return SF_NODATA;
-  } else if (src->data.data) {
-    /* Use the next character from the data object */
-    if (fread(chr, 1, 1, (FILE *)src->data.data) != 1) return SF_NODATA;
-    src->data.remain--;
-    src->data.curpos++;
-    /* ... Implement ... */
   }
-  return SF_TRUE;
+
+  /* Retain some history for ungetting */
+  keep = blk->pos < MAX_UNGOT ? blk->pos : MAX_UNGOT;
+  return mem_window(src, src->data.baseoff + blk->pos - keep, keep);
 }
-static enum srcflag fyl_unget_char(struct parse_source *src, char chr)
+static enum srcflag mem_seek(struct parse_source *src, off_t off)
 {
-  if (!src) {
-    return SF_FALSE;
-  } else if (src->data.remain) {
-    src->data.remain++;
-    src->data.curpos--;
-  } else if (push_ungot(&src->ungot, chr) != SF_TRUE) {
+  if (!src || !src->data.data || src->isclosed || off < 0 ||
+      (size_t)off > src->data.size)
     return SF_FALSE;
+  if (off >= src->data.baseoff && off - src->data.baseoff <= src->block.len) {
+    src->block.pos = off - src->data.baseoff;
+    seek_splice(&src->block);
+    return SF_TRUE;
   }
-  return SF_TRUE;
+  return mem_window(src, off, 0) == SF_ERROR ? SF_FALSE : SF_TRUE;
+}
+static enum srcflag mem_open(struct parse_source *src, void const *data)
+{
+  const struct parse_memory *mem = data;
+
+  if (!src || !mem || !mem->text) return SF_FALSE;
+  src->data.data = mem->text;
+  src->data.size = mem->len;
+  src->isclosed = false;
+  return mem_window(src, 0, 0);
+}
+
+/* Define the operations that can be performed on a file source */
+static enum srcflag fyl_fill(struct parse_source *src)
+{
+  struct _source_block *blk;
+  size_t keep, held, got;
+
+  if (!src || !src->data.data || src->isclosed) return SF_FALSE;
+  blk = &src->block;
+
+  /* Retain some history for ungetting, plus any backslash that was held back
+   * from the previous block as its newline may start this one
+   */
+  keep = blk->pos < MAX_UNGOT ? blk->pos : MAX_UNGOT;
+  held = src->data.held ? 1 : 0;
+  memmove(src->data.mem, blk->buf + blk->pos - keep, keep + held);
+  src->data.baseoff += blk->pos - keep;
+  got = fread(src->data.mem + keep + held, 1, SRC_BLKSIZE,
+      (FILE *)src->data.data);
+  if (ferror((FILE *)src->data.data)) return SF_ERROR;
+  blk->buf = src->data.mem;
+  blk->pos = keep;
+  blk->len = keep + held + got;
+  src->data.held = false;
+  if (!got && !held) {
+    blk->nsplice = blk->cursplice = 0;
+    return SF_NODATA;
+  }
+  if (got && blk->buf[blk->len - 1] == '\\') {
+    src->data.held = true;
+    blk->len--;
+  }
+  return scan_splices(blk, keep);
 }
 static enum srcflag fyl_tell(struct parse_source *src, off_t *off)
 {
   if (!src || !off || !src->data.data || src->isclosed) return SF_FALSE;
-  /* ... */
+  *off = src->data.baseoff + src->block.pos;
   return SF_TRUE;
 }
 static enum srcflag fyl_seek(struct parse_source *src, off_t off)
 {
-  if (!src || src->isclosed || off > src->data.remain)
+  struct _source_block *blk;
+
+  if (!src || !src->data.data || src->isclosed || off < 0)
     return SF_FALSE;
-  /* ... */
+  blk = &src->block;
+  if (off >= src->data.baseoff && off - src->data.baseoff <= blk->len) {
+    /* Target is within the current block */
+    blk->pos = off - src->data.baseoff;
+    seek_splice(blk);
+  } else {
+    if (fseeko((FILE *)src->data.data, off, SEEK_SET))
+      return SF_FALSE;
+    src->data.baseoff = off;
+    src->data.held = false;
+    blk->buf = src->data.mem;
+    blk->len = blk->pos = 0;
+    blk->nsplice = blk->cursplice = 0;
+  }
   return SF_TRUE;
 }
 static enum srcflag fyl_open(struct parse_source *src, void const *data)
 {
   const char *fname;
   FILE *fd;
-  struct stat stbuf;
 
   if (!src || !data) return SF_FALSE;
   fname = (const char *)data;
-  if (!(fd = fopen(fname, "rt"))) return SF_FALSE;;
-  src->data.data = fd;
-  src->data.baseoff = 0;
-  src->data.curpos = 0;
-  if (fstat(fileno(fd), &stbuf)) {
+  if (!(fd = fopen(fname, "rt"))) return SF_FALSE;
+  if (!(src->data.mem = malloc(SRC_BLKSIZE + MAX_UNGOT + 1))) {
     fclose(fd);
     return SF_FALSE;
   }
-  src->data.remain = stbuf.st_size;
-  src->ungot.curpos = 0;
+  src->data.data = fd;
+  src->data.baseoff = 0;
+  src->data.held = false;
+  src->block.buf = src->data.mem;
+  src->block.len = 0;
+  src->block.pos = 0;
   src->isclosed = false;
   return SF_TRUE;
 }
@@ -277,7 +404,10 @@ static enum srcflag fyl_close(struct parse_source *src)
   src->isclosed = true;
   fd = (FILE *)src->data.data;
   src->data.data = NULL;
-  src->data.remain = 0;
+  free(src->data.mem);
+  src->data.mem = NULL;
+  src->block.buf = NULL;
+  src->block.len = src->block.pos = 0;
   fclose(fd);
   return SF_TRUE;
 }
@@ -291,30 +421,41 @@ int init_source(struct parse_context *ctx)
         sizeof(struct parse_source_cont));
     stailq_init(ctx, ctx->source, sizeof(struct parse_source));
     ctx->source->ungot.curpos = 0;
+    ctx->source->endoff = 0;
   }
   return 0;
 }
 
 int fini_source(struct parse_context *ctx)
 {
-  /*... FIXME Need to close all outstanding sources ...*/
-  stailq_clear(ctx->source);
+  if (ctx->source) {
+    /* Close all the outstanding sources */
+    while (stailq_head(&ctx->source->lifo))
+      pop_source(ctx);
+    obstack_free(&ctx->source->lifo.memstack, NULL);
+    ctx->source = NULL;
+  }
   return 0;
 }
 
 /* Define the known operations provided */
 static struct parse_source_ops k_ops[SRC_NUM] = {
   [SRC_STRING] = {       /* String based operations */
-    .read_char = str_read_char,
-    .unget_char = str_unget_char,
+    .fill = str_fill,
     .tell = str_tell,
     .seek = str_seek,
     .open = str_open,
     .close = str_close
   },
+  [SRC_MEMORY] = {       /* Memory based operations */
+    .fill = mem_fill,
+    .tell = str_tell,
+    .seek = mem_seek,
+    .open = mem_open,
+    .close = str_close
+  },
   [SRC_FILE] = {         /* File based operations */
-    .read_char = fyl_read_char,
-    .unget_char = fyl_unget_char,
+    .fill = fyl_fill,
     .tell = fyl_tell,
     .seek = fyl_seek,
     .open = fyl_open,
@@ -324,8 +465,7 @@ static struct parse_source_ops k_ops[SRC_NUM] = {
   [SRC_DUMMY] = {                /* Dummy operations */
     .init = dum_init,
     .fini = dum_fini,
-    .read_char = dum_read_char,
-    .unget_char = dum_unget_char,
+    .fill = dum_fill,
     .tell = dum_tell,
     .seek = dum_seek,
     .open = dum_open,
@@ -342,21 +482,49 @@ struct parse_source *push_source(struct parse_context *ctx,
   if (ctx && type < SRC_NUM) {
     struct parse_source_hdr *hdr = &ctx->source->lifo;
     if (hdr) {
-      struct parse_source *node;
-      node = obstack_alloc(&hdr->memstack, sizeof(struct parse_source));
-      node->ops = &k_ops[type];
-      if (node->ops->init)
-        node->ops->init(ctx->source, node);
-      if (node->ops->open(node, data)) {
-        stailq_insert_head(hdr, node);
-        return node;
+      struct parse_source node;
+      memset(&node, 0, sizeof(struct parse_source));
+      node.ops = &k_ops[type];
+      node.lineno = 1;
+      if (node.ops->init)
+        node.ops->init(ctx->source, &node);
+      if (node.ops->open(&node, data) == SF_TRUE) {
+        /* A source given once the others are done starts the budget again */
+        if (ctx->budget && stailq_empty(hdr))
+          budget_start(ctx);
+        budget_read(ctx, node.block.len - node.block.pos);
+        return stailq_insert_head(hdr, &node);
       }
-      obstack_free(&hdr->memstack, node);
+      if (node.ops->close)
+        node.ops->close(&node);
+      free(node.block.splice);
     }
   }
   return NULL;
 }
 
+/* Remove all of the sources, along with anything that was ungot */
+void source_drop(struct parse_context *ctx)
+{
+  while (stailq_head(&ctx->source->lifo))
+    pop_source(ctx);
+  ctx->source->ungot.curpos = 0;
+}
+
+/* Add the text of an alias as the next source, the alias is released once
+ * the text has been read
+ */
+struct parse_source *push_alias(struct parse_context *ctx,
+                                const char           *text,
+                                struct parse_alias   *alias)
+{
+  struct parse_source *src = push_source(ctx, SRC_STRING, text);
+
+  if (src)
+    src->alias = alias;
+  return src;
+}
+
 /* Remove the last source from the stack of sources */
 struct parse_source *pop_source(struct parse_context *ctx)
 {
@@ -364,59 +532,146 @@ struct parse_source *pop_source(struct parse_context *ctx)
     struct parse_source_hdr *hdr = &ctx->source->lifo;
     if (hdr) {
       struct parse_source *fre = stailq_head(hdr);
+      struct parse_alias *alias = fre->alias;
       stailq_remove_head(hdr);
+      if (!fre->ops->tell || fre->ops->tell(fre, &ctx->source->endoff) != SF_TRUE)
+        ctx->source->endoff = 0;
       fre->ops->close(fre);
+      free(fre->block.splice);
       obstack_free(&hdr->memstack, fre);
+
+      /* The text of the alias is only given back once it is closed */
+      if (alias)
+        alias_release(ctx, alias);
       return stailq_head(hdr);
     }
   }
   return NULL;
 }
 
-char source_next_char(struct parse_context *ctx)
+/* Return the source with data available to be read, refilling the block and
+ * removing exhausted sources as required
+ */
+static struct parse_source *source_avail(struct parse_context *ctx)
 {
   struct parse_source_hdr *hdr;
   struct parse_source *src;
-  char chr = '\0';
 
   if (!(hdr = &ctx->source->lifo)) {
     ctx->int_error = IE_NOSOURCE;
-    return '\0';
+    return NULL;
   }
   while ((src = stailq_head(hdr)) != NULL) {
-    enum srcflag sf = src->ops->read_char(src, &chr);
-    switch (sf) {
+    if (src->block.pos < src->block.len)
+      return src;
+    if (budget_check(ctx))
+      return NULL;
+    switch (src->ops->fill(src)) {
     case SF_ERROR:
       ctx->int_error = IE_NOGETCHR;
-      return '\0';
+      return NULL;
     case SF_FALSE:
-      return '\0';
+      return NULL;
     case SF_TRUE:
+      budget_read(ctx, src->block.len - src->block.pos);
+      break;
+    case SF_NODATA:
+      pop_source(ctx);
+    default:
+      break;
+    }
+  }
+  ctx->int_error = IE_NOSOURCE;
+  return NULL;
+}
+
+/* Read the next physical character, any backslash-newline is returned as is */
+char source_next_char(struct parse_context *ctx)
+{
+  struct parse_source *src;
+  struct _source_block *blk;
+  char chr;
+
+  if (pop_ungot(&ctx->source->ungot, &chr) == SF_TRUE)
+    return chr;
+  if (!(src = source_avail(ctx)))
+    return '\0';
+  blk = &src->block;
+  chr = blk->buf[blk->pos++];
+  if (blk->cursplice < blk->nsplice && blk->splice[blk->cursplice] < blk->pos)
+    blk->cursplice++;
+#if SHPARSE_DEBUG == 2
+  fprintf(stderr, "READCHAR => %c\n", chr);
+#endif
+  if (chr == '\n')
+    src->lineno++;
+  return chr;
+}
+
+/* Read the next logical character a character at a time, this is the
+ * reference for the use of the backslash-newline pairs found on filling
+ */
+static char ref_next_char_eatbnl(struct parse_context *ctx)
+{
+  char chr, nxt;
+
+  while ((chr = source_next_char(ctx)) == '\\') {
+    if ((nxt = source_next_char(ctx)) != '\n') {
+      if (nxt != PEOF)
+        source_unget_char(ctx, nxt);
+      break;
+    }
+  }
+  return chr;
+}
+
+/* Read the next logical character, skipping over any backslash-newline pairs
+ * found when the block was filled
+ */
+char source_next_char_eatbnl(struct parse_context *ctx)
+{
+  struct parse_source *src;
+  struct _source_block *blk;
+  char chr;
+
+  if (ctx->reference)
+    return ref_next_char_eatbnl(ctx);
+  if (pop_ungot(&ctx->source->ungot, &chr) == SF_TRUE)
+    return chr;
+  while ((src = source_avail(ctx)) != NULL) {
+    blk = &src->block;
+    while (blk->cursplice < blk->nsplice &&
+           blk->splice[blk->cursplice] == blk->pos) {
+      blk->pos += 2;
+      blk->cursplice++;
+      src->lineno++;
+    }
+    if (blk->pos < blk->len) {
+      chr = blk->buf[blk->pos++];
 #if SHPARSE_DEBUG == 2
       fprintf(stderr, "READCHAR => %c\n", chr);
 #endif
       if (chr == '\n')
         src->lineno++;
       return chr;
-    case SF_NODATA:
-      pop_source(ctx);
-    default:
-      break;
     }
   }
-  ctx->int_error = IE_NOSOURCE;
   return '\0';
 }
 
+/* Step back over the given character in the current source */
 void source_unget_char(struct parse_context *ctx, char chr)
 {
   if (ctx) {
     struct parse_source *src = stailq_head(&ctx->source->lifo);
-    if (src && src->ops->unget_char) {
-      if (src->ops->unget_char(src, chr) != SF_TRUE) {
-        ctx->int_error = IE_NOUNGET;
-      } 
-    } else if (push_ungot(&ctx->source->ungot, chr) != SF_TRUE) {
+    if (src && src->block.pos) {
+      struct _source_block *blk = &src->block;
+      if (blk->buf[--blk->pos] == '\n')
+        src->lineno--;
+      if (blk->cursplice && blk->splice[blk->cursplice - 1] >= blk->pos)
+        blk->cursplice--;
+    } else if (chr != PEOF &&
+               push_ungot(&ctx->source->ungot, chr) != SF_TRUE) {
       ctx->int_error = IE_NOUNGET;
     }
   }
@@ -424,16 +679,7 @@ void source_unget_char(struct parse_context *ctx, char chr)
 
 void source_unget(struct parse_context *ctx)
 {
-  if (ctx) {
-    struct parse_source *src = stailq_head(&ctx->source->lifo);
-    if (src) {
-      if (src->ops->unget_char(src, ctx->cur_char) != SF_TRUE) {
-        ctx->int_error = IE_NOUNGET;
-      }
-    } else if (push_ungot(&ctx->source->ungot, ctx->cur_char) != SF_TRUE) {
-      ctx->int_error = IE_NOUNGET;
-    }
-  }
+  source_unget_char(ctx, ctx->cur_char);
 }
 
 unsigned int source_currline(struct parse_context *ctx)
@@ -449,3 +695,88 @@ unsigned int source_currline(struct parse_context *ctx)
   }
   return 0;
 }
+
+/* Set the number of the line the current source is reading */
+void source_setline(struct parse_context *ctx, unsigned int lineno)
+{
+  struct parse_source *src;
+
+  if (ctx && (src = stailq_head(ctx->source)))
+    src->lineno = lineno;
+}
+
+/* Provide the whole text of the current source when it is held in memory and
+ * nothing has been ungot, so that offsets within it can be read again
+ */
+bool source_text(struct parse_context *ctx, const char **text, size_t *len)
+{
+  struct parse_source *src = stailq_head(&ctx->source->lifo);
+
+  if (!src || src->isclosed || ctx->source->ungot.curpos)
+    return false;
+  if (src->ops == &k_ops[SRC_STRING]) {
+    *text = src->data.data;
+    *len = src->block.len;
+  } else if (src->ops == &k_ops[SRC_MEMORY]) {
+    *text = src->data.data;
+    *len = src->data.size;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/* Return the length of the text of the current source, or zero if it is not
+ * known
+ */
+size_t source_size(struct parse_context *ctx)
+{
+  struct parse_source *src = stailq_head(&ctx->source->lifo);
+  const char *text;
+  struct stat st;
+  size_t len;
+
+  if (source_text(ctx, &text, &len))
+    return len;
+  if (src && !src->isclosed && src->ops == &k_ops[SRC_FILE] &&
+      !fstat(fileno((FILE *)src->data.data), &st) && st.st_size > 0)
+    return st.st_size;
+  return 0;
+}
+
+/* Return the offset of the next character to be read from the source */
+size_t source_curroff(struct parse_context *ctx)
+{
+  if (ctx) {
+    struct parse_source *src;
+    off_t off;
+
+    if (!(src = stailq_head(ctx->source)))
+      return ctx->source->endoff;
+    if (src->ops->tell && src->ops->tell(src, &off) == SF_TRUE)
+      return off;
+  }
+  return 0;
+}
+
+/* Return true if the only source is the one the caller pushed and nothing
+ * has been ungot, so that the offset within it is all that is read from
+ */
+bool source_sole(struct parse_context *ctx)
+{
+  struct parse_source *src = stailq_head(&ctx->source->lifo);
+
+  return src && !src->next && !src->alias && !src->isclosed &&
+      !ctx->source->ungot.curpos;
+}
+
+/* Move the current source to the given offset within it */
+bool source_seek(struct parse_context *ctx, size_t off)
+{
+  struct parse_source *src = stailq_head(&ctx->source->lifo);
+
+  if (!src || !src->ops->seek || src->ops->seek(src, off) != SF_TRUE)
+    return false;
+  ctx->source->ungot.curpos = 0;
+  return true;
+}
@@ -89,8 +89,13 @@ enum parse_tokid findkwd(const char *text)
   return INV_PARSER_TOKEN;
 }
 
-/* Declare the functions called by the main tokenizer function */
-static bool int_readtoken(struct parse_context *ctx, struct parse_token *tok);
+/* Retrieve the next token from an alias being expanded, or else the source */
+static inline void next_token(struct parse_context *ctx,
+                              struct parse_token   *tok)
+{
+  if (!alias_next_token(ctx, tok))
+    int_readtoken(ctx, tok);
+}
 
 #if SHPARSE_DEBUG > 0
 static void dump_parse_tokid(FILE *fd, const char *pmt, struct parse_token *tok)
@@ -145,15 +150,23 @@ enum parse_tokid readtoken(struct parse_context *ctx)
   struct parse_token tok;
   struct parse_tokflags savekwd = ctx->chkflags;
 
-/*  while (true) {*/
-    /* Perform the reread logic here */
+  /* Read no further once a limit has been reached */
+  if (budget_check(ctx))
+    return TEOF;
+
+  while (true) {
+    /* Perform the reread logic here, a newline that was pushed back is eaten
+     * below when newlines are being skipped, as in the original parser
+     */
     if (ctx->tokpushback) {
       ctx->tokpushback = false;
-      return ctx->last_token.id;
+      if (ctx->last_token.id != TNL || !savekwd.chknl)
+        return ctx->last_token.id;
+      tok = ctx->last_token;
+    } else {
+      /* Retrieve the next token, either from an alias or the source */
+      next_token(ctx, &tok);
     }
-
-    /* Call the internal function to actually retrieve the next token */
-    int_readtoken(ctx, &tok);
 #if SHPARSE_DEBUG > 0
     dump_parse_tokid(stderr, "INTTOKEN", &tok);
 #endif
@@ -162,6 +175,8 @@ enum parse_tokid readtoken(struct parse_context *ctx)
     if (savekwd.chknl) {
       while (tok.id == TNL) {
         parseheredoc(ctx);
+        if (ctx->synerror.code != SE_NONE)
+          return INV_PARSER_TOKEN;
         set_tokflags(&ctx->chkflags, tf_false, tf_false, tf_false, tf_keep);
 
         /* Perform the reread logic here */
@@ -170,8 +185,8 @@ enum parse_tokid readtoken(struct parse_context *ctx)
           return ctx->last_token.id;
         }
 
-        /* Call the internal function to actually retrieve the next token */
-        int_readtoken(ctx, &tok);
+        /* Retrieve the next token, either from an alias or the source */
+        next_token(ctx, &tok);
       }
     }
 
@@ -188,17 +203,84 @@ enum parse_tokid readtoken(struct parse_context *ctx)
       enum parse_tokid kwd = findkwd(token_text(tok));
       if (kwd != INV_PARSER_TOKEN) {
         tok.id = kwd;
+        tok.flags |= WF_KEYWORD;
         ctx->last_token = tok;
         return kwd;
       }
     }
 
-    if (savekwd.chkalias) {
-      /* TODO: Implement?? as not really executing the code */
-    }
+    /* Replace an alias by its value and reread, the first word of the value
+     * is checked in the same way as the word it replaced
+     */
+    if (savekwd.chkalias && alias_expand(ctx, &tok))
+      continue;
     ctx->last_token = tok;
     return tok.id;
-/*  }*/
+  }
+}
+
+/* Define the state of a backquoted command being parsed where it lies in the
+ * source. Its characters are read through each of the backquotes it is
+ * within, which remove the backslashes quoting the characters special to
+ * them, and the unquoted backquote that ends it is read as the end of input.
+ */
+struct parse_bquote {
+  struct parse_bquote *outer;         /* Backquote this one is within */
+  bool                 dblquote;      /* Set if within double quotes */
+  bool                 ended;         /* Set once the end has been read */
+  bool                 haslook;       /* Set if a character was looked at */
+  bool                 hasunget;      /* Set if a character was stepped back */
+  char                 look;          /* Character read beyond a backslash */
+  char                 unget;         /* Character stepped back over */
+};
+
+static char bq_next_char(struct parse_context *, struct parse_bquote *);
+
+/* Read the next character of the text a backquoted command lies within */
+static inline char bq_input(struct parse_context *ctx, struct parse_bquote *bq)
+{
+  if (bq->haslook) {
+    bq->haslook = false;
+    return bq->look;
+  }
+  if (bq->outer)
+    return bq_next_char(ctx, bq->outer);
+  return source_next_char_eatbnl(ctx);
+}
+
+/* Read the next character of a backquoted command, as it would have been
+ * found had its text been copied with the quoting of the backquote removed
+ */
+static char bq_next_char(struct parse_context *ctx, struct parse_bquote *bq)
+{
+  char chr, nxt;
+
+  if (bq->hasunget) {
+    bq->hasunget = false;
+    return bq->unget;
+  }
+  while (!bq->ended) {
+    switch (chr = bq_input(ctx, bq)) {
+    case '`':
+      bq->ended = true;
+      break;
+
+    case '\\':
+      nxt = bq_input(ctx, bq);
+      if (nxt == '\n')
+        continue;
+      if (nxt == '\\' || nxt == '`' || nxt == '$' ||
+          (bq->dblquote && nxt == '"'))
+        return nxt;
+      bq->look = nxt;
+      bq->haslook = true;
+      return chr;
+
+    default:
+      return chr;
+    }
+  }
+  return PEOF;
 }
 
 /* Provide a file reader which will skip esacped newlines */
@@ -208,44 +290,56 @@ static inline char next_char(struct parse_context *ctx)
 
   ctx->lst_char[1] = ctx->lst_char[0];
   ctx->lst_char[0] = ctx->cur_char;
-  ctx->cur_char = chr = source_next_char(ctx);
+  ctx->cur_char = chr = ctx->bquote ? bq_next_char(ctx, ctx->bquote)
+                                    : source_next_char(ctx);
   return chr;
 }
 
 static inline char next_char_eatbnl(struct parse_context *ctx)
 {
-  char chr;
+  char chr = ctx->bquote ? bq_next_char(ctx, ctx->bquote)
+                         : source_next_char_eatbnl(ctx);
 
-  while ((chr = source_next_char(ctx)) == '\\') {
-    if (source_next_char(ctx) != '\n') {
-      source_unget(ctx);
-      break;
-    }
-  }
   ctx->lst_char[1] = ctx->lst_char[0];
   ctx->lst_char[0] = ctx->cur_char;
   ctx->cur_char = chr;
   return chr;
 }
 
+/* Step back over the last character read */
+static inline void unget_char(struct parse_context *ctx)
+{
+  if (ctx->bquote) {
+    ctx->bquote->unget = ctx->cur_char;
+    ctx->bquote->hasunget = true;
+  } else {
+    source_unget(ctx);
+  }
+}
+
 static bool syn_readtoken(struct parse_context *,
                           struct parse_token   *,
                           enum   parse_toksyn,
                           struct parse_heredoc *);
 
-/* Declare the internal tokenizer function */
-static bool int_readtoken(struct parse_context *ctx,
-                          struct parse_token   *tok)
+/* Add a control character to the current word, noting it in the word flags */
+static inline void grow_ctlchar(struct parse_context *ctx, char ctl)
 {
-  if (!ctx || !tok) return false;
- 
-  /* Clear out any existing data from the token */
-  tok->id = INV_PARSER_TOKEN;
-  tok->val.node = NULL;
+  obstack_1grow(&ctx->txtstack, ctl);
+  if (ctl == CTLESC || ctl == CTLQUOTEMARK)
+    ctx->wordflags |= WF_CTLCHAR;
+  else
+    ctx->wordflags |= WF_CTLCHAR | WF_EXPAND;
+}
 
+/* Declare the internal tokenizer function */
+static bool int_lextoken(struct parse_context *ctx,
+                         struct parse_token   *tok)
+{
   /* Repeat checking until a token or word is found */
   while (true) {
     char chr = next_char_eatbnl(ctx);
+    tok->offset = source_curroff(ctx) - (chr != PEOF);
     switch (chr) {
       case ' ':
       case '\t':
@@ -253,7 +347,7 @@ static bool int_readtoken(struct parse_context *ctx,
 
       case '#':
         while ((chr = next_char(ctx)) != '\n' && chr != PEOF);
-        source_unget(ctx);
+        unget_char(ctx);
         continue;
 
       case '\n':
@@ -268,7 +362,7 @@ static bool int_readtoken(struct parse_context *ctx,
         if (next_char_eatbnl(ctx) == '&') {
           tok->id = TAND;
         } else {
-          source_unget(ctx);
+          unget_char(ctx);
           tok->id = TBACKGND;
         }
         return true;
@@ -277,7 +371,7 @@ static bool int_readtoken(struct parse_context *ctx,
         if (next_char_eatbnl(ctx) == '|') {
           tok->id = TOR;
         } else {
-          source_unget(ctx);
+          unget_char(ctx);
           tok->id = TPIPE;
         } 
         return true;
@@ -286,7 +380,7 @@ static bool int_readtoken(struct parse_context *ctx,
         if (next_char_eatbnl(ctx) == ';') {
           tok->id = TENDCASE;
         } else {
-          source_unget(ctx);
+          unget_char(ctx);
           tok->id = TSEMI;
         }
         return true;
@@ -303,6 +397,33 @@ static bool int_readtoken(struct parse_context *ctx,
   }
 }
 
+bool int_readtoken(struct parse_context *ctx,
+                   struct parse_token   *tok)
+{
+  bool ret;
+
+  if (!ctx || !tok) return false;
+ 
+  /* Clear out any existing data from the token */
+  tok->id = INV_PARSER_TOKEN;
+  tok->val.node = NULL;
+  tok->flags = WF_NONE;
+
+  /* Note the extent of the token within the source, the tokens of a
+   * backquoted command not being read from the text as it lies there */
+#if SHADOW_LEXER
+  if (ctx->shadow && !ctx->bquote)
+    shadow_sample(ctx);
+#endif
+  ret = int_lextoken(ctx, tok);
+  tok->length = source_curroff(ctx) - tok->offset;
+#if SHADOW_LEXER
+  if (ctx->shadow && !ctx->bquote && ret)
+    shadow_check(ctx, tok);
+#endif
+  return ret;
+}
+
 static inline struct parse_syntax *
 push_syntax(struct parse_context *ctx,
             enum parse_toksyn     type)
@@ -317,13 +438,18 @@ push_syntax(struct parse_context *ctx,
   node.innerdq = false;
   node.varpushed = false;
   node.dblquote = false;
+  node.arithloc = 0;
+  node.arith = NULL;
   return dtailq_insert_head(ctx->lst_syntax, &node);
 }
 
 static inline struct parse_syntax *
 pop_syntax(struct parse_context *ctx)
 {
-  return dtailq_remove_head(ctx->lst_syntax);
+  struct parse_syntax *syn = dtailq_remove_head(ctx->lst_syntax);
+  if (syn)
+    obstack_free(&ctx->lst_syntax->memstack, syn);
+  return dtailq_head(ctx->lst_syntax);
 }
 
 /* Return the tokenizer representation of the given character and syntax table */
@@ -492,8 +618,7 @@ static enum parse_chrid syn_lookup(struct parse_syntax *syn, char chr)
 
 static void int_parseredir(struct parse_context *, char, char);
 static void int_parsesub(struct parse_context *);
-static void int_parsebackquote_old(struct parse_context *);
-static void int_parsebackquote_new(struct parse_context *);
+static void int_parsebackquote(struct parse_context *, bool);
 
 static bool syn_readtoken(struct parse_context *ctx,
                           struct parse_token   *tok,
@@ -502,42 +627,65 @@ static bool syn_readtoken(struct parse_context *ctx,
 {
   struct obstack *nctx = &ctx->memstack;
   struct obstack *sctx = &ctx->txtstack;
-  struct parse_syntax *cursyn;
+  struct parse_syntax *cursyn, *outer;
   char *txt;
   char chr = ctx->cur_char;
   bool loop_newline;
+  bool markseen = false;
 
   /* Push the given syntax onto the stack */
   cursyn = push_syntax(ctx, syntab);
+  outer = cursyn->next;
   ctx->quoteflag = false;
-  stailq_clear(ctx->backquote);
+  ctx->wordflags = WF_NONE;
+  ctx->bqlist = NULL;
+  ctx->bqtail = &ctx->bqlist;
+  ctx->arith = NULL;
+  ctx->arithtail = &ctx->arith;
+  seg_reset(ctx);
+  if (heredoc)
+    heredoc->started = true;
 
   /* Keep processing lines until the end_of_word is flagged */
   do {
     bool end_of_word = false;     /* Set on end of word */
     loop_newline = false;         /* Set to redo loop */
+
+    /* A word of many lines ends early once a limit has been reached */
+    if (budget_check(ctx))
+      chr = PEOF;
     if (heredoc && heredoc->eofmark && heredoc->eofmark != FAKEEOFMARK) {
       char *ptr;
-      bool nosave = false;
+      size_t markloc;
 
       if (heredoc->striptabs) {
         while (chr == '\t') 
           chr = next_char(ctx);
       }
 
+      /* Check for the end mark, the characters compared are kept in the
+       * document until the whole mark has been seen
+       */
+      markloc = obstack_object_size(sctx);
       for (ptr = heredoc->eofmark; obstack_1grow(sctx, chr), *ptr; ptr++) {
-        if (chr != *ptr) {
-          nosave = true;
+        if (chr != *ptr)
           break;
-        }
         chr = next_char(ctx);
       }
-      if (nosave) {
-        obstack_free(sctx, obstack_finish(sctx));
-      } else if (chr == '\n' || chr == PEOF) {
+      if (!*ptr && (chr == '\n' || chr == PEOF)) {
+        obstack_blank_fast(sctx, -(ptrdiff_t)(obstack_object_size(sctx) - markloc));
+        markseen = heredoc->ended = true;
         chr = PEOF;
       } else {
-        push_source(ctx, SRC_STRING, obstack_finish(sctx));
+        /* Not the end mark so reread everything after the first character */
+        char *base = (char *)obstack_base(sctx) + markloc;
+        size_t len = obstack_object_size(sctx) - markloc - 1;
+
+        chr = *base;
+        if (len)
+          push_source(ctx, SRC_STRING,
+              obstack_copy0(&ctx->memstack, base + 1, len));
+        obstack_blank_fast(sctx, -(ptrdiff_t)(len + 1));
       }
     }
 
@@ -554,6 +702,7 @@ static bool syn_readtoken(struct parse_context *ctx,
         else
           chr = next_char_eatbnl(ctx);
         loop_newline = true;
+        end_of_word = true;
         break;
 
       case CWORD:
@@ -562,24 +711,24 @@ static bool syn_readtoken(struct parse_context *ctx,
 
       case CCTL:
         if (!heredoc || cursyn->dblquote || cursyn->varnest)
-          obstack_1grow(sctx, CTLESC);
+          grow_ctlchar(ctx, CTLESC);
         obstack_1grow(sctx, chr);
         break;
 
       case CBACK:
         chr = next_char(ctx);
         if (chr == PEOF) {
-          obstack_1grow(sctx, CTLESC);
+          grow_ctlchar(ctx, CTLESC);
           obstack_1grow(sctx, '\\');
-          source_unget(ctx);
+          unget_char(ctx);
         } else {
           if (cursyn->dblquote && chr != '\\' && chr != '`' && chr != '$' &&
               (chr != '"' || (heredoc && !cursyn->varnest)) &&
               (chr != '}' || !cursyn->varnest)) {
-            obstack_1grow(sctx, CTLESC);
+            grow_ctlchar(ctx, CTLESC);
             obstack_1grow(sctx, '\\');
           }
-          obstack_1grow(sctx, CTLESC);
+          grow_ctlchar(ctx, CTLESC);
           obstack_1grow(sctx, chr);
           ctx->quoteflag = true;
         }
@@ -588,7 +737,7 @@ static bool syn_readtoken(struct parse_context *ctx,
       case CSQUOTE:
         cursyn->type = SYN_SQUOTE;
         if (!heredoc)
-          obstack_1grow(sctx, CTLQUOTEMARK);
+          grow_ctlchar(ctx, CTLQUOTEMARK);
         break;
 
       case CDQUOTE:
@@ -597,7 +746,7 @@ static bool syn_readtoken(struct parse_context *ctx,
         if (cursyn->varnest)
           cursyn->innerdq ^= true;
         if (!heredoc)
-          obstack_1grow(sctx, CTLQUOTEMARK);
+          grow_ctlchar(ctx, CTLQUOTEMARK);
         break;
 
       case CENDQUOTE:
@@ -613,11 +762,14 @@ static bool syn_readtoken(struct parse_context *ctx,
         if (chr == '"' && cursyn->varnest)
           cursyn->innerdq ^= true;
         if (!heredoc)
-          obstack_1grow(sctx, CTLQUOTEMARK);
+          grow_ctlchar(ctx, CTLQUOTEMARK);
         break;
 
       case CVAR:
         int_parsesub(ctx);
+        if (ctx->synerror.code != SE_NONE)
+          goto fail;
+        cursyn = dtailq_head(ctx->lst_syntax);
         break;
 
       case CENDVAR:
@@ -626,7 +778,9 @@ static bool syn_readtoken(struct parse_context *ctx,
             cursyn = pop_syntax(ctx);
           else if (cursyn->dqvarnest)
             cursyn->dqvarnest--;
-          obstack_1grow(sctx, CTLENDVAR);
+          grow_ctlchar(ctx, CTLENDVAR);
+          if (ctx->wordsegments)
+            seg_end(ctx, obstack_object_size(sctx));
         } else {
           obstack_1grow(sctx, chr);
         }
@@ -644,11 +798,17 @@ static bool syn_readtoken(struct parse_context *ctx,
         } else {
           chr = next_char_eatbnl(ctx);
           if (chr == ')') {
-            obstack_1grow(sctx, CTLENDARI);
+            if (!ctx->checkonly)
+              arith_compile(ctx, cursyn->arith,
+                  (char *)obstack_base(sctx) + cursyn->arithloc,
+                  obstack_object_size(sctx) - cursyn->arithloc);
+            grow_ctlchar(ctx, CTLENDARI);
+            if (ctx->wordsegments)
+              seg_end(ctx, obstack_object_size(sctx));
             cursyn = pop_syntax(ctx);
           } else {
             obstack_1grow(sctx, ')');
-            source_unget(ctx);
+            unget_char(ctx);
           }
         }
         break;
@@ -657,11 +817,16 @@ static bool syn_readtoken(struct parse_context *ctx,
         if (ctx->chkflags.chkeofmark) {
           obstack_1grow(sctx, '`');
         } else {
-          int_parsebackquote_old(ctx);
+          int_parsebackquote(ctx, true);
+          if (ctx->synerror.code != SE_NONE)
+            goto fail;
         }
         break;
 
       case CEOF:
+        /* Note a here-document that was ended by the end of the input */
+        if (heredoc && !markseen)
+          ctx->heredoceof = heredoc->ended = true;
         end_of_word = true;
         break;
 
@@ -689,6 +854,8 @@ static bool syn_readtoken(struct parse_context *ctx,
   } else if (cursyn->varnest) {
     ctx_synerror(ctx, SE_MISSING, -1, "}"); goto fail;
   }
+  while (dtailq_head(ctx->lst_syntax) != outer)
+    pop_syntax(ctx);
   obstack_1grow(sctx, '\0');
   size_t txtlen = obstack_object_size(sctx);
   txt = obstack_finish(sctx);
@@ -698,24 +865,34 @@ static bool syn_readtoken(struct parse_context *ctx,
       int_parseredir(ctx, chr, *txt);
       tok->id = TREDIR;
     } else {
-      source_unget(ctx);
+      unget_char(ctx);
       tok->id = TWORD;
       tok->val.value.text = txt;
       tok->val.value.len = txtlen;
+      tok->flags = ctx->wordflags | (ctx->quoteflag ? WF_QUOTED : WF_NONE);
     }
   } else {
     tok->id = TWORD;
     tok->val.value.text = txt;
     tok->val.value.len = txtlen;
+    tok->flags = ctx->wordflags | (ctx->quoteflag ? WF_QUOTED : WF_NONE);
   }
   return true;
 fail:
+  /* Whatever the word left open is noted so that it can be skipped */
+  while ((cursyn = dtailq_head(ctx->lst_syntax)) != outer) {
+    if (!heredoc && recover_enabled(ctx))
+      recover_syntax(ctx, cursyn);
+    pop_syntax(ctx);
+  }
   obstack_free(sctx, obstack_finish(sctx));
   obstack_free(nctx, obstack_finish(nctx));
   return false;
 }
 
-/* Process a here document */
+/* Process the here documents, stopping at one that holds a syntax error to
+ * leave it and those that follow to be skipped if errors are recovered from
+ */
 void parseheredoc(struct parse_context *ctx)
 {
   if (ctx->lst_heredoc) {
@@ -732,7 +909,33 @@ void parseheredoc(struct parse_context *ctx)
         syntab = SYN_DQUOTE;
       }
   
-      if (!syn_readtoken(ctx, &tok, syntab, hereptr)) {
+      if (ctx->events) {
+        event_begin(ctx, hereptr->here->type, source_currline(ctx));
+        if (syn_readtoken(ctx, &tok, syntab, hereptr)) {
+          event_word(ctx, &tok, 0);
+          event_end(ctx, hereptr->here->type);
+        }
+      } else if (syn_readtoken(ctx, &tok, syntab, hereptr)) {
+        union parse_node *doc = narg_alloc(ctx);
+
+        doc->type = NARG;
+        doc->narg.next = NULL;
+        doc->narg.text = ctx->checkonly ? token_text(tok) :
+            obstack_copy0(&ctx->memstack, token_text(tok), token_length(tok));
+        doc->narg.textlen = token_length(tok) - 1;
+        doc->narg.backquote = ctx->bqlist;
+        doc->narg.arith = ctx->arith;
+        doc->narg.flags = tok.flags;
+        doc->narg.seg = NULL;
+        doc->narg.nseg = 0;
+        if (ctx->wordsegments)
+          doc->narg.seg = seg_copy(ctx, token_length(tok) - 1, &doc->narg.nseg);
+        hereptr->here->nhere.doc = doc;
+      }
+      if (ctx->synerror.code != SE_NONE) {
+        if (recover_enabled(ctx))
+          recover_heredoc(ctx);
+        break;
       }
     }
     stailq_clear(ctx->lst_heredoc);
@@ -742,8 +945,9 @@ void parseheredoc(struct parse_context *ctx)
 /* The following is the revised code found for PARSEREDIR */
 static void int_parseredir(struct parse_context *ctx, char chr, char fd)
 {
-  union parse_node *np = node_alloc(ctx);
+  union parse_node *np = &ctx->cur_redir;
 
+  np->nfile.next = NULL;
   switch (chr) {
   case '>':
     np->nfile.fd = 1;
@@ -763,7 +967,7 @@ static void int_parseredir(struct parse_context *ctx, char chr, char fd)
 
     default:
       np->type = NTO;
-      source_unget(ctx);
+      unget_char(ctx);
     }
     break;
 
@@ -774,9 +978,8 @@ static void int_parseredir(struct parse_context *ctx, char chr, char fd)
       np->type = NHERE;
       np->nhere.fd = 0;
       chr = next_char_eatbnl(ctx);
-      ctx->cur_heredoc.here = np;
       if (!(ctx->cur_heredoc.striptabs = (chr == '-'))) {
-        source_unget(ctx);
+        unget_char(ctx);
       }
       break;
 
@@ -793,12 +996,12 @@ static void int_parseredir(struct parse_context *ctx, char chr, char fd)
     default:
       np->type = NFROM;
       np->nfile.fd = 0;
-      source_unget(ctx);
+      unget_char(ctx);
     }
-    if (isdigit(fd))
-      np->nfile.fd = fd - '0';
+    break;
   }
-  memcpy(&ctx->cur_redir, np, sizeof(union parse_node));
+  if (isdigit(fd))
+    np->nfile.fd = fd - '0';
 }
 
 /* The following is the revised code found for PARSESUB */
@@ -816,15 +1019,26 @@ static void int_parsesub(struct parse_context *ctx)
     chr = next_char_eatbnl(ctx);
     if (chr == '(') {
       struct parse_syntax *cursyn = push_syntax(ctx, SYN_ARITH);
+      union parse_node *n = narith_alloc(ctx);
+
+      /* The expression is compiled once its end is reached */
+      n->type = NARITH;
+      n->narith.next = NULL;
+      *ctx->arithtail = n;
+      ctx->arithtail = &n->narith.next;
       cursyn->dblquote = true;
-      obstack_1grow(sctx, CTLARI);
+      cursyn->arith = n;
+      if (ctx->wordsegments)
+        seg_begin(ctx, SEG_ARITH, obstack_object_size(sctx), true);
+      grow_ctlchar(ctx, CTLARI);
+      cursyn->arithloc = obstack_object_size(sctx);
     } else {
-      source_unget(ctx);
-      int_parsebackquote_new(ctx);
+      unget_char(ctx);
+      int_parsebackquote(ctx, false);
     }
   } else if (chr != '{' && !is_name(chr) && !is_special(chr)) {
     obstack_1grow(sctx, '$');
-    source_unget(ctx);
+    unget_char(ctx);
   } else {
     size_t typeloc;                  /* Offset to byte storing type info */
     enum parse_varsubs subtype;
@@ -832,7 +1046,7 @@ static void int_parsesub(struct parse_context *ctx)
     struct parse_syntax *cursyn = ctx->lst_syntax->first;
     enum parse_toksyn newsyn = cursyn->type;
 
-    obstack_1grow(sctx, CTLVAR);
+    grow_ctlchar(ctx, CTLVAR);
     typeloc = obstack_object_size(sctx);
     obstack_1grow(sctx, '\0');
     if (chr == '{') {
@@ -863,7 +1077,7 @@ static void int_parsesub(struct parse_context *ctx)
           cc = chr;
           chr = next_char_eatbnl(ctx);
           if (cc == '}' || chr == '}') {
-            source_unget(ctx);
+            unget_char(ctx);
             subtype = VSNONE;
             chr = cc;
             cc = '#';
@@ -882,7 +1096,7 @@ static void int_parsesub(struct parse_context *ctx)
       break;
     }
     if (badsub) {
-      source_unget(ctx);
+      unget_char(ctx);
     } else if (!subtype) {
       char cc = chr;
       switch (chr) {
@@ -891,9 +1105,9 @@ static void int_parsesub(struct parse_context *ctx)
 
       case ':':
         chr = next_char_eatbnl(ctx);
+        subtype = VSNUL;
         switch (chr) {
         default:
-          subtype = VSNUL;
           break;
 
         case '}':
@@ -943,7 +1157,7 @@ static void int_parsesub(struct parse_context *ctx)
         if (chr == cc) {
           subtype = VSTRIMRIGHTMAX;
         } else {
-          source_unget(ctx);
+          unget_char(ctx);
           subtype = VSTRIMRIGHT;
         }
         newsyn = SYN_BASE;
@@ -955,7 +1169,7 @@ static void int_parsesub(struct parse_context *ctx)
           subtype = VSTRIMLEFTMAX;
         } else {
           subtype = VSTRIMLEFT;
-          source_unget(ctx);
+          unget_char(ctx);
         }
         newsyn = SYN_BASE;
         break;
@@ -963,7 +1177,7 @@ static void int_parsesub(struct parse_context *ctx)
     } else {
       if (subtype == VSLENGTH && chr != '}')
         subtype = VSNONE;
-      source_unget(ctx);
+      unget_char(ctx);
     }
     if (newsyn == SYN_ARITH)
       newsyn = SYN_DQUOTE;
@@ -974,6 +1188,8 @@ static void int_parsesub(struct parse_context *ctx)
     }
     obstack_1grow(sctx, '=');
     *(char *)(obstack_base(sctx) + typeloc) = VSBIT | subtype;
+    if (ctx->wordsegments)
+      seg_var(ctx, obstack_base(sctx), typeloc - 1, obstack_object_size(sctx));
     if (subtype != VSNORMAL) {
       cursyn->varnest++;
       if (cursyn->dblquote)
@@ -982,50 +1198,263 @@ static void int_parsesub(struct parse_context *ctx)
   }
 }
 
-/* Parse an old backquote sequence, `...` */
-static void int_parsebackquote_old(struct parse_context *ctx)
+/* Parse a command substitution, either the new form $(...) or the old form
+ * `...`, where it lies in the source. The word read so far is left open
+ * while the commands are parsed, their words being read into text of their
+ * own, and the state of the word is put aside along with any here documents
+ * still to be read, which would otherwise be taken by the words and newlines
+ * of the commands.
+ */
+static void int_parsebackquote(struct parse_context *ctx, bool oldstyle)
 {
-/* FIXME: Uncomment when finishing code
-  struct parse_nodelist  newnode;
-*/
-  struct obstack        *sctx = &ctx->txtstack;
-  char chr;
+  struct parse_nodelist *bqlist = ctx->bqlist, **bqtail = ctx->bqtail, *bq;
+  union parse_node *arith = ctx->arith, **arithtail = ctx->arithtail, *n;
+  struct parse_segbuf *segbuf = ctx->segbuf;
+  struct parse_heredoc_hdr *heredoc = ctx->lst_heredoc, nestdoc;
+  struct parse_tokflags chkflags = ctx->chkflags;
+  struct parse_token last = ctx->last_token;
+  enum parse_wordflags wordflags = ctx->wordflags;
+  bool quoteflag = ctx->quoteflag;
+  struct parse_syntax *cursyn;
+  struct parse_bquote bquote;
+
+  if (ctx->wordsegments) {
+    struct parse_segment *seg = seg_begin(ctx, SEG_BACKQ,
+        obstack_object_size(&ctx->txtstack), false);
+    if (seg)
+      seg->length = 1;
+    segbuf = ctx->segbuf;
+    ctx->segbuf = NULL;
+  }
+  if (!stailq_empty(heredoc)) {
+    stailq_init(ctx, &nestdoc, sizeof(struct parse_heredoc));
+    ctx->lst_heredoc = &nestdoc;
+  }
+  if (oldstyle) {
+    memset(&bquote, 0, sizeof(struct parse_bquote));
+    bquote.outer = ctx->bquote;
+    cursyn = dtailq_head(ctx->lst_syntax);
+    bquote.dblquote = cursyn->dblquote;
+    ctx->bquote = &bquote;
+  }
 
-  obstack_1grow(sctx, CTLBACKQ);
-  do {
-    struct parse_syntax *syn = dtailq_tail(ctx->lst_syntax);
+  n = parse_subst(ctx, oldstyle);
 
-    chr = next_char_eatbnl(ctx);
-    switch (chr) {
-    case '`':
-      break;
+  /* The end of the substitution is left to be skipped unless it was where
+   * the error was found
+   */
+  if (ctx->synerror.code != SE_NONE && recover_enabled(ctx) &&
+      (oldstyle ? !bquote.ended : ctx->last_token.id != TRP))
+    recover_close(ctx, oldstyle ? '`' : ')');
+  if (oldstyle) {
+    if (ctx->synerror.code == SE_NONE && !bquote.ended)
+      ctx_synerror(ctx, SE_BACKEOF, -1, "EOF in backquote substitution");
+    ctx->bquote = bquote.outer;
+  }
+  if (ctx->lst_heredoc != heredoc) {
+    stailq_concat(heredoc, &nestdoc);
+    obstack_free(&nestdoc.memstack, NULL);
+    ctx->lst_heredoc = heredoc;
+  }
+  if (ctx->wordsegments) {
+    seg_free(ctx);
+    ctx->segbuf = segbuf;
+  }
+  ctx->bqlist = bqlist;
+  ctx->bqtail = bqtail;
+  ctx->arith = arith;
+  ctx->arithtail = arithtail;
+  ctx->chkflags = chkflags;
+  ctx->last_token = last;
+  ctx->wordflags = wordflags;
+  ctx->quoteflag = quoteflag;
+
+  /* Add the commands to those of the word */
+  bq = nodelist_alloc(ctx);
+  bq->node = n;
+  bq->next = NULL;
+  *ctx->bqtail = bq;
+  ctx->bqtail = &bq->next;
+  grow_ctlchar(ctx, CTLBACKQ);
+}
 
-    case '\\':
-      chr = next_char(ctx);
-      if (chr != '\\' && chr != ' ' && chr != '$' && 
-          (syn->dblquote || chr != '"')) {
-        obstack_1grow(sctx, '\\');
-      }
-      obstack_1grow(sctx, chr);
-      break;
+/* Enlarge the arrays of a token stream, all the arrays share a single block
+ * of memory which is replaced by one twice the size when full
+ */
+static bool stream_grow(struct parse_token_stream *out)
+{
+  size_t alloc = out->alloc ? out->alloc * 2 : 256;
+  char *arena;
+  struct parse_token_stream grown;
+
+  if (!(arena = malloc(alloc * (2 * sizeof(uint32_t) + 4 * sizeof(uint8_t)))))
+    return false;
+  grown.start = (uint32_t *)arena;
+  grown.length = grown.start + alloc;
+  grown.id = (uint8_t *)(grown.length + alloc);
+  grown.flags = grown.id + alloc;
+  grown.redir = grown.flags + alloc;
+  grown.redirfd = grown.redir + alloc;
+  if (out->count) {
+    memcpy(grown.start, out->start, out->count * sizeof(uint32_t));
+    memcpy(grown.length, out->length, out->count * sizeof(uint32_t));
+    memcpy(grown.id, out->id, out->count);
+    memcpy(grown.flags, out->flags, out->count);
+    memcpy(grown.redir, out->redir, out->count);
+    memcpy(grown.redirfd, out->redirfd, out->count);
+  }
+  free(out->arena);
+  out->start = grown.start;
+  out->length = grown.length;
+  out->id = grown.id;
+  out->flags = grown.flags;
+  out->redir = grown.redir;
+  out->redirfd = grown.redirfd;
+  out->arena = arena;
+  out->alloc = alloc;
+  return true;
+}
 
-    case PEOF:
-      ctx_synerror(ctx, SE_BACKEOF, -1, "EOF in backquote substitution");
-      return;
+/* Add the last token read to the token stream */
+static bool stream_add(struct parse_token_stream *out,
+                       struct parse_token        *tok,
+                       union parse_node          *redir)
+{
+  size_t idx = out->count;
+
+  if (idx >= out->alloc && !stream_grow(out))
+    return false;
+  out->start[idx] = tok->offset;
+  out->length[idx] = tok->length;
+  out->id[idx] = tok->id;
+  out->flags[idx] = tok->flags;
+  out->redir[idx] = redir ? redir->type : INV_PARSER_NODE;
+  out->redirfd[idx] = redir ? redir->nfile.fd : 0;
+  out->count++;
+  return true;
+}
 
-    case '\n':
-    default:
-      obstack_1grow(sctx, chr);
-      break;
-    }
-  } while (chr != '`');
-  obstack_1grow(sctx, '\0');
-  push_source(ctx, SRC_STRING, obstack_finish(sctx));
+/* Replace the tokens from one index up to another of the token stream with
+ * all the tokens of a second stream
+ */
+bool token_stream_splice(struct parse_token_stream       *out,
+                         size_t                           from,
+                         size_t                           to,
+                         const struct parse_token_stream *ins)
+{
+  size_t count = out->count - (to - from) + ins->count;
+
+  while (count > out->alloc)
+    if (!stream_grow(out))
+      return false;
+#define SPLICE_ARRAY(fld)                                                    \
+  if (out->count > to)                                                      \
+    memmove(out->fld + from + ins->count, out->fld + to,                    \
+            (out->count - to) * sizeof(*out->fld));                         \
+  if (ins->count)                                                           \
+    memcpy(out->fld + from, ins->fld, ins->count * sizeof(*out->fld))
+  SPLICE_ARRAY(start);
+  SPLICE_ARRAY(length);
+  SPLICE_ARRAY(id);
+  SPLICE_ARRAY(flags);
+  SPLICE_ARRAY(redir);
+  SPLICE_ARRAY(redirfd);
+#undef SPLICE_ARRAY
+  out->count = count;
+  return true;
+}
+
+/* Add the next token of the sources to the token stream, the state notes
+ * where keywords may be recognised and is updated for the following token.
+ * Returns the token added, TEOF at the end of the sources or
+ * INV_PARSER_TOKEN if the token could not be read.
+ */
+enum parse_tokid tokenize_next(struct parse_context      *ctx,
+                               struct parse_token_stream *out,
+                               unsigned char             *state)
+{
+  enum parse_tokid tokid;
+  unsigned char cur = *state & ~TS_CHKKWD;
+
+  set_tokflags(&ctx->chkflags, tf_false,
+               *state & TS_CHKKWD ? tf_true : tf_false, tf_false, tf_false);
+  tokid = readtoken(ctx);
+  if (tokid == INV_PARSER_TOKEN || ctx->synerror.code != SE_NONE)
+    return INV_PARSER_TOKEN;
+  if (tokid == TEOF)
+    return TEOF;
+
+  if (tokid == TREDIR) {
+    union parse_node *redir = node_copy(ctx, &ctx->cur_redir);
+    struct parse_token savtok = ctx->last_token;
+
+    /* Read the target of the redirection and any here document mark */
+    parsefname(ctx, redir);
+    if (ctx->synerror.code != SE_NONE)
+      return INV_PARSER_TOKEN;
+    if (!stream_add(out, &savtok, redir) ||
+        !stream_add(out, &ctx->last_token, NULL))
+      return INV_PARSER_TOKEN;
+    *state = cur;
+    return tokid;
+  }
+  if (!stream_add(out, &ctx->last_token, NULL))
+    return INV_PARSER_TOKEN;
+
+  /* Determine if the next token may be a keyword */
+  switch (tokid) {
+  case TWORD:
+    if (cur == TS_FORVAR || cur == TS_CASEWORD)
+      *state = (cur == TS_FORVAR ? TS_FORIN : TS_CASEIN) | TS_CHKKWD;
+    else
+      *state = cur;
+    break;
+
+  case TFOR:
+    *state = TS_FORVAR;
+    break;
+
+  case TCASE:
+    *state = TS_CASEWORD;
+    break;
+
+  case TIN:
+    *state = cur == TS_CASEIN ? TS_NONE | TS_CHKKWD : TS_NONE;
+    break;
+
+  case TNL:
+    parseheredoc(ctx);
+    if (ctx->synerror.code != SE_NONE)
+      return INV_PARSER_TOKEN;
+    /* FALLTHROUGH */
+  default:
+    *state = TS_NONE | TS_CHKKWD;
+    break;
+  }
+  return tokid;
+}
 
-  /* .. FIXME Complete implementation .. */
+/* Tokenize the remainder of the sources into the given token stream, the
+ * keywords are only recognised where a command may start
+ */
+bool tokenize_all(struct parse_context *ctx, struct parse_token_stream *out)
+{
+  unsigned char state = TS_NONE | TS_CHKKWD;
+  enum parse_tokid tokid;
+
+  if (!ctx || !out) return false;
+  memset(out, 0, sizeof(struct parse_token_stream));
+  while ((tokid = tokenize_next(ctx, out, &state)) != TEOF)
+    if (tokid == INV_PARSER_TOKEN)
+      return false;
+  return true;
 }
 
-/* Parse a new backquote sequence, $(...) */
-static void int_parsebackquote_new(struct parse_context *ctx)
+/* Release the memory used by a token stream */
+void token_stream_free(struct parse_token_stream *out)
 {
+  if (out) {
+    free(out->arena);
+    memset(out, 0, sizeof(struct parse_token_stream));
+  }
 }
@@ -0,0 +1,126 @@
+/*
+ * This source provides the removal of the quoting from the text of a word,
+ * that is the CTLQUOTEMARK characters and the CTLESC characters that precede
+ * quoted characters. Where the processor allows, the control characters are
+ * searched for a vector of bytes at a time, as most of the text of a word is
+ * normally copied unchanged.
+ */
+
+#include <string.h>
+#include "parser.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define UNESC_VECLEN 32
+typedef __m256i unesc_vec;
+#define unesc_load(ptr)       _mm256_loadu_si256((const __m256i *)(ptr))
+#define unesc_store(ptr, vec) _mm256_storeu_si256((__m256i *)(ptr), vec)
+#define unesc_mask(vec)                                                        \
+  (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(                              \
+      _mm256_cmpeq_epi8(vec, _mm256_set1_epi8(CTLESC)),                        \
+      _mm256_cmpeq_epi8(vec, _mm256_set1_epi8(CTLQUOTEMARK))))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define UNESC_VECLEN 16
+typedef __m128i unesc_vec;
+#define unesc_load(ptr)       _mm_loadu_si128((const __m128i *)(ptr))
+#define unesc_store(ptr, vec) _mm_storeu_si128((__m128i *)(ptr), vec)
+#define unesc_mask(vec)                                                        \
+  (uint32_t)_mm_movemask_epi8(_mm_or_si128(                                    \
+      _mm_cmpeq_epi8(vec, _mm_set1_epi8(CTLESC)),                              \
+      _mm_cmpeq_epi8(vec, _mm_set1_epi8(CTLQUOTEMARK))))
+#endif
+
+/* Copy the text of the word with the quoting removed into the given buffer,
+ * which must be at least one more than the length of the text and may be the
+ * text itself, returning the length of the result which is terminated by a NUL
+ */
+size_t word_unescape(const char *text, size_t len, char *out)
+{
+  const char *src = text, *end = text + len;
+  char *dst = out;
+
+  while (src < end) {
+    const char *stop = end;
+
+#ifdef UNESC_VECLEN
+    /* Move whole vectors until one contains a control character, which is
+     * then moved a character at a time. The destination never passes the
+     * source so a vector can only be stored over text already read.
+     */
+    if (end - src >= UNESC_VECLEN) {
+      unesc_vec vec = unesc_load(src);
+
+      if (!unesc_mask(vec)) {
+        unesc_store(dst, vec);
+        src += UNESC_VECLEN;
+        dst += UNESC_VECLEN;
+        continue;
+      }
+      stop = src + UNESC_VECLEN;
+    }
+#endif
+    while (src < stop) {
+      if (*src == CTLQUOTEMARK) {
+        src++;
+        continue;
+      }
+      if (*src == CTLESC && ++src == end)
+        break;
+      *dst++ = *src++;
+    }
+  }
+  *dst = '\0';
+  return dst - out;
+}
+
+/* Return the value of a word that contains no expansions, either its text when
+ * the tokenizer found no control characters in it or the text with the quoting
+ * removed in the given buffer of the given size, or NULL if the value is only
+ * known on expansion. NULL is also returned if the buffer is too small for the
+ * value, the size of the buffer needed being stored in the given location,
+ * which is otherwise set to the length of the value.
+ */
+const char *word_literal(union parse_node *n,
+                         char             *buf,
+                         size_t            bufsize,
+                         size_t           *len)
+{
+  size_t textlen;
+
+  if (len)
+    *len = 0;
+  if (!n || n->type != NARG || (n->narg.flags & WF_EXPAND))
+    return NULL;
+  textlen = n->narg.textlen;
+  if (!(n->narg.flags & WF_CTLCHAR)) {
+    if (len)
+      *len = textlen;
+    return n->narg.text;
+  }
+
+  /* The value is never longer than the text, so only a buffer smaller than
+   * the text needs the length of the value to be found first
+   */
+  if (!buf || bufsize <= textlen) {
+    const char *src = n->narg.text, *end = src + textlen;
+    size_t need = 1;
+
+    for (; src < end; src++) {
+      if (*src == CTLQUOTEMARK)
+        continue;
+      if (*src == CTLESC && ++src == end)
+        break;
+      need++;
+    }
+    if (!buf || need > bufsize) {
+      if (len)
+        *len = need;
+      return NULL;
+    }
+  }
+  textlen = word_unescape(n->narg.text, textlen, buf);
+  if (len)
+    *len = textlen;
+  return buf;
+}